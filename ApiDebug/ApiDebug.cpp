@@ -22,11 +22,18 @@
 #include <stdexcept>
 #include <vector>
 #include <array>
+#include <chrono>
 
 #define LEB_IMPLEMENTATION
 #include "LongestEdgeBisection.h"
+#include "LongestEdgeBisectionCPU.h"
+
+#define LEBSNAP_IMPLEMENTATION
+#include "LongestEdgeBisectionSnapshot.h"
+#include "Bintree.h"
 
 #define VIEWPORT_WIDTH 800
+#define BUFFER_BINDING_LEB 1
 
 #ifndef PATH_TO_SRC_DIRECTORY
 #   define PATH_TO_SRC_DIRECTORY "./"
@@ -57,188 +64,246 @@ struct OpenGLManager {
     GLuint nodeBuffer;
     GLuint texture;
     GLuint programs[PROGRAM_COUNT];
-} g_gl = {0, 0, 0, {0}};
+    struct {
+        uint32_t *data;     // persistently mapped node buffer
+        uint32_t capacity;  // in nodes
+        uint32_t version;   // bintree version of the current data
+        GLsync fence;       // signaled once the GPU is done reading the data
+    } nodeStorage;
+    GLuint heapBuffer;
+    struct {
+        int minDepth, maxDepth; // depths of the heap buffer, -1 if invalid
+        lebcpu_HeapDelta delta; // heap words to upload
+        uint32_t byteSize;      // bytes uploaded by the last update
+        uint32_t rangeCount;    // glBufferSubData calls of the last update
+    } heapStorage;
+} g_gl = {0, 0, 0, {0}, {NULL, 0, ~0u, 0}, 0, {-1, -1, lebcpu_HeapDelta(), 0, 0}};
 
 enum {MODE_TRIANGLE, MODE_QUAD};
 struct DemoParameters {
     int mode;
     int minDepth, maxDepth;
+    int threadCount;
     uint32_t activeNode;
     dja::vec2 target;
     float radius;
-    struct {bool reset, freeze;} flags;
+    struct {bool reset, freeze, heapUpload;} flags;
 } g_params = {
-    MODE_TRIANGLE, 1, 5, 0, dja::vec2(0.4f, 0.1f), 0.0f, {true, false}
+    MODE_TRIANGLE, 1, 5, lebcpu_HardwareThreadCount(), 0, dja::vec2(0.4f, 0.1f), 0.0f, {true, false, false}
 };
 
 // -----------------------------------------------------------------------------
-float wedge(const dja::vec2& a, const dja::vec2& b)
+lebcpu_Mode bintreeMode()
 {
-    return a.x * b.y - a.y * b.x;
+    return g_params.mode == MODE_TRIANGLE ? LEBCPU_MODE_TRIANGLE
+                                          : LEBCPU_MODE_QUAD;
 }
 
-struct triangle {
-    dja::vec2 v[3];
-    triangle(const dja::vec2& a, const dja::vec2& b, const dja::vec2& c) {
-        v[0].x = a.x; v[0].y = a.y;
-        v[1].x = b.x; v[1].y = b.y;
-        v[2].x = c.x; v[2].y = c.y;
-    }
-
-    bool contains(const dja::vec2 &p) const {
-        const float e = 0.0f;
-        float w1 = wedge(v[1] - v[0], p - v[0]);
-        float w2 = wedge(v[2] - v[1], p - v[1]);
-        float w3 = wedge(v[0] - v[2], p - v[2]);
+bintree g_bintree(bintreeMode(),
+                  g_params.minDepth,
+                  g_params.maxDepth,
+                  g_params.threadCount);
 
-        return (w1 <= e && w2 <= e && w3 <= e) || (w1 >= -e && w2 >= -e && w3 >= -e);
-    }
+// -----------------------------------------------------------------------------
+// the snapshot file of each mode
+const char *snapshotPath(char *buf)
+{
+    return strcat2(buf, g_app.dir.output, g_params.mode == MODE_TRIANGLE
+                                          ? "ApiDebug_Triangle.leb"
+                                          : "ApiDebug_Quad.leb");
+}
 
-    bool contains(const dja::vec2 &p, float r) const {
-        bool res = contains(p);
-        int cnt = 256;
+// warm starts from the snapshot of the current mode, if any
+bool loadSnapshot()
+{
+    char buf[1024];
 
-        for (int i = 0; i < cnt && !res; ++i) {
-            float u = i / float(cnt);
-            float a = u * 2 * M_PI;
-            float x = cos(a), y = sin(a);
+    if (!g_bintree.loadSnapshot(snapshotPath(buf)))
+        return false;
 
-            res = res || contains(p + r * dja::vec2(x, y));
-        }
+    LOG("Loading {Snapshot} %s\n", buf);
+    g_params.minDepth = g_bintree.m_leb->minDepth;
+    g_params.maxDepth = g_bintree.m_leb->maxDepth;
 
-        return res;
-    }
-};
+    return true;
+}
 
-// triangle
-struct bintree {
-    leb_Heap *m_leb;
-    int m_pingPong;
+void saveSnapshot()
+{
+    char buf[1024];
 
-    bintree() {
-        m_leb = leb_CreateMinMax(g_params.minDepth, g_params.maxDepth);
-        m_pingPong = 0;
-        leb_ResetToRoot(m_leb);
+    if (g_bintree.saveSnapshot(snapshotPath(buf))) {
+        LOG("Saving {Snapshot} %s\n", buf);
     }
+}
 
-    void reset(int minDepth, int maxDepth) {
-        leb_Release(m_leb);
-        m_leb = leb_CreateMinMax(minDepth, maxDepth);
-        leb_ResetToRoot(m_leb);
+// -----------------------------------------------------------------------------
+// builds the tree with increasing thread counts and compares the timings and
+// resulting heaps against the serial reference
+void logScalingReport()
+{
+    const int runCount = 3;
+    const int maxThreadCount = lebcpu_HardwareThreadCount();
+    const uint32_t byteSize = leb__HeapByteSize(g_params.maxDepth);
+    bintree reference(bintreeMode(), g_params.minDepth, g_params.maxDepth, 1);
+    bintree tree(bintreeMode(), g_params.minDepth, g_params.maxDepth, 1);
+    double serialTime = 1e30;
+
+    reference.m_radius = tree.m_radius = g_params.radius;
+
+    for (int i = 0; i < runCount; ++i) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        reference.build(g_params.target, g_params.maxDepth, true);
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        serialTime = std::min(serialTime,
+            std::chrono::duration<double, std::milli>(t1 - t0).count());
     }
 
-    void build(const dja::vec2 &target, int maxLevel) {
-        leb_ResetToRoot(m_leb);
-
-        for (int i = 0; i < maxLevel; ++i) {
-            updateOnce(target);
+    LOG("-- Scaling Report (%s, depth %i..%i, radius %.3f, %u nodes)\n",
+        g_params.mode == MODE_TRIANGLE ? "triangle" : "quad",
+        g_params.minDepth, g_params.maxDepth, g_params.radius,
+        leb_NodeCount(reference.m_leb));
+    LOG("threads | build (ms) | speedup | identical\n");
+    LOG(" serial | %10.3f | %7.2f | -\n", serialTime, 1.0);
+
+    for (int threadCount = 1;; threadCount = std::min(2 * threadCount,
+                                                      maxThreadCount)) {
+        double time = 1e30;
+
+        tree.setThreadCount(threadCount);
+        for (int i = 0; i < runCount; ++i) {
+            auto t0 = std::chrono::high_resolution_clock::now();
+            tree.build(g_params.target, g_params.maxDepth);
+            auto t1 = std::chrono::high_resolution_clock::now();
+
+            time = std::min(time,
+                std::chrono::duration<double, std::milli>(t1 - t0).count());
         }
-    }
 
-    bool testTarget(const leb_Node &node, const dja::vec2 &target) const
-    {
-        float attribArray[][3] = {
-            {0.0f, 0.0f, 1.0f},
-            {1.0f, 0.0f, 0.0f}
-        };
+        bool identical = !memcmp(tree.m_leb->buffer,
+                                 reference.m_leb->buffer,
+                                 byteSize);
 
-        if (g_params.mode == MODE_TRIANGLE)
-            leb_DecodeNodeAttributeArray(node, 2, attribArray);
-        else
-            leb_DecodeNodeAttributeArray_Quad(node, 2, attribArray);
+        LOG("%7i | %10.3f | %7.2f | %s\n",
+            threadCount, time, serialTime / time, identical ? "yes" : "NO");
 
-        dja::vec2 a = dja::vec2(attribArray[0][0], attribArray[1][0]),
-                  b = dja::vec2(attribArray[0][1], attribArray[1][1]),
-                  c = dja::vec2(attribArray[0][2], attribArray[1][2]);
-
-        return triangle(a, b, c).contains(target, g_params.radius);
+        if (threadCount == maxThreadCount)
+            break;
     }
+}
 
-    void updateOnce(const dja::vec2 &target)
-    {
-        uint32_t cnt = leb_NodeCount(m_leb);
-
-        // update
-        for (uint32_t i = 0; i < cnt; ++i) {
-            leb_Node node = leb_DecodeNode(m_leb, i);
-
-            if /* splitting pass */(m_pingPong == 0 && !g_params.flags.freeze) {
-                bool isInside = testTarget(node, target);
-
-                /* split */
-                if (isInside) {
-                    if (g_params.mode == MODE_TRIANGLE) {
-                        leb_SplitNodeConforming(m_leb, node);
-                    } else {
-                        leb_SplitNodeConforming_Quad(m_leb, node);
-                    }
-                }
-            } else if /* merging pass */(m_pingPong == 1 && !g_params.flags.freeze) {
-                leb_DiamondParent diamond;
-
-                if (g_params.mode == MODE_TRIANGLE) {
-                    diamond = leb_DecodeDiamondParent(node);
-                } else {
-                    diamond = leb_DecodeDiamondParent_Quad(node);
-                }
-
-                bool shouldMerge = !testTarget(diamond.base, target)
-                                 && !testTarget(diamond.top, target);
-
-                if (shouldMerge) {
-                    if (g_params.mode == MODE_TRIANGLE) {
-                        leb_MergeNodeConforming(m_leb, node, diamond);
-                    } else {
-                        leb_MergeNodeConforming_Quad(m_leb, node, diamond);
-                    }
-                }
-            }
-        }
 
-        leb_ComputeSumReduction(m_leb);
+// -----------------------------------------------------------------------------
 
-        precomputeNodes();
-        m_pingPong = 1 - m_pingPong;
-    }
+// the node buffer is persistently mapped and only rewritten when the tree
+// changed; its storage is reallocated with twice the capacity when too small
+void loadNodeBuffer()
+{
+    const uint32_t nodeCount = (uint32_t)g_bintree.size();
 
+    if (g_gl.nodeStorage.version == g_bintree.m_version)
+        return;
 
-    std::vector<uint32_t> precomputeNodes() const
-    {
-        uint32_t nodeCount = leb_NodeCount(m_leb);
-        std::vector<uint32_t> dataOut(nodeCount);
+    if (nodeCount > g_gl.nodeStorage.capacity) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT
+                               | GL_MAP_PERSISTENT_BIT
+                               | GL_MAP_COHERENT_BIT;
+        uint32_t capacity = std::max(nodeCount, 2u * g_gl.nodeStorage.capacity);
+        GLsizeiptr byteSize = sizeof(uint32_t) * capacity;
+
+        if (glIsBuffer(g_gl.nodeBuffer))
+            glDeleteBuffers(1, &g_gl.nodeBuffer);
+        glGenBuffers(1, &g_gl.nodeBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gl.nodeBuffer);
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, byteSize, NULL, flags);
+        g_gl.nodeStorage.data = (uint32_t *)
+            glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, byteSize, flags);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_gl.nodeBuffer);
+
+        if (!g_gl.nodeStorage.data)
+            throw std::runtime_error("node buffer mapping error");
+
+        g_gl.nodeStorage.capacity = capacity;
+    } else if (g_gl.nodeStorage.fence) {
+        // wait for the GPU to finish reading the previous data
+        while (glClientWaitSync(g_gl.nodeStorage.fence,
+                                GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000) == GL_TIMEOUT_EXPIRED);
+    }
 
-        for (uint32_t i = 0; i < nodeCount; ++i) {
-            uint32_t nodeID = leb_DecodeNode(m_leb, i).id;
+    if (g_gl.nodeStorage.fence) {
+        glDeleteSync(g_gl.nodeStorage.fence);
+        g_gl.nodeStorage.fence = 0;
+    }
 
-            dataOut[i] = nodeID;
-        }
+    g_bintree.precomputeNodes(g_gl.nodeStorage.data);
+    g_gl.nodeStorage.version = g_bintree.m_version;
+}
 
-        return dataOut;
+// the heap buffer mirrors the CPU heap with the layout of the LEB GLSL
+// library; only the heap words modified since the previous call are uploaded,
+// with nearby words merged into a single glBufferSubData
+void loadHeapBuffer()
+{
+    const leb_Heap *leb = g_bintree.m_leb;
+    const uint32_t heapByteSize = leb__HeapByteSize(leb->maxDepth);
+    lebcpu_HeapDelta *delta = &g_gl.heapStorage.delta;
+
+    if (g_gl.heapStorage.minDepth != leb->minDepth
+        || g_gl.heapStorage.maxDepth != leb->maxDepth) {
+        if (glIsBuffer(g_gl.heapBuffer))
+            glDeleteBuffers(1, &g_gl.heapBuffer);
+        glGenBuffers(1, &g_gl.heapBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gl.heapBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     heapByteSize + 2 * sizeof(int32_t),
+                     NULL,
+                     GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                        0,
+                        sizeof(int32_t),
+                        &leb->minDepth);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                        sizeof(int32_t),
+                        sizeof(int32_t),
+                        &leb->maxDepth);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+                         BUFFER_BINDING_LEB,
+                         g_gl.heapBuffer);
+
+        g_gl.heapStorage.minDepth = leb->minDepth;
+        g_gl.heapStorage.maxDepth = leb->maxDepth;
+        lebcpu_FillHeapDelta(delta, leb);
     }
 
-    int size() const {
-        return (int)leb_NodeCount(m_leb);
-    }
+    lebcpu_CoalesceHeapDelta(delta, 16u);
+    g_gl.heapStorage.byteSize = 4u * lebcpu_HeapDeltaWordCount(delta);
+    g_gl.heapStorage.rangeCount = (uint32_t)delta->ranges.size();
 
-} g_bintree;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gl.heapBuffer);
+    for (size_t i = 0; i < delta->ranges.size(); ++i) {
+        const lebcpu_WordRange &range = delta->ranges[i];
 
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER,
+                        2 * sizeof(int32_t) + 4u * range.begin,
+                        4u * (range.end - range.begin),
+                        &leb->buffer[range.begin]);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-// -----------------------------------------------------------------------------
+    lebcpu_ClearHeapDelta(delta);
+}
 
-void loadNodeBuffer()
+// uploads the tree in the representation the triangle program reads
+void loadTreeBuffer()
 {
-    const std::vector<uint32_t> nodeIDs = g_bintree.precomputeNodes();
-
-    if (glIsBuffer(g_gl.nodeBuffer))
-        glDeleteBuffers(1, &g_gl.nodeBuffer);
-    glGenBuffers(1, &g_gl.nodeBuffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gl.nodeBuffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER,
-                 sizeof(nodeIDs[0]) * nodeIDs.size(),
-                 &nodeIDs[0],
-                 GL_STATIC_DRAW);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_gl.nodeBuffer);
+    if (g_params.flags.heapUpload)
+        loadHeapBuffer();
+    else
+        loadNodeBuffer();
 }
 
 void loadEmptyVertexArray()
@@ -276,6 +341,10 @@ void loadTriangleProgram()
         djgp_push_string(djp, "#define MODE_TRIANGLE\n");
     else
         djgp_push_string(djp, "#define MODE_QUAD\n");
+    if (g_params.flags.heapUpload) {
+        djgp_push_string(djp, "#define LEB_BUFFER_COUNT 1\n");
+        djgp_push_string(djp, "#define BUFFER_BINDING_LEB %i\n", BUFFER_BINDING_LEB);
+    }
 
     djgp_push_file(djp, PATH_TO_LEB_GLSL_LIBRARY "LongestEdgeBisection.glsl");
     djgp_push_file(djp, strcat2(buf, g_app.dir.shader, "Triangle.glsl"));
@@ -293,10 +362,11 @@ void loadTriangleProgram()
 // (typically before entering the game loop)
 void load(int /*argc*/, char **/*argv*/)
 {
-    g_bintree.build(g_params.target, g_params.maxDepth);
+    if (!loadSnapshot())
+        g_bintree.buildTopDown(g_params.target);
 
     loadEmptyVertexArray();
-    loadNodeBuffer();
+    loadTreeBuffer();
     loadPointProgram();
     loadTriangleProgram();
 }
@@ -309,6 +379,9 @@ void release()
     for (int i = 0; i < PROGRAM_COUNT; ++i)
         glDeleteProgram(g_gl.programs[i]);
     glDeleteBuffers(1, &g_gl.nodeBuffer);
+    glDeleteBuffers(1, &g_gl.heapBuffer);
+    if (g_gl.nodeStorage.fence)
+        glDeleteSync(g_gl.nodeStorage.fence);
 }
 
 // -----------------------------------------------------------------------------
@@ -321,6 +394,9 @@ void renderTriangleScene()
     glBindVertexArray(g_gl.vertexArray);
         glDrawArraysInstanced(GL_TRIANGLES, 0, 3, g_bintree.size());
     glBindVertexArray(0);
+    if (g_gl.nodeStorage.fence)
+        glDeleteSync(g_gl.nodeStorage.fence);
+    g_gl.nodeStorage.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 
     // target helper
     glViewport(256, 0, VIEWPORT_WIDTH, VIEWPORT_WIDTH);
@@ -342,7 +418,7 @@ void renderTriangleScene()
 void render()
 {
     g_bintree.updateOnce(g_params.target);
-    loadNodeBuffer();
+    loadTreeBuffer();
 
     glClearColor(0.8, 0.8, 0.8, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -366,24 +442,58 @@ void renderGui()
         };
         if (ImGui::Combo("Mode", &g_params.mode, &eModes[0], 2)) {
             loadTriangleProgram();
-            g_bintree.reset(g_params.minDepth, g_params.maxDepth);
+            g_bintree.reset(bintreeMode(), g_params.minDepth, g_params.maxDepth);
         }
         if (ImGui::SliderInt("MinDepth", &g_params.minDepth, 0, g_params.maxDepth)) {
-            g_bintree.reset(g_params.minDepth, g_params.maxDepth);
+            g_bintree.reset(bintreeMode(), g_params.minDepth, g_params.maxDepth);
         }
         if (ImGui::SliderInt("MaxDepth", &g_params.maxDepth, std::max(5, g_params.minDepth), 29)) {
-            g_bintree.reset(g_params.minDepth, g_params.maxDepth);
+            g_bintree.reset(bintreeMode(), g_params.minDepth, g_params.maxDepth);
         }
         ImGui::SliderFloat("TargetX", &g_params.target.x, 0, 1);
         ImGui::SliderFloat("TargetY", &g_params.target.y, 0, 1);
-        ImGui::SliderFloat("Radius", &g_params.radius, 0, 1);
+        if (ImGui::SliderFloat("Radius", &g_params.radius, 0, 1)) {
+            g_bintree.m_radius = g_params.radius;
+        }
+        if (ImGui::SliderInt("Threads", &g_params.threadCount, 1, lebcpu_HardwareThreadCount())) {
+            g_bintree.setThreadCount(g_params.threadCount);
+        }
         if (ImGui::Button("Reset Tree")) {
-            g_bintree.build(g_params.target, g_params.maxDepth);
-            loadNodeBuffer();
+            g_bintree.buildTopDown(g_params.target);
+            loadTreeBuffer();
+        }
+        if (ImGui::Checkbox("Freeze", &g_params.flags.freeze)) {
+            g_bintree.m_freeze = g_params.flags.freeze;
+        }
+        if (ImGui::Checkbox("Heap Upload", &g_params.flags.heapUpload)) {
+            g_bintree.m_delta = g_params.flags.heapUpload
+                              ? &g_gl.heapStorage.delta : NULL;
+            g_gl.heapStorage.minDepth = g_gl.heapStorage.maxDepth = -1;
+            g_gl.nodeStorage.version = ~0u;
+            loadTriangleProgram();
+        }
+        if (g_params.flags.heapUpload) {
+            ImGui::Text("Upload: %u Bytes (%u ranges)",
+                        g_gl.heapStorage.byteSize,
+                        g_gl.heapStorage.rangeCount);
+        }
+        if (ImGui::Button("Scaling Report")) {
+            logScalingReport();
+        }
+        if (ImGui::Button("Save Snapshot")) {
+            saveSnapshot();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Load Snapshot")) {
+            loadSnapshot();
         }
-        ImGui::Checkbox("Freeze", &g_params.flags.freeze);
         ImGui::Text("Mem Usage: %u Bytes", leb__HeapByteSize(g_params.maxDepth));
         ImGui::Text("Nodes: %u", g_bintree.size());
+        ImGui::Text("Reduction Nodes: %u", g_bintree.m_reductionNodeCount);
+        ImGui::Text("Splits: %u Merges: %u%s",
+                    g_bintree.m_splitCount,
+                    g_bintree.m_mergeCount,
+                    g_bintree.converged() ? " (converged)" : "");
         ImGui::Text("Bounding Node: %u",
                     g_params.mode == MODE_TRIANGLE ?
                                     leb_BoundingNode(g_bintree.m_leb,
@@ -1,13 +1,21 @@
+// with BUFFER_BINDING_LEB, the nodes are decoded from a copy of the CPU heap
+#ifndef BUFFER_BINDING_LEB
 layout (std430, binding = 0)
 buffer TreeBuffer {
     uint u_NodeIDs[];
 };
+#endif
 
 #ifdef VERTEX_SHADER
 void main()
 {
+#ifdef BUFFER_BINDING_LEB
+    const int lebID = 0;
+    leb_Node node = leb_DecodeNode(lebID, gl_InstanceID);
+#else
     uint nodeID = u_NodeIDs[gl_InstanceID];
     leb_Node node = leb_Node(nodeID, findMSB(nodeID));
+#endif
     vec3 xPos = vec3(0, 0, 1), yPos = vec3(1, 0, 0);
 #if defined(MODE_TRIANGLE)
     mat2x3 posMatrix = leb_DecodeNodeAttributeArray(node, mat2x3(xPos, yPos));
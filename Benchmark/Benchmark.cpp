@@ -0,0 +1,973 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Longest Edge Bisection (LEB) Headless CPU Benchmark
+//
+// Drives the split/merge/reduction loop of the ApiDebug demo along a scripted
+// target trajectory and reports timings as JSON. No OpenGL context required.
+// With --terrain or --heightmap, drives the level-of-detail pipeline of the
+// Terrain demo instead (see TerrainCPU.h), for a camera flying over the
+// trajectory.
+//
+#define DJ_ALGEBRA_IMPLEMENTATION 1
+#include "dj_algebra.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#define LEB_IMPLEMENTATION
+#include "LongestEdgeBisection.h"
+#include "LongestEdgeBisectionCPU.h"
+
+#define LEBSNAP_IMPLEMENTATION
+#include "LongestEdgeBisectionSnapshot.h"
+#include "Bintree.h"
+
+#define HMAP_IMPLEMENTATION
+#include "HeightmapContainer.h"
+#include "TerrainCPU.h"
+
+#define LOG(fmt, ...)  fprintf(stderr, fmt, ##__VA_ARGS__); fflush(stderr);
+
+// -----------------------------------------------------------------------------
+enum {
+    TRAJECTORY_STATIC,
+    TRAJECTORY_LINE,
+    TRAJECTORY_CIRCLE,
+    TRAJECTORY_LISSAJOUS,
+
+    TRAJECTORY_COUNT
+};
+const char *g_trajectoryNames[TRAJECTORY_COUNT] = {
+    "static", "line", "circle", "lissajous"
+};
+
+struct BenchmarkParameters {
+    lebcpu_Mode mode;
+    int minDepth, maxDepth;
+    int threadCount;
+    int frameCount;
+    int queryCount;
+    int targetCount;
+    int readerCount;
+    int forestSize;
+    int terrainSize;
+    int trajectory;
+    float radius;
+    bool serial;
+    bool topDown;
+    bool sparse;
+    bool extract;
+    const char *output;
+    const char *loadSnapshot, *saveSnapshot;
+    const char *heightmap;
+} g_params = {
+    LEBCPU_MODE_TRIANGLE, 1, 20, lebcpu_HardwareThreadCount(), 1000, 0, 0, 0, 0,
+    0, TRAJECTORY_CIRCLE, 0.01f, false, false, false, false, NULL, NULL, NULL,
+    NULL
+};
+
+void usage(const char *app)
+{
+    LOG("usage: %s [options]\n"
+        "  --mode triangle|quad   subdivision mode (default: triangle)\n"
+        "  --min-depth N          minimum subdivision depth (default: 1)\n"
+        "  --max-depth N          maximum subdivision depth (default: 20)\n"
+        "  --radius R             radius of the target disk (default: 0.01)\n"
+        "  --threads N            number of threads (default: all cores)\n"
+        "  --frames N             number of updates to time (default: 1000)\n"
+        "  --trajectory NAME      static|line|circle|lissajous (default: circle)\n"
+        "  --queries N            point locations to time after each update\n"
+        "  --targets N            refine around N disks moving along the trajectory\n"
+        "  --readers N            threads locating points in the published tree\n"
+        "  --forest N             refine a forest over an NxN grid of quads\n"
+        "  --terrain N            refine the Terrain demo over a synthetic NxN heightmap\n"
+        "  --heightmap FILE       refine the Terrain demo over a heightmap container\n"
+        "  --serial               use the reference single-threaded update\n"
+        "  --top-down             build the initial subdivision in a single descent\n"
+        "  --sparse               store the subdivision in a sparse heap\n"
+        "  --extract              extract an indexed mesh after each update\n"
+        "  --output FILE          write the report to FILE instead of stdout\n"
+        "  --load-snapshot FILE   start from a snapshot instead of building\n"
+        "  --save-snapshot FILE   save the final subdivision\n",
+        app);
+}
+
+void parseCommandLine(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "--serial")) {
+            g_params.serial = true;
+            continue;
+        } else if (!strcmp(arg, "--top-down")) {
+            g_params.topDown = true;
+            continue;
+        } else if (!strcmp(arg, "--sparse")) {
+            g_params.sparse = true;
+            continue;
+        } else if (!strcmp(arg, "--extract")) {
+            g_params.extract = true;
+            continue;
+        } else if (!strcmp(arg, "--help")) {
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        } else if (!value) {
+            throw std::runtime_error(std::string("missing value for ") + arg);
+        }
+
+        if (!strcmp(arg, "--mode")) {
+            if (!strcmp(value, "triangle"))
+                g_params.mode = LEBCPU_MODE_TRIANGLE;
+            else if (!strcmp(value, "quad"))
+                g_params.mode = LEBCPU_MODE_QUAD;
+            else
+                throw std::runtime_error(std::string("unknown mode ") + value);
+        } else if (!strcmp(arg, "--min-depth")) {
+            g_params.minDepth = atoi(value);
+        } else if (!strcmp(arg, "--max-depth")) {
+            g_params.maxDepth = atoi(value);
+        } else if (!strcmp(arg, "--radius")) {
+            g_params.radius = (float)atof(value);
+        } else if (!strcmp(arg, "--threads")) {
+            g_params.threadCount = std::max(1, atoi(value));
+        } else if (!strcmp(arg, "--frames")) {
+            g_params.frameCount = std::max(1, atoi(value));
+        } else if (!strcmp(arg, "--queries")) {
+            g_params.queryCount = std::max(0, atoi(value));
+        } else if (!strcmp(arg, "--targets")) {
+            g_params.targetCount = std::max(0, atoi(value));
+        } else if (!strcmp(arg, "--readers")) {
+            g_params.readerCount = std::max(0, atoi(value));
+        } else if (!strcmp(arg, "--forest")) {
+            g_params.forestSize = std::max(0, atoi(value));
+        } else if (!strcmp(arg, "--terrain")) {
+            g_params.terrainSize = std::max(0, atoi(value));
+        } else if (!strcmp(arg, "--heightmap")) {
+            g_params.heightmap = value;
+        } else if (!strcmp(arg, "--trajectory")) {
+            g_params.trajectory = -1;
+            for (int j = 0; j < TRAJECTORY_COUNT; ++j)
+                if (!strcmp(value, g_trajectoryNames[j]))
+                    g_params.trajectory = j;
+            if (g_params.trajectory < 0)
+                throw std::runtime_error(std::string("unknown trajectory ") + value);
+        } else if (!strcmp(arg, "--output")) {
+            g_params.output = value;
+        } else if (!strcmp(arg, "--load-snapshot")) {
+            g_params.loadSnapshot = value;
+        } else if (!strcmp(arg, "--save-snapshot")) {
+            g_params.saveSnapshot = value;
+        } else {
+            throw std::runtime_error(std::string("unknown option ") + arg);
+        }
+        ++i;
+    }
+
+    if (g_params.minDepth < 0 || g_params.maxDepth > 29
+        || g_params.minDepth > g_params.maxDepth
+        || g_params.maxDepth < 5) {
+        throw std::runtime_error("invalid depth range");
+    }
+
+    if (g_params.serial && g_params.sparse)
+        throw std::runtime_error("the serial update requires a dense heap");
+    if (g_params.serial && g_params.topDown)
+        throw std::runtime_error("the top-down build is multi-threaded");
+    if (g_params.sparse && (g_params.loadSnapshot || g_params.saveSnapshot))
+        throw std::runtime_error("snapshots require a dense heap");
+    if (g_params.sparse && g_params.readerCount > 0)
+        throw std::runtime_error("readers require a dense heap");
+    if (g_params.forestSize > 0 && (g_params.serial || g_params.sparse
+        || g_params.topDown || g_params.loadSnapshot || g_params.saveSnapshot
+        || g_params.queryCount > 0 || g_params.targetCount > 0
+        || g_params.readerCount > 0 || g_params.extract)) {
+        throw std::runtime_error("forests only support the batched update");
+    }
+    if ((g_params.terrainSize > 0 || g_params.heightmap) && (g_params.serial
+        || g_params.sparse || g_params.topDown || g_params.loadSnapshot
+        || g_params.saveSnapshot || g_params.queryCount > 0
+        || g_params.targetCount > 0 || g_params.readerCount > 0
+        || g_params.extract || g_params.forestSize > 0)) {
+        throw std::runtime_error("terrains only support the batched update");
+    }
+}
+
+// -----------------------------------------------------------------------------
+// target position at time u in [0, 1]; the paths stay inside the root
+// triangle, which is also contained in the root quad
+dja::vec2 trajectory(float u)
+{
+    const float pi = 3.14159265f;
+
+    switch (g_params.trajectory) {
+    case TRAJECTORY_LINE:
+        return dja::vec2(0.1f + 0.3f * u, 0.1f + 0.3f * u);
+    case TRAJECTORY_CIRCLE:
+        return dja::vec2(0.3f + 0.15f * cos(2.0f * pi * u),
+                         0.3f + 0.15f * sin(2.0f * pi * u));
+    case TRAJECTORY_LISSAJOUS:
+        return dja::vec2(0.3f + 0.15f * sin(6.0f * pi * u),
+                         0.3f + 0.15f * sin(4.0f * pi * u));
+    default:
+        return dja::vec2(0.4f, 0.1f);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// disks spread along the trajectory at time u; their maximum depths alternate
+// so that the targets request different resolutions
+void targets(float u, lebcpu_DiskGrid *grid)
+{
+    std::vector<lebcpu_Disk> disks(g_params.targetCount);
+
+    for (int i = 0; i < g_params.targetCount; ++i) {
+        float phase = u + (float)i / (float)g_params.targetCount;
+        dja::vec2 p = trajectory(phase - floor(phase));
+
+        disks[i].x = p.x;
+        disks[i].y = p.y;
+        disks[i].radius = g_params.radius;
+        disks[i].maxDepth = g_params.maxDepth - 2 * (i % 3);
+    }
+
+    lebcpu_BuildDiskGrid(grid, disks.empty() ? NULL : &disks[0],
+                         (uint32_t)disks.size(), 0.0f, 0.0f, 1.0f);
+}
+
+// -----------------------------------------------------------------------------
+// reader thread: locates random points in the published tree until stopped,
+// and checks that each of them lands on a leaf of the version it acquired
+struct ReaderStats {
+    uint64_t acquisitionCount, queryCount, errorCount;
+};
+
+void reader(lebcpu_PublishedHeap *published, const std::atomic<bool> *stop,
+            uint32_t seed, ReaderStats *stats)
+{
+    const uint32_t pointCount = 256u;
+    float x[pointCount], y[pointCount];
+    leb_Node nodes[pointCount];
+    lebcpu_PointLocator locator;
+
+    stats->acquisitionCount = stats->queryCount = stats->errorCount = 0u;
+
+    while (!stop->load()) {
+        lebcpu_HeapView view = lebcpu_AcquireHeap(published);
+
+        if (!view.heap) {
+            lebcpu_ReleaseHeap(published, view);
+            std::this_thread::yield();
+            continue;
+        }
+
+        for (uint32_t i = 0; i < pointCount; ++i) {
+            seed = seed * 1664525u + 1013904223u;
+            x[i] = (float)(seed >> 8) / 16777216.0f;
+            seed = seed * 1664525u + 1013904223u;
+            y[i] = (float)(seed >> 8) / 16777216.0f;
+
+            // keep the points inside the root triangle
+            if (g_params.mode == LEBCPU_MODE_TRIANGLE && x[i] + y[i] > 1.0f) {
+                x[i] = 1.0f - x[i];
+                y[i] = 1.0f - y[i];
+            }
+        }
+
+        lebcpu_BoundingNodeBatch(view.heap, g_params.mode, x, y, pointCount,
+                                 &locator, nodes);
+
+        for (uint32_t i = 0; i < pointCount; ++i)
+            if (!lebcpu_IsLeafNode(view.heap, nodes[i]))
+                ++stats->errorCount;
+
+        lebcpu_ReleaseHeap(published, view);
+        ++stats->acquisitionCount;
+        stats->queryCount+= pointCount;
+    }
+}
+
+// -----------------------------------------------------------------------------
+double percentile(const std::vector<double> &sorted, double p)
+{
+    size_t i = (size_t)(p * (double)(sorted.size() - 1) + 0.5);
+
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+void run()
+{
+    typedef std::chrono::steady_clock clock;
+    bintree tree(g_params.mode,
+                 g_params.minDepth,
+                 g_params.maxDepth,
+                 g_params.threadCount,
+                 g_params.sparse);
+    std::vector<double> frameTimes(g_params.frameCount);
+    uint64_t processedNodeCount = 0u;
+    uint32_t peakNodeCount = 0u;
+    uint64_t splitCount = 0u, mergeCount = 0u;
+    int convergedFrameCount = 0;
+    size_t peakHeapByteSize = 0u;
+    double buildTime, updateTime = 0.0, queryTime = 0.0, extractTime = 0.0;
+    std::vector<float> meshVertices;
+    std::vector<uint32_t> meshIndices;
+    uint64_t meshVertexCount = 0u;
+    std::vector<float> queryX(g_params.queryCount), queryY(g_params.queryCount);
+    std::vector<leb_Node> queryNodes(g_params.queryCount);
+    lebcpu_DiskGrid grid;
+    uint32_t seed = 1u;
+    lebcpu_PublishedHeap *published = NULL;
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> readers;
+    std::vector<ReaderStats> readerStats(g_params.readerCount);
+    double runTime;
+
+    tree.m_radius = g_params.radius;
+
+    if (g_params.readerCount > 0) {
+        published = lebcpu_CreatePublishedHeap();
+        tree.m_published = published;
+        tree.publish();
+
+        for (int i = 0; i < g_params.readerCount; ++i)
+            readers.push_back(std::thread(reader, published, &stop,
+                                          (uint32_t)i + 1u, &readerStats[i]));
+    }
+    clock::time_point runStart = clock::now();
+
+    // initial build, or warm start from a snapshot
+    {
+        clock::time_point t0 = clock::now();
+
+        if (g_params.loadSnapshot) {
+            if (!tree.loadSnapshot(g_params.loadSnapshot))
+                throw std::runtime_error("failed to load snapshot");
+            g_params.minDepth = tree.m_leb->minDepth;
+            g_params.maxDepth = tree.m_leb->maxDepth;
+        } else if (g_params.targetCount > 0) {
+            targets(0.0f, &grid);
+            if (g_params.topDown)
+                tree.buildTopDown(grid);
+            else
+                tree.build(grid, g_params.maxDepth, g_params.serial);
+        } else if (g_params.topDown) {
+            tree.buildTopDown(trajectory(0.0f));
+        } else {
+            tree.build(trajectory(0.0f), g_params.maxDepth, g_params.serial);
+        }
+        clock::time_point t1 = clock::now();
+
+        buildTime = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        peakHeapByteSize = tree.heapByteSize();
+    }
+
+    // timed updates
+    for (int i = 0; i < g_params.frameCount; ++i) {
+        dja::vec2 target = trajectory((float)i / (float)g_params.frameCount);
+        uint32_t nodeCount = (uint32_t)tree.size();
+        clock::time_point t0 = clock::now();
+
+        if (g_params.targetCount > 0) {
+            targets((float)i / (float)g_params.frameCount, &grid);
+
+            if (g_params.serial)
+                tree.updateOnceSerial(grid);
+            else
+                tree.updateOnce(grid);
+        } else if (g_params.serial) {
+            tree.updateOnceSerial(target);
+        } else {
+            tree.updateOnce(target);
+        }
+
+        clock::time_point t1 = clock::now();
+
+        frameTimes[i] = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        splitCount+= tree.m_splitCount;
+        mergeCount+= tree.m_mergeCount;
+        convergedFrameCount+= tree.converged() ? 1 : 0;
+        updateTime+= frameTimes[i];
+        processedNodeCount+= nodeCount;
+        peakNodeCount = std::max(peakNodeCount, (uint32_t)tree.size());
+        peakHeapByteSize = std::max(peakHeapByteSize, tree.heapByteSize());
+
+        // point locations, half of them around the target
+        if (g_params.queryCount > 0) {
+            for (int j = 0; j < g_params.queryCount; ++j) {
+                float u, v;
+
+                seed = seed * 1664525u + 1013904223u;
+                u = (float)(seed >> 8) / 16777216.0f;
+                seed = seed * 1664525u + 1013904223u;
+                v = (float)(seed >> 8) / 16777216.0f;
+
+                if (j & 1) {
+                    u = target.x + 4.0f * g_params.radius * (u - 0.5f);
+                    v = target.y + 4.0f * g_params.radius * (v - 0.5f);
+                }
+                queryX[j] = u;
+                queryY[j] = v;
+            }
+
+            clock::time_point t2 = clock::now();
+
+            tree.boundingNodes(&queryX[0], &queryY[0],
+                               (uint32_t)g_params.queryCount, &queryNodes[0]);
+
+            clock::time_point t3 = clock::now();
+
+            queryTime+= std::chrono::duration<double, std::milli>(t3 - t2).count();
+        }
+
+        // indexed mesh of the leaves
+        if (g_params.extract) {
+            meshVertices.resize(2 * (tree.size() + 2));
+            meshIndices.resize(3 * tree.size());
+
+            clock::time_point t2 = clock::now();
+
+            meshVertexCount+= tree.extractMesh((float (*)[2])&meshVertices[0],
+                                               &meshIndices[0]);
+
+            clock::time_point t3 = clock::now();
+
+            extractTime+= std::chrono::duration<double, std::milli>(t3 - t2).count();
+        }
+    }
+
+    runTime = std::chrono::duration<double, std::milli>(clock::now() - runStart).count();
+    stop = true;
+    for (size_t i = 0; i < readers.size(); ++i)
+        readers[i].join();
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    if (g_params.saveSnapshot && !tree.saveSnapshot(g_params.saveSnapshot))
+        throw std::runtime_error("failed to save snapshot");
+
+    // report
+    FILE *pf = g_params.output ? fopen(g_params.output, "w") : stdout;
+
+    if (!pf)
+        throw std::runtime_error("failed to open output file");
+
+    fprintf(pf, "{\n");
+    fprintf(pf, "  \"mode\": \"%s\",\n",
+            g_params.mode == LEBCPU_MODE_TRIANGLE ? "triangle" : "quad");
+    fprintf(pf, "  \"minDepth\": %i,\n", g_params.minDepth);
+    fprintf(pf, "  \"maxDepth\": %i,\n", g_params.maxDepth);
+    fprintf(pf, "  \"radius\": %g,\n", g_params.radius);
+    fprintf(pf, "  \"threads\": %i,\n", g_params.serial ? 1 : g_params.threadCount);
+    fprintf(pf, "  \"serial\": %s,\n", g_params.serial ? "true" : "false");
+    fprintf(pf, "  \"heap\": \"%s\",\n", g_params.sparse ? "sparse" : "dense");
+    fprintf(pf, "  \"trajectory\": \"%s\",\n", g_trajectoryNames[g_params.trajectory]);
+    fprintf(pf, "  \"targets\": %i,\n", std::max(1, g_params.targetCount));
+    fprintf(pf, "  \"frames\": %i,\n", g_params.frameCount);
+    fprintf(pf, "  \"warmStart\": %s,\n", g_params.loadSnapshot ? "true" : "false");
+    fprintf(pf, "  \"build\": \"%s\",\n",
+            g_params.loadSnapshot ? "snapshot" : g_params.topDown ? "top-down" : "updates");
+    fprintf(pf, "  \"buildMs\": %.6f,\n", buildTime);
+    fprintf(pf, "  \"frameTimeMs\": {\n");
+    fprintf(pf, "    \"mean\": %.6f,\n", updateTime / g_params.frameCount);
+    fprintf(pf, "    \"min\": %.6f,\n", frameTimes.front());
+    fprintf(pf, "    \"p50\": %.6f,\n", percentile(frameTimes, 0.50));
+    fprintf(pf, "    \"p90\": %.6f,\n", percentile(frameTimes, 0.90));
+    fprintf(pf, "    \"p99\": %.6f,\n", percentile(frameTimes, 0.99));
+    fprintf(pf, "    \"max\": %.6f\n", frameTimes.back());
+    fprintf(pf, "  },\n");
+    fprintf(pf, "  \"nodesPerSecond\": %.1f,\n",
+            updateTime > 0.0 ? 1e3 * processedNodeCount / updateTime : 0.0);
+    fprintf(pf, "  \"finalNodes\": %i,\n", tree.size());
+    fprintf(pf, "  \"peakNodes\": %u,\n", peakNodeCount);
+    fprintf(pf, "  \"splits\": %llu,\n", (unsigned long long)splitCount);
+    fprintf(pf, "  \"merges\": %llu,\n", (unsigned long long)mergeCount);
+    fprintf(pf, "  \"convergedFrames\": %i,\n", convergedFrameCount);
+    fprintf(pf, "  \"queriesPerFrame\": %i,\n", g_params.queryCount);
+    fprintf(pf, "  \"queriesPerSecond\": %.1f,\n",
+            queryTime > 0.0
+            ? 1e3 * g_params.queryCount * g_params.frameCount / queryTime : 0.0);
+    if (g_params.extract) {
+        fprintf(pf, "  \"extraction\": {\n");
+        fprintf(pf, "    \"meanMs\": %.6f,\n", extractTime / g_params.frameCount);
+        fprintf(pf, "    \"meanVertices\": %.1f\n",
+                (double)meshVertexCount / g_params.frameCount);
+        fprintf(pf, "  },\n");
+    }
+    if (published) {
+        ReaderStats total = {0u, 0u, 0u};
+
+        for (size_t i = 0; i < readerStats.size(); ++i) {
+            total.acquisitionCount+= readerStats[i].acquisitionCount;
+            total.queryCount+= readerStats[i].queryCount;
+            total.errorCount+= readerStats[i].errorCount;
+        }
+
+        fprintf(pf, "  \"readers\": {\n");
+        fprintf(pf, "    \"threads\": %i,\n", g_params.readerCount);
+        fprintf(pf, "    \"acquisitions\": %llu,\n",
+                (unsigned long long)total.acquisitionCount);
+        fprintf(pf, "    \"queriesPerSecond\": %.1f,\n",
+                1e3 * total.queryCount / runTime);
+        fprintf(pf, "    \"errors\": %llu,\n", (unsigned long long)total.errorCount);
+        fprintf(pf, "    \"publications\": %u,\n", published->publishCount);
+        fprintf(pf, "    \"deferredPublications\": %u,\n", published->deferredCount);
+        fprintf(pf, "    \"copiedBytes\": %llu\n",
+                4ull * (unsigned long long)published->copiedWordCount);
+        fprintf(pf, "  },\n");
+    }
+    fprintf(pf, "  \"peakHeapBytes\": %llu\n",
+            (unsigned long long)peakHeapByteSize);
+    fprintf(pf, "}\n");
+
+    if (pf != stdout)
+        fclose(pf);
+
+    if (published) {
+        tree.m_published = NULL;
+        lebcpu_ReleasePublishedHeap(published);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// forest over an NxN grid of quads covering the unit square, with one root per
+// halfedge; each root gets the depth that leaves the finest triangles of the
+// forest as small as those of a single heap of depth maxDepth
+void runForest()
+{
+    typedef std::chrono::steady_clock clock;
+    const int gridSize = g_params.forestSize;
+    const uint32_t rootCount = 4u * gridSize * gridSize;
+    int rootDepth = 0;
+    std::vector<uint32_t> twins(rootCount), nexts(rootCount);
+    std::vector<lebcpu_ForestRoot> roots(rootCount);
+    std::vector<float> rootAttributes(6u * rootCount);
+    float (*rootAttributeArrays)[2][3] = (float (*)[2][3])&rootAttributes[0];
+    std::vector<double> frameTimes(g_params.frameCount);
+    uint64_t processedNodeCount = 0u;
+    uint32_t peakNodeCount = 0u;
+    uint64_t splitCount = 0u, mergeCount = 0u;
+    double buildTime, updateTime = 0.0;
+    dja::vec2 target;
+
+    while ((1u << rootDepth) < rootCount)
+        ++rootDepth;
+    rootDepth = g_params.maxDepth - rootDepth;
+    if (rootDepth < 1)
+        throw std::runtime_error("maximum depth too small for the forest");
+
+    // halfedge h of face f goes from corner h & 3 to the next one, counter
+    // clockwise; it is twinned with the halfedge that runs the other way
+    for (int j = 0; j < gridSize; ++j)
+    for (int i = 0; i < gridSize; ++i) {
+        const int cornerX[4] = {i, i + 1, i + 1, i}, cornerY[4] = {j, j, j + 1, j + 1};
+        const int twinFaces[4] = {
+            j > 0 ? (j - 1) * gridSize + i : -1,
+            i + 1 < gridSize ? j * gridSize + i + 1 : -1,
+            j + 1 < gridSize ? (j + 1) * gridSize + i : -1,
+            i > 0 ? j * gridSize + i - 1 : -1
+        };
+        const float scale = 1.0f / (float)gridSize;
+        uint32_t faceID = (uint32_t)(j * gridSize + i);
+
+        for (uint32_t k = 0; k < 4u; ++k) {
+            uint32_t h = 4u * faceID + k;
+            uint32_t k1 = (k + 1u) & 3u;
+
+            nexts[h] = 4u * faceID + k1;
+            twins[h] = twinFaces[k] < 0 ? LEBCPU_NULL_ROOT
+                                        : 4u * twinFaces[k] + ((k + 2u) & 3u);
+            rootAttributeArrays[h][0][0] = scale * cornerX[k];
+            rootAttributeArrays[h][1][0] = scale * cornerY[k];
+            rootAttributeArrays[h][0][1] = scale * (i + 0.5f);
+            rootAttributeArrays[h][1][1] = scale * (j + 0.5f);
+            rootAttributeArrays[h][0][2] = scale * cornerX[k1];
+            rootAttributeArrays[h][1][2] = scale * cornerY[k1];
+        }
+    }
+    lebcpu_BuildHalfedgeForestRoots(&twins[0], &nexts[0], rootCount, &roots[0]);
+
+    lebcpu_ThreadPool *pool = lebcpu_CreateThreadPool(g_params.threadCount);
+    lebcpu_Forest *forest = lebcpu_CreateForest(&roots[0], rootCount, 0, rootDepth);
+    auto testNodes = [&](const lebcpu_ForestNode *nodes, int nodeCount) {
+        lebcpu_TriangleBatch batch;
+
+        lebcpu_DecodeForestTriangleBatch(nodes, nodeCount, rootAttributeArrays,
+                                         &batch);
+
+        return lebcpu_DiskTriangleTestBatch(target.x, target.y,
+                                            g_params.radius, &batch);
+    };
+    auto update = [&](int pingPong) {
+        uint32_t count;
+
+        if (pingPong == 0) {
+            count = lebcpu_ForestSplitPassBatch(forest, testNodes, pool);
+        } else {
+            count = lebcpu_ForestMergePassBatch(forest,
+                          [&](const lebcpu_ForestDiamond *diamonds, int nodeCount) {
+                lebcpu_ForestNode base[LEBCPU_BATCH_SIZE], top[LEBCPU_BATCH_SIZE];
+
+                for (int i = 0; i < nodeCount; ++i) {
+                    base[i] = diamonds[i].base;
+                    top[i] = diamonds[i].top;
+                }
+
+                return ~(testNodes(base, nodeCount) | testNodes(top, nodeCount));
+            }, pool);
+        }
+        lebcpu_UpdateForestSumReduction(forest, pool);
+
+        return count;
+    };
+
+    // initial build
+    {
+        clock::time_point t0 = clock::now();
+
+        target = trajectory(0.0f);
+        for (int i = 0; i < rootDepth; ++i)
+            update(0);
+        clock::time_point t1 = clock::now();
+
+        buildTime = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    }
+
+    // timed updates, ping-ponging between split and merge passes
+    for (int i = 0; i < g_params.frameCount; ++i) {
+        uint32_t nodeCount = lebcpu_ForestNodeCount(forest);
+        clock::time_point t0 = clock::now();
+        uint32_t count;
+
+        target = trajectory((float)i / (float)g_params.frameCount);
+        count = update(i & 1);
+
+        clock::time_point t1 = clock::now();
+
+        frameTimes[i] = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        if (i & 1)
+            mergeCount+= count;
+        else
+            splitCount+= count;
+        updateTime+= frameTimes[i];
+        processedNodeCount+= nodeCount;
+        peakNodeCount = std::max(peakNodeCount, lebcpu_ForestNodeCount(forest));
+    }
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    // report
+    FILE *pf = g_params.output ? fopen(g_params.output, "w") : stdout;
+
+    if (!pf)
+        throw std::runtime_error("failed to open output file");
+
+    fprintf(pf, "{\n");
+    fprintf(pf, "  \"mode\": \"forest\",\n");
+    fprintf(pf, "  \"grid\": %i,\n", gridSize);
+    fprintf(pf, "  \"roots\": %u,\n", rootCount);
+    fprintf(pf, "  \"rootMaxDepth\": %i,\n", rootDepth);
+    fprintf(pf, "  \"radius\": %g,\n", g_params.radius);
+    fprintf(pf, "  \"threads\": %i,\n", g_params.threadCount);
+    fprintf(pf, "  \"trajectory\": \"%s\",\n", g_trajectoryNames[g_params.trajectory]);
+    fprintf(pf, "  \"frames\": %i,\n", g_params.frameCount);
+    fprintf(pf, "  \"buildMs\": %.6f,\n", buildTime);
+    fprintf(pf, "  \"frameTimeMs\": {\n");
+    fprintf(pf, "    \"mean\": %.6f,\n", updateTime / g_params.frameCount);
+    fprintf(pf, "    \"min\": %.6f,\n", frameTimes.front());
+    fprintf(pf, "    \"p50\": %.6f,\n", percentile(frameTimes, 0.50));
+    fprintf(pf, "    \"p90\": %.6f,\n", percentile(frameTimes, 0.90));
+    fprintf(pf, "    \"p99\": %.6f,\n", percentile(frameTimes, 0.99));
+    fprintf(pf, "    \"max\": %.6f\n", frameTimes.back());
+    fprintf(pf, "  },\n");
+    fprintf(pf, "  \"nodesPerSecond\": %.1f,\n",
+            updateTime > 0.0 ? 1e3 * processedNodeCount / updateTime : 0.0);
+    fprintf(pf, "  \"finalNodes\": %u,\n", lebcpu_ForestNodeCount(forest));
+    fprintf(pf, "  \"peakNodes\": %u,\n", peakNodeCount);
+    fprintf(pf, "  \"splits\": %llu,\n", (unsigned long long)splitCount);
+    fprintf(pf, "  \"merges\": %llu\n", (unsigned long long)mergeCount);
+    fprintf(pf, "}\n");
+
+    if (pf != stdout)
+        fclose(pf);
+
+    lebcpu_ReleaseForest(forest);
+    lebcpu_ReleaseThreadPool(pool);
+}
+
+// -----------------------------------------------------------------------------
+// heightmap of the terrain benchmark, i.e., the container given with
+// --heightmap, or a synthetic heightmap whose levels are computed in memory
+struct TerrainHeightmap {
+    hmap_Heightmap *container;
+    hmap_Heightmap synthetic;
+    std::vector<hmap_Level> levels;
+    std::vector<std::vector<uint16_t> > dmaps;
+    std::vector<std::vector<float> > smaps;
+};
+
+// sum of sine waves of increasing frequency and decreasing amplitude
+void buildSyntheticHeightmap(int size, TerrainHeightmap *heightmap)
+{
+    const float pi = 3.14159265f;
+    const int levelCount = hmap_LevelCount(size, size);
+    std::vector<uint16_t> heights((size_t)size * size);
+
+    for (int j = 0; j < size; ++j)
+    for (int i = 0; i < size; ++i) {
+        float u = (i + 0.5f) / size, v = (j + 0.5f) / size;
+        float z = 0.5f, amplitude = 0.25f;
+
+        for (int k = 0; k < 8; ++k) {
+            float angle = 2.4f * k, frequency = 3.0f * (1 << k);
+
+            z+= amplitude * sin(2.0f * pi * frequency
+                                * (u * cos(angle) + v * sin(angle)) + k);
+            amplitude*= 0.5f;
+        }
+
+        heights[i + (size_t)size * j] =
+            (uint16_t)(65535.0f * std::min(std::max(z, 0.0f), 1.0f));
+    }
+
+    heightmap->levels.resize(levelCount);
+    heightmap->dmaps.resize(levelCount);
+    heightmap->smaps.resize(levelCount);
+
+    for (int i = 0; i < levelCount; ++i) {
+        hmap_Level &level = heightmap->levels[i];
+
+        level.width = std::max(1, size >> i);
+        level.height = std::max(1, size >> i);
+        heightmap->dmaps[i].resize(2u * level.width * level.height);
+        heightmap->smaps[i].resize(2u * level.width * level.height);
+        level.dmap = &heightmap->dmaps[i][0];
+        level.smap = &heightmap->smaps[i][0];
+
+        if (i == 0) {
+            hmap_ComputeLevel(&heights[0], size, size, &heightmap->dmaps[0][0],
+                              &heightmap->smaps[0][0], g_params.threadCount);
+        } else {
+            const hmap_Level &parent = heightmap->levels[i - 1];
+
+            hmap_ComputeNextLevel(parent.dmap, &heightmap->smaps[i - 1][0],
+                                  parent.width, parent.height,
+                                  &heightmap->dmaps[i][0],
+                                  &heightmap->smaps[i][0]);
+        }
+    }
+
+    heightmap->synthetic.width = heightmap->synthetic.height = size;
+    heightmap->synthetic.levelCount = levelCount;
+    heightmap->synthetic.slopeFormat = HMAP_SLOPE_RG32F;
+    heightmap->synthetic.slopeScale = 1.0f;
+    heightmap->synthetic.levels = &heightmap->levels[0];
+    heightmap->synthetic.mapping = NULL;
+    heightmap->synthetic.mappingByteSize = 0;
+}
+
+// uniforms of the Terrain demo, with its default settings, for a camera
+// located above the trajectory at time u
+void terrainVariables(float u, terraincpu_Terrain *terrain)
+{
+    const float pi = 3.14159265f;
+    const float fovy = 80.0f, zNear = 0.01f, zFar = 32.0f, size = 8.0f;
+    const float upAngle = 3.5f, sideAngle = 0.4f;
+    const int width = 1680, height = 1050;
+    float c1 = cos(upAngle), s1 = sin(upAngle);
+    float c2 = cos(sideAngle), s2 = sin(sideAngle);
+    dja::vec2 p = trajectory(u);
+    dja::vec3 pos(size * (p.x - 0.5f), size * (p.y - 0.5f), 1.25f);
+    dja::mat3 axis(
+        c1 * c2, -s1, -c1 * s2,
+        c2 * s1,  c1, -s1 * s2,
+        s2     , 0.0f, c2
+    );
+    dja::mat4 projection = dja::mat4::homogeneous::perspective(
+        fovy * pi / 180.0f, (float)width / (float)height, zNear, zFar
+    );
+    dja::mat4 viewInv = dja::mat4::homogeneous::translation(pos)
+        * dja::mat4::homogeneous::from_mat3(axis);
+    dja::mat4 view = dja::inverse(viewInv);
+    dja::mat4 model = dja::mat4::homogeneous::scale(size)
+                    * dja::mat4::homogeneous::translation(dja::vec3(-0.5f, -0.5f, 0));
+    dja::mat4 modelView = view * model;
+    dja::mat4 mvp = projection * modelView;
+    float mvpArray[4][4];
+
+    for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 4; ++j) {
+        terrain->modelViewMatrix[i][j] = modelView[i][j];
+        mvpArray[i][j] = mvp[i][j];
+    }
+
+    terraincpu_LoadFrustumPlanes(mvpArray, terrain->frustumPlanes);
+    terrain->projection = TERRAINCPU_PROJECTION_RECTILINEAR;
+    terrain->lodFactor = terraincpu_LodFactor(terrain->projection, fovy, height,
+                                              3, 7.0f);
+    terrain->dmapFactor = 0.2f;
+    terrain->minLodVariance = terraincpu_MinLodVariance(0.1f, terrain->dmapFactor);
+    terrain->cull = true;
+}
+
+// the subdivision is built by updating it until both passes leave it
+// untouched, and then updated once per frame as the camera moves; the nodes
+// that pass the culling test are listed after each update
+void runTerrain()
+{
+    typedef std::chrono::steady_clock clock;
+    TerrainHeightmap heightmap;
+    terraincpu_DmapBounds dmapBounds;
+    terraincpu_Terrain terrain;
+    std::vector<uint32_t> visibleNodes;
+    std::vector<double> frameTimes(g_params.frameCount);
+    uint64_t processedNodeCount = 0u, visibleNodeCount = 0u;
+    uint32_t peakNodeCount = 0u;
+    uint64_t splitCount = 0u, mergeCount = 0u;
+    double buildTime, updateTime = 0.0, visibleTime = 0.0;
+    int buildFrameCount = 0;
+
+    heightmap.container = NULL;
+    if (g_params.heightmap) {
+        heightmap.container = hmap_Load(g_params.heightmap);
+
+        if (!heightmap.container)
+            throw std::runtime_error("failed to load heightmap");
+    } else {
+        buildSyntheticHeightmap(g_params.terrainSize, &heightmap);
+    }
+    terrain.dmap = heightmap.container ? heightmap.container : &heightmap.synthetic;
+    terraincpu_ComputeDmapBounds(terrain.dmap, &dmapBounds, g_params.threadCount);
+    terrain.dmapBounds = &dmapBounds;
+
+    lebcpu_ThreadPool *pool = lebcpu_CreateThreadPool(g_params.threadCount);
+    leb_Heap *leb = leb_CreateMinMax(g_params.minDepth, g_params.maxDepth);
+
+    leb_ResetToDepth(leb, g_params.minDepth);
+
+    // initial build
+    {
+        clock::time_point t0 = clock::now();
+        int unchangedFrameCount = 0;
+
+        terrainVariables(0.0f, &terrain);
+        while (unchangedFrameCount < 2) {
+            uint32_t count = terraincpu_Update(leb, &terrain,
+                                               buildFrameCount & 1, pool);
+
+            unchangedFrameCount = count == 0u ? unchangedFrameCount + 1 : 0;
+            ++buildFrameCount;
+        }
+        clock::time_point t1 = clock::now();
+
+        buildTime = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    }
+
+    // timed updates, ping-ponging between split and merge passes
+    for (int i = 0; i < g_params.frameCount; ++i) {
+        uint32_t nodeCount = lebcpu_NodeCount(leb);
+        clock::time_point t0 = clock::now();
+        uint32_t count;
+
+        terrainVariables((float)i / (float)g_params.frameCount, &terrain);
+        count = terraincpu_Update(leb, &terrain, (buildFrameCount + i) & 1, pool);
+
+        clock::time_point t1 = clock::now();
+
+        terraincpu_VisibleNodes(leb, &terrain, pool, &visibleNodes);
+
+        clock::time_point t2 = clock::now();
+
+        frameTimes[i] = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        visibleTime+= std::chrono::duration<double, std::milli>(t2 - t1).count();
+        if ((buildFrameCount + i) & 1)
+            mergeCount+= count;
+        else
+            splitCount+= count;
+        updateTime+= frameTimes[i];
+        processedNodeCount+= nodeCount;
+        visibleNodeCount+= visibleNodes.size();
+        peakNodeCount = std::max(peakNodeCount, lebcpu_NodeCount(leb));
+    }
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    // report
+    FILE *pf = g_params.output ? fopen(g_params.output, "w") : stdout;
+
+    if (!pf)
+        throw std::runtime_error("failed to open output file");
+
+    fprintf(pf, "{\n");
+    fprintf(pf, "  \"mode\": \"terrain\",\n");
+    fprintf(pf, "  \"heightmap\": \"%s\",\n",
+            g_params.heightmap ? g_params.heightmap : "synthetic");
+    fprintf(pf, "  \"heightmapSize\": [%i, %i],\n",
+            terrain.dmap->width, terrain.dmap->height);
+    fprintf(pf, "  \"minDepth\": %i,\n", g_params.minDepth);
+    fprintf(pf, "  \"maxDepth\": %i,\n", g_params.maxDepth);
+    fprintf(pf, "  \"threads\": %i,\n", g_params.threadCount);
+    fprintf(pf, "  \"trajectory\": \"%s\",\n", g_trajectoryNames[g_params.trajectory]);
+    fprintf(pf, "  \"frames\": %i,\n", g_params.frameCount);
+    fprintf(pf, "  \"buildMs\": %.6f,\n", buildTime);
+    fprintf(pf, "  \"buildFrames\": %i,\n", buildFrameCount);
+    fprintf(pf, "  \"frameTimeMs\": {\n");
+    fprintf(pf, "    \"mean\": %.6f,\n", updateTime / g_params.frameCount);
+    fprintf(pf, "    \"min\": %.6f,\n", frameTimes.front());
+    fprintf(pf, "    \"p50\": %.6f,\n", percentile(frameTimes, 0.50));
+    fprintf(pf, "    \"p90\": %.6f,\n", percentile(frameTimes, 0.90));
+    fprintf(pf, "    \"p99\": %.6f,\n", percentile(frameTimes, 0.99));
+    fprintf(pf, "    \"max\": %.6f\n", frameTimes.back());
+    fprintf(pf, "  },\n");
+    fprintf(pf, "  \"nodesPerSecond\": %.1f,\n",
+            updateTime > 0.0 ? 1e3 * processedNodeCount / updateTime : 0.0);
+    fprintf(pf, "  \"finalNodes\": %u,\n", lebcpu_NodeCount(leb));
+    fprintf(pf, "  \"peakNodes\": %u,\n", peakNodeCount);
+    fprintf(pf, "  \"splits\": %llu,\n", (unsigned long long)splitCount);
+    fprintf(pf, "  \"merges\": %llu,\n", (unsigned long long)mergeCount);
+    fprintf(pf, "  \"visibility\": {\n");
+    fprintf(pf, "    \"meanMs\": %.6f,\n", visibleTime / g_params.frameCount);
+    fprintf(pf, "    \"meanNodes\": %.1f\n",
+            (double)visibleNodeCount / g_params.frameCount);
+    fprintf(pf, "  }\n");
+    fprintf(pf, "}\n");
+
+    if (pf != stdout)
+        fclose(pf);
+
+    leb_Release(leb);
+    lebcpu_ReleaseThreadPool(pool);
+    if (heightmap.container)
+        hmap_Release(heightmap.container);
+}
+
+// -----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    try {
+        parseCommandLine(argc, argv);
+        if (g_params.forestSize > 0)
+            runForest();
+        else if (g_params.terrainSize > 0 || g_params.heightmap)
+            runTerrain();
+        else
+            run();
+    } catch (std::exception& e) {
+        LOG("%s\n", e.what());
+        LOG("(!) Benchmark Killed (!)\n");
+
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Heightmap Converter
+//
+// Preprocesses a 16-bit heightmap into the container the Terrain demo maps at
+// startup (see HeightmapContainer.h), e.g.,
+//     HeightmapConverter assets/Terrain4k.png
+// writes assets/Terrain4k.hmap. Slopes are stored as RG16F unless another
+// format is given with --slopes (rg32f, rg16f or rg16snorm). With --tiles N,
+// the heightmap is written to a tiled container of N x N tiles instead,
+// e.g., assets/Terrain4k.htiles, which the demo streams.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define HMAP_IMPLEMENTATION
+#include "HeightmapContainer.h"
+
+#define LOG(fmt, ...)  fprintf(stderr, fmt, ##__VA_ARGS__); fflush(stderr);
+
+// parses the name of a slope format; returns false if unknown
+bool slopeFormat(const char *name, hmap_SlopeFormat *format)
+{
+    const char *names[] = {"rg32f", "rg16f", "rg16snorm"};
+
+    for (int i = 0; i < 3; ++i) {
+        if (!strcmp(name, names[i])) {
+            *format = (hmap_SlopeFormat)i;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    typedef std::chrono::steady_clock clock;
+    hmap_SlopeFormat format = HMAP_SLOPE_RG16F;
+    int tileSize = 0;
+
+    while (argc > 2 && !strncmp(argv[1], "--", 2) && strcmp(argv[1], "--help")) {
+        bool valid = false;
+
+        if (!strcmp(argv[1], "--slopes"))
+            valid = slopeFormat(argv[2], &format);
+        else if (!strcmp(argv[1], "--tiles"))
+            valid = (tileSize = atoi(argv[2])) > 0;
+
+        if (!valid) {
+            LOG("invalid option %s %s\n", argv[1], argv[2]);
+
+            return EXIT_FAILURE;
+        }
+        argc-= 2;
+        argv+= 2;
+    }
+
+    if (argc < 2 || argc > 3 || !strcmp(argv[1], "--help")) {
+        LOG("usage: HeightmapConverter [--slopes rg32f|rg16f|rg16snorm] "
+            "[--tiles N] heightmap.png [output]\n");
+
+        return argc == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::string output = argc > 2
+                       ? argv[2]
+                       : hmap_ContainerPath(argv[1], tileSize > 0 ? ".htiles" : ".hmap");
+    clock::time_point t0 = clock::now();
+    int width, height, channelCount;
+
+    // same orientation as the textures loaded by dj_opengl
+    stbi_set_flip_vertically_on_load(1);
+    uint16_t *heights = stbi_load_16(argv[1], &width, &height, &channelCount, 1);
+
+    if (!heights) {
+        LOG("failed to load %s\n", argv[1]);
+
+        return EXIT_FAILURE;
+    }
+
+    clock::time_point t1 = clock::now();
+    bool success = tileSize > 0
+                 ? hmap_SaveTiled(output.c_str(), heights, width, height, tileSize, format)
+                 : hmap_Save(output.c_str(), heights, width, height, format);
+    clock::time_point t2 = clock::now();
+
+    stbi_image_free(heights);
+
+    if (!success)
+        return EXIT_FAILURE;
+
+    LOG("%s: %ix%i, %i levels (decode %.1f ms, convert %.1f ms)\n",
+        output.c_str(), width, height,
+        tileSize > 0 ? hmap_TiledLevelCount(width, height, tileSize)
+                     : hmap_LevelCount(width, height),
+        std::chrono::duration<double, std::milli>(t1 - t0).count(),
+        std::chrono::duration<double, std::milli>(t2 - t1).count());
+
+    return EXIT_SUCCESS;
+}
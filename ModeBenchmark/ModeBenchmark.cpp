@@ -0,0 +1,259 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+// Longest Edge Bisection (LEB) Mode Dispatch Microbenchmark
+//
+// Times the per-node loops of the bintree update on a converged subdivision,
+// once instantiated for a mode policy (lebcpu_TriangleMode, lebcpu_QuadMode)
+// and once for a policy that checks the mode at every call, as the loops did
+// before they were specialized. The subdivision is converged, so that every
+// sweep visits the same leaves and leaves the heap untouched.
+//
+#define DJ_ALGEBRA_IMPLEMENTATION 1
+#include "dj_algebra.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+#define LEB_IMPLEMENTATION
+#include "LongestEdgeBisection.h"
+#include "LongestEdgeBisectionCPU.h"
+
+#define LEBSNAP_IMPLEMENTATION
+#include "LongestEdgeBisectionSnapshot.h"
+#include "Bintree.h"
+
+#define LOG(fmt, ...)  fprintf(stderr, fmt, ##__VA_ARGS__); fflush(stderr);
+
+// -----------------------------------------------------------------------------
+struct BenchmarkParameters {
+    int maxDepth;
+    float radius;
+    int repeatCount;
+} g_params = {22, 0.05f, 5};
+
+const float g_attribArray[][3] = {
+    {0.0f, 0.0f, 1.0f},
+    {1.0f, 0.0f, 0.0f}
+};
+
+void usage(const char *app)
+{
+    LOG("usage: %s [options]\n"
+        "  --max-depth N          maximum subdivision depth (default: 22)\n"
+        "  --radius R             radius of the target disk (default: 0.05)\n"
+        "  --repeat N             timings kept are the best of N (default: 5)\n",
+        app);
+}
+
+void parseCommandLine(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "--help")) {
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        } else if (!value) {
+            throw std::runtime_error(std::string("missing value for ") + arg);
+        }
+
+        if (!strcmp(arg, "--max-depth")) {
+            g_params.maxDepth = atoi(value);
+        } else if (!strcmp(arg, "--radius")) {
+            g_params.radius = (float)atof(value);
+        } else if (!strcmp(arg, "--repeat")) {
+            g_params.repeatCount = std::max(1, atoi(value));
+        } else {
+            throw std::runtime_error(std::string("unknown option ") + arg);
+        }
+        ++i;
+    }
+
+    if (g_params.maxDepth < 5 || g_params.maxDepth > 29)
+        throw std::runtime_error("invalid depth");
+}
+
+// -----------------------------------------------------------------------------
+// policy that branches on a mode chosen at run time
+struct RuntimeMode {
+    static lebcpu_Mode mode;
+
+    static leb_DiamondParent DecodeDiamondParent(const leb_Node node)
+    {
+        if (mode == LEBCPU_MODE_TRIANGLE)
+            return leb_DecodeDiamondParent(node);
+        else
+            return leb_DecodeDiamondParent_Quad(node);
+    }
+
+    static void
+    DecodeNodeAttributeArray(const leb_Node node, int attributeArraySize,
+                             float attributeArray[][3])
+    {
+        if (mode == LEBCPU_MODE_TRIANGLE)
+            leb_DecodeNodeAttributeArray(node, attributeArraySize, attributeArray);
+        else
+            leb_DecodeNodeAttributeArray_Quad(node, attributeArraySize, attributeArray);
+    }
+};
+lebcpu_Mode RuntimeMode::mode = LEBCPU_MODE_TRIANGLE;
+
+// -----------------------------------------------------------------------------
+// disk test of a node
+template <typename Mode>
+bool testTarget(const leb_Node node, const dja::vec2 &target)
+{
+    float attribArray[][3] = {
+        {g_attribArray[0][0], g_attribArray[0][1], g_attribArray[0][2]},
+        {g_attribArray[1][0], g_attribArray[1][1], g_attribArray[1][2]}
+    };
+
+    Mode::DecodeNodeAttributeArray(node, 2, attribArray);
+
+    return lebcpu_DiskTriangleTest(target.x, target.y, g_params.radius,
+                                   attribArray[0], attribArray[1]);
+}
+
+// body of the serial update: for each leaf, the split test and the merge
+// test of its diamond; returns the number of positive tests
+template <typename Mode>
+uint32_t serialSweep(const leb_Heap *leb, const dja::vec2 &target)
+{
+    uint32_t nodeCount = leb_NodeCount(leb);
+    uint32_t hitCount = 0u;
+
+    for (uint32_t i = 0; i < nodeCount; ++i) {
+        leb_Node node = leb_DecodeNode(leb, i);
+        leb_DiamondParent diamond = Mode::DecodeDiamondParent(node);
+
+        hitCount+= testTarget<Mode>(node, target) ? 1u : 0u;
+        hitCount+= (testTarget<Mode>(diamond.base, target)
+                 || testTarget<Mode>(diamond.top, target)) ? 1u : 0u;
+    }
+
+    return hitCount;
+}
+
+// batched split and merge passes on a single thread; returns the number of
+// modified nodes, which is zero on a converged subdivision
+template <typename Mode>
+uint32_t batchPasses(leb_Heap *leb, const dja::vec2 &target)
+{
+    auto testBatch = [&](const leb_Node *nodes, int nodeCount) {
+        lebcpu_TriangleBatch batch;
+
+        lebcpu_DecodeTriangleBatch<Mode>(nodes, nodeCount, g_attribArray, &batch);
+
+        return lebcpu_DiskTriangleTestBatch(target.x, target.y,
+                                            g_params.radius, &batch);
+    };
+    uint32_t changeCount = 0u;
+
+    changeCount+= lebcpu_SplitPassBatch<Mode>(leb, testBatch, NULL);
+    changeCount+= lebcpu_MergePassBatch<Mode>(leb,
+                          [&](const leb_DiamondParent *diamonds, int nodeCount) {
+        leb_Node base[LEBCPU_BATCH_SIZE] = {}, top[LEBCPU_BATCH_SIZE] = {};
+
+        for (int i = 0; i < nodeCount; ++i) {
+            base[i] = diamonds[i].base;
+            top[i] = diamonds[i].top;
+        }
+
+        return ~(testBatch(base, nodeCount) | testBatch(top, nodeCount));
+    }, NULL);
+
+    return changeCount;
+}
+
+// -----------------------------------------------------------------------------
+// best time of the benchmark, in nanoseconds per leaf
+template <typename Kernel>
+double timeKernel(const Kernel &kernel, uint32_t nodeCount, uint32_t *result)
+{
+    typedef std::chrono::steady_clock clock;
+    double bestTime = 1e30;
+
+    for (int i = 0; i < g_params.repeatCount; ++i) {
+        clock::time_point t0 = clock::now();
+
+        *result = kernel();
+
+        clock::time_point t1 = clock::now();
+
+        bestTime = std::min(bestTime,
+                            std::chrono::duration<double, std::nano>(t1 - t0).count());
+    }
+
+    return bestTime / nodeCount;
+}
+
+template <typename Mode>
+void run(lebcpu_Mode mode, bool last)
+{
+    const dja::vec2 target(0.25f, 0.25f);
+    bintree tree(mode, mode == LEBCPU_MODE_TRIANGLE ? 1 : 2,
+                 g_params.maxDepth, 1);
+    uint32_t nodeCount;
+    uint32_t runtimeHits = 0u, policyHits = 0u;
+    uint32_t runtimeChanges = 0u, policyChanges = 0u;
+    double runtimeSweep, policySweep, runtimePasses, policyPasses;
+
+    tree.m_radius = g_params.radius;
+    tree.buildTopDown(target);
+    nodeCount = (uint32_t)tree.size();
+    RuntimeMode::mode = mode;
+
+    runtimeSweep = timeKernel([&]() {
+        return serialSweep<RuntimeMode>(tree.m_leb, target);
+    }, nodeCount, &runtimeHits);
+    policySweep = timeKernel([&]() {
+        return serialSweep<Mode>(tree.m_leb, target);
+    }, nodeCount, &policyHits);
+    runtimePasses = timeKernel([&]() {
+        return batchPasses<RuntimeMode>(tree.m_leb, target);
+    }, nodeCount, &runtimeChanges);
+    policyPasses = timeKernel([&]() {
+        return batchPasses<Mode>(tree.m_leb, target);
+    }, nodeCount, &policyChanges);
+
+    if (runtimeHits != policyHits || runtimeChanges != 0u || policyChanges != 0u)
+        throw std::runtime_error("policies disagree");
+
+    printf("  {\n");
+    printf("    \"mode\": \"%s\",\n",
+           mode == LEBCPU_MODE_TRIANGLE ? "triangle" : "quad");
+    printf("    \"maxDepth\": %i,\n", g_params.maxDepth);
+    printf("    \"nodes\": %u,\n", nodeCount);
+    printf("    \"serialSweepNsPerNode\": {\"runtime\": %.3f, \"policy\": %.3f, "
+           "\"speedup\": %.3f},\n",
+           runtimeSweep, policySweep, runtimeSweep / policySweep);
+    printf("    \"batchPassesNsPerNode\": {\"runtime\": %.3f, \"policy\": %.3f, "
+           "\"speedup\": %.3f}\n",
+           runtimePasses, policyPasses, runtimePasses / policyPasses);
+    printf("  }%s\n", last ? "" : ",");
+}
+
+// -----------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    try {
+        parseCommandLine(argc, argv);
+        printf("[\n");
+        run<lebcpu_TriangleMode>(LEBCPU_MODE_TRIANGLE, false);
+        run<lebcpu_QuadMode>(LEBCPU_MODE_QUAD, true);
+        printf("]\n");
+    } catch (std::exception& e) {
+        LOG("%s\n", e.what());
+        LOG("(!) Benchmark Killed (!)\n");
+
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
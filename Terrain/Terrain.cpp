@@ -4,6 +4,11 @@
 //
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
+#if TERRAIN_HEADLESS_EGL
+#   define EGL_NO_X11
+#   include <EGL/egl.h>
+#   include <EGL/eglext.h>
+#endif
 #include "imgui.h"
 #include "imgui_impl.h"
 
@@ -31,6 +36,12 @@
 #define LEB_IMPLEMENTATION
 #include "LongestEdgeBisection.h"
 
+#define LEBSNAP_IMPLEMENTATION
+#include "LongestEdgeBisectionSnapshot.h"
+
+#define HMAP_IMPLEMENTATION
+#include "HeightmapContainer.h"
+
 #define LOG(fmt, ...)  fprintf(stdout, fmt, ##__VA_ARGS__); fflush(stdout);
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -114,6 +125,12 @@ void updateCameraMatrix()
     );
 }
 
+// camera keyframe of the headless runner
+struct CameraKeyframe {
+    dja::vec3 pos;
+    float upAngle, sideAngle;
+};
+
 // -----------------------------------------------------------------------------
 // Terrain Manager
 enum { METHOD_CS, METHOD_TS, METHOD_GS, METHOD_MS };
@@ -124,6 +141,10 @@ struct TerrainManager {
         std::string pathToFile;
         float scale;
     } dmap;
+    struct {
+        hmap_SlopeFormat format;
+        float factor; // scale of the slopes stored as RG16_SNORM
+    } smap;
     int method;
     int shading;
     int gpuSubd;
@@ -134,6 +155,7 @@ struct TerrainManager {
 } g_terrain = {
     {true, true, false, false, true},
     {std::string(PATH_TO_ASSET_DIRECTORY "./Terrain4k.png"), 0.2f},
+    {HMAP_SLOPE_RG16F, 1.0f},
     METHOD_CS,
     SHADING_DIFFUSE,
     3,
@@ -143,6 +165,26 @@ struct TerrainManager {
     8
 };
 
+// -----------------------------------------------------------------------------
+// Tile Streaming Manager (tiled heightmaps only)
+struct TileStreamingManager {
+    hmap_TiledHeightmap *heightmap;
+    hmap_TileCache *cache;
+    hmap_TileStreamer *streamer;
+    int cacheSize;   // tiles held by the tile cache
+    int slotCount;   // tiles staged by the streamer
+    int uploadCount; // tiles uploaded per frame, at most
+    std::vector<uint32_t> requests;
+    GLsync fences[2];
+    int pingPong;
+} g_tiles = {
+    NULL, NULL, NULL,
+    256, 16, 8,
+    std::vector<uint32_t>(),
+    {NULL, NULL},
+    0
+};
+
 
 // -----------------------------------------------------------------------------
 // Application Manager
@@ -159,6 +201,13 @@ struct AppManager {
     struct {
         int on, frame, capture;
     } recorder;
+    struct {
+        bool on;
+        const char *pathToCameraPath;
+        const char *pathToTimings;
+        std::vector<CameraKeyframe> cameraPath;
+    } headless;
+    const char *pathToSubdivision; // snapshot that init starts from, if set
     int frame, frameLimit;
 } g_app = {
     /*dir*/     {
@@ -171,6 +220,8 @@ struct AppManager {
                    2.2f, 0.4f
                 },
     /*record*/  {false, 0, 0},
+    /*headless*/{false, NULL, NULL, std::vector<CameraKeyframe>()},
+    /*subd*/    NULL,
     /*frame*/   0, -1
 };
 
@@ -182,6 +233,7 @@ enum {
     CLOCK_BATCH,
     CLOCK_UPDATE,
     CLOCK_RENDER,
+    CLOCK_STREAM,
     CLOCK_REDUCTION,
     CLOCK_REDUCTION00,
     CLOCK_REDUCTION01,
@@ -228,6 +280,9 @@ enum {
     BUFFER_LEB_NODE_COUNTER,    // compute shader path only
     BUFFER_TERRAIN_DRAW_CS,     // compute shader path only
     BUFFER_TERRAIN_DISPATCH_CS, // compute shader path only
+    BUFFER_TILE_TABLE,          // tiled heightmaps only
+    BUFFER_TILE_REQUESTS0,      // tiled heightmaps only
+    BUFFER_TILE_REQUESTS1,      // tiled heightmaps only
     BUFFER_COUNT
 };
 enum {
@@ -235,6 +290,10 @@ enum {
     TEXTURE_ZBUF,
     TEXTURE_DMAP,
     TEXTURE_SMAP,
+    TEXTURE_DMAP_BOUNDS,
+    TEXTURE_DMAP_TILES,         // tiled heightmaps only
+    TEXTURE_SMAP_TILES,         // tiled heightmaps only
+    TEXTURE_TILE_TABLE,         // tiled heightmaps only
     TEXTURE_COUNT
 };
 enum {
@@ -246,6 +305,7 @@ enum {
     PROGRAM_LEB_REDUCTION,
     PROGRAM_LEB_REDUCTION_PREPASS,
     PROGRAM_BATCH,
+    PROGRAM_TILE_REQUEST,       // tiled heightmaps only
     PROGRAM_COUNT
 };
 enum {
@@ -259,6 +319,8 @@ enum {
     UNIFORM_TERRAIN_LOD_FACTOR,
     UNIFORM_TERRAIN_MIN_LOD_VARIANCE,
     UNIFORM_TERRAIN_SCREEN_RESOLUTION,
+    UNIFORM_TERRAIN_SMAP_FACTOR,
+    UNIFORM_TERRAIN_DMAP_BOUNDS_SAMPLER,
 
     UNIFORM_SPLIT_DMAP_SAMPLER,
     UNIFORM_SPLIT_SMAP_SAMPLER,
@@ -267,6 +329,8 @@ enum {
     UNIFORM_SPLIT_LOD_FACTOR,
     UNIFORM_SPLIT_MIN_LOD_VARIANCE,
     UNIFORM_SPLIT_SCREEN_RESOLUTION,
+    UNIFORM_SPLIT_SMAP_FACTOR,
+    UNIFORM_SPLIT_DMAP_BOUNDS_SAMPLER,
 
     UNIFORM_MERGE_DMAP_SAMPLER,
     UNIFORM_MERGE_SMAP_SAMPLER,
@@ -275,6 +339,8 @@ enum {
     UNIFORM_MERGE_LOD_FACTOR,
     UNIFORM_MERGE_MIN_LOD_VARIANCE,
     UNIFORM_MERGE_SCREEN_RESOLUTION,
+    UNIFORM_MERGE_SMAP_FACTOR,
+    UNIFORM_MERGE_DMAP_BOUNDS_SAMPLER,
 
     UNIFORM_RENDER_DMAP_SAMPLER,
     UNIFORM_RENDER_SMAP_SAMPLER,
@@ -283,9 +349,14 @@ enum {
     UNIFORM_RENDER_LOD_FACTOR,
     UNIFORM_RENDER_MIN_LOD_VARIANCE,
     UNIFORM_RENDER_SCREEN_RESOLUTION,
+    UNIFORM_RENDER_SMAP_FACTOR,
+    UNIFORM_RENDER_DMAP_BOUNDS_SAMPLER,
 
     UNIFORM_TOPVIEW_DMAP_SAMPLER,
     UNIFORM_TOPVIEW_DMAP_FACTOR,
+    UNIFORM_TOPVIEW_DMAP_BOUNDS_SAMPLER,
+
+    UNIFORM_TILE_REQUEST_DMAP_FACTOR,
 
     UNIFORM_COUNT
 };
@@ -455,6 +526,12 @@ void configureTerrainProgram(GLuint glp, GLuint offset)
     glProgramUniform2f(glp,
         g_gl.uniforms[UNIFORM_TERRAIN_SCREEN_RESOLUTION + offset],
         g_framebuffer.w, g_framebuffer.h);
+    glProgramUniform1f(glp,
+        g_gl.uniforms[UNIFORM_TERRAIN_SMAP_FACTOR + offset],
+        g_terrain.smap.factor);
+    glProgramUniform1i(glp,
+        g_gl.uniforms[UNIFORM_TERRAIN_DMAP_BOUNDS_SAMPLER + offset],
+        TEXTURE_DMAP_BOUNDS);
 }
 
 void configureTerrainPrograms()
@@ -477,6 +554,21 @@ void configureTopViewProgram()
     glProgramUniform1i(g_gl.programs[PROGRAM_TOPVIEW],
         g_gl.uniforms[UNIFORM_TOPVIEW_DMAP_SAMPLER],
         TEXTURE_DMAP);
+    glProgramUniform1i(g_gl.programs[PROGRAM_TOPVIEW],
+        g_gl.uniforms[UNIFORM_TOPVIEW_DMAP_BOUNDS_SAMPLER],
+        TEXTURE_DMAP_BOUNDS);
+}
+
+// -----------------------------------------------------------------------------
+// set Tile Request program uniforms
+void configureTileRequestProgram()
+{
+    if (!g_tiles.heightmap)
+        return;
+
+    glProgramUniform1f(g_gl.programs[PROGRAM_TILE_REQUEST],
+        g_gl.uniforms[UNIFORM_TILE_REQUEST_DMAP_FACTOR],
+        g_terrain.dmap.scale);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -538,6 +630,30 @@ bool loadViewerProgram()
     return (glGetError() == GL_NO_ERROR);
 }
 
+// -----------------------------------------------------------------------------
+/**
+ * Push the Tile Streaming Defines
+ *
+ * Programs that sample a tiled heightmap do so through the tile cache, whose
+ * layout is fixed by the heightmap.
+ */
+void pushTileStreamingDefines(djg_program *djp)
+{
+    const hmap_TiledHeightmap *heightmap = g_tiles.heightmap;
+
+    if (!heightmap)
+        return;
+
+    djgp_push_string(djp, "#define FLAG_STREAM 1\n");
+    djgp_push_string(djp, "#define TEXTURE_BINDING_DMAP_TILES %i\n", TEXTURE_DMAP_TILES);
+    djgp_push_string(djp, "#define TEXTURE_BINDING_SMAP_TILES %i\n", TEXTURE_SMAP_TILES);
+    djgp_push_string(djp, "#define TEXTURE_BINDING_TILE_TABLE %i\n", TEXTURE_TILE_TABLE);
+    djgp_push_string(djp, "#define TILE_SIZE %i\n", heightmap->tileSize);
+    djgp_push_string(djp, "#define TILE_LEVEL_COUNT %i\n", heightmap->levelCount);
+    djgp_push_string(djp, "#define TILE_HEIGHTMAP_WIDTH %i\n", heightmap->width);
+    djgp_push_string(djp, "#define TILE_HEIGHTMAP_HEIGHT %i\n", heightmap->height);
+}
+
 // -----------------------------------------------------------------------------
 /**
  * Load the Terrain Rendering Program
@@ -592,6 +708,7 @@ bool loadTerrainProgram(GLuint *glp, const char *flag, GLuint uniformOffset)
         djgp_push_string(djp, "#define FLAG_CULL 1\n");
     if (g_terrain.flags.wire)
         djgp_push_string(djp, "#define FLAG_WIRE 1\n");
+    pushTileStreamingDefines(djp);
     djgp_push_file(djp, strcat2(buf, g_app.dir.shader, "FrustumCulling.glsl"));
     djgp_push_file(djp, PATH_TO_LEB_GLSL_LIBRARY "LongestEdgeBisection.glsl");
     djgp_push_file(djp, strcat2(buf, g_app.dir.shader, "TerrainRenderCommon.glsl"));
@@ -653,6 +770,10 @@ bool loadTerrainProgram(GLuint *glp, const char *flag, GLuint uniformOffset)
         glGetUniformLocation(*glp, "u_MinLodVariance");
     g_gl.uniforms[UNIFORM_TERRAIN_SCREEN_RESOLUTION + uniformOffset] =
         glGetUniformLocation(*glp, "u_ScreenResolution");
+    g_gl.uniforms[UNIFORM_TERRAIN_SMAP_FACTOR + uniformOffset] =
+        glGetUniformLocation(*glp, "u_SmapFactor");
+    g_gl.uniforms[UNIFORM_TERRAIN_DMAP_BOUNDS_SAMPLER + uniformOffset] =
+        glGetUniformLocation(*glp, "u_DmapBoundsSampler");
 
     configureTerrainProgram(*glp, uniformOffset);
 
@@ -789,6 +910,7 @@ bool loadTopViewProgram()
     LOG("Loading {Top-View-Program}\n");
     if (g_terrain.flags.displace)
         djgp_push_string(djp, "#define FLAG_DISPLACE 1\n");
+    pushTileStreamingDefines(djp);
     djgp_push_string(djp, "#define TERRAIN_PATCH_SUBD_LEVEL %i\n", g_terrain.gpuSubd);
     djgp_push_string(djp, "#define TERRAIN_PATCH_TESS_FACTOR %i\n", 1 << g_terrain.gpuSubd);
     djgp_push_string(djp, "#define BUFFER_BINDING_TERRAIN_VARIABLES %i\n", STREAM_TERRAIN_VARIABLES);
@@ -809,12 +931,57 @@ bool loadTopViewProgram()
         glGetUniformLocation(*glp, "u_DmapFactor");
     g_gl.uniforms[UNIFORM_TOPVIEW_DMAP_SAMPLER] =
         glGetUniformLocation(*glp, "u_DmapSampler");
+    g_gl.uniforms[UNIFORM_TOPVIEW_DMAP_BOUNDS_SAMPLER] =
+        glGetUniformLocation(*glp, "u_DmapBoundsSampler");
 
     configureTopViewProgram();
 
     return (glGetError() == GL_NO_ERROR);
 }
 
+// -----------------------------------------------------------------------------
+/**
+ * Load the Tile Request Program
+ *
+ * This program is responsible for recording the tiles of a tiled heightmap
+ * that the visible nodes of the subdivision need.
+ */
+bool loadTileRequestProgram()
+{
+    djg_program *djp;
+    GLuint *glp = &g_gl.programs[PROGRAM_TILE_REQUEST];
+    char buf[1024];
+
+    if (!g_tiles.heightmap)
+        return true;
+
+    LOG("Loading {Tile-Request-Program}\n");
+    djp = djgp_create();
+    djgp_push_string(djp, "#define FLAG_DISPLACE 1\n");
+    pushTileStreamingDefines(djp);
+    djgp_push_string(djp, "#define BUFFER_BINDING_TERRAIN_VARIABLES %i\n", STREAM_TERRAIN_VARIABLES);
+    djgp_push_string(djp, "#define BUFFER_BINDING_TILE_REQUESTS %i\n", BUFFER_TILE_REQUESTS0);
+    djgp_push_string(djp, "#define LEB_BUFFER_COUNT 1\n");
+    djgp_push_string(djp, "#define BUFFER_BINDING_LEB %i\n", BUFFER_LEB);
+    djgp_push_file(djp, strcat2(buf, g_app.dir.shader, "FrustumCulling.glsl"));
+    djgp_push_file(djp, PATH_TO_LEB_GLSL_LIBRARY "LongestEdgeBisection.glsl");
+    djgp_push_file(djp, strcat2(buf, g_app.dir.shader, "TerrainRenderCommon.glsl"));
+    djgp_push_file(djp, strcat2(buf, g_app.dir.shader, "TerrainTileRequest.glsl"));
+    if (!djgp_to_gl(djp, 450, false, true, glp)) {
+        djgp_release(djp);
+
+        return false;
+    }
+    djgp_release(djp);
+
+    g_gl.uniforms[UNIFORM_TILE_REQUEST_DMAP_FACTOR] =
+        glGetUniformLocation(*glp, "u_DmapFactor");
+
+    configureTileRequestProgram();
+
+    return (glGetError() == GL_NO_ERROR);
+}
+
 // -----------------------------------------------------------------------------
 /**
  * Load All Programs
@@ -830,6 +997,7 @@ bool loadPrograms()
     if (v) v &= loadLebReductionPrepassProgram();
     if (v) v &= loadBatchProgram();
     if (v) v &= loadTopViewProgram();
+    if (v) v &= loadTileRequestProgram();
 
     return v;
 }
@@ -924,11 +1092,29 @@ bool loadSceneFramebufferTexture()
     return (glGetError() == GL_NO_ERROR);
 }
 
+// -----------------------------------------------------------------------------
+// OpenGL formats of the slope texture
+struct SlopeTextureFormat {
+    GLenum internalFormat, type;
+};
+
+SlopeTextureFormat slopeTextureFormat(hmap_SlopeFormat format)
+{
+    const SlopeTextureFormat formats[] = {
+        {GL_RG32F, GL_FLOAT},
+        {GL_RG16F, GL_HALF_FLOAT},
+        {GL_RG16_SNORM, GL_SHORT}
+    };
+
+    return formats[format];
+}
+
 // -----------------------------------------------------------------------------
 /**
  * Load the Normal Texture Map
  *
- * This loads an RG32F texture used as a slope map
+ * This loads a texture used as a slope map, stored in the format of
+ * g_terrain.smap.format
  */
 void loadNmapTexture(const djg_texture *dmap)
 {
@@ -936,29 +1122,13 @@ void loadNmapTexture(const djg_texture *dmap)
     int h = dmap->next->y;
     const uint16_t *texels = (const uint16_t *)dmap->next->texels;
     int mipcnt = djgt__mipcnt(w, h, 1);
+    hmap_SlopeFormat format = g_terrain.smap.format;
+    SlopeTextureFormat glFormat = slopeTextureFormat(format);
+    std::vector<char> smap((size_t)hmap_SlopeByteSize(format) * w * h);
 
-    std::vector<float> smap(w * h * 2);
-
-    for (int j = 0; j < h; ++j)
-        for (int i = 0; i < w; ++i) {
-            int i1 = std::max(0, i - 1);
-            int i2 = std::min(w - 1, i + 1);
-            int j1 = std::max(0, j - 1);
-            int j2 = std::min(h - 1, j + 1);
-            uint16_t px_l = texels[i1 + w * j]; // in [0,2^16-1]
-            uint16_t px_r = texels[i2 + w * j]; // in [0,2^16-1]
-            uint16_t px_b = texels[i + w * j1]; // in [0,2^16-1]
-            uint16_t px_t = texels[i + w * j2]; // in [0,2^16-1]
-            float z_l = (float)px_l / 65535.0f; // in [0, 1]
-            float z_r = (float)px_r / 65535.0f; // in [0, 1]
-            float z_b = (float)px_b / 65535.0f; // in [0, 1]
-            float z_t = (float)px_t / 65535.0f; // in [0, 1]
-            float slope_x = (float)w * 0.5f * (z_r - z_l);
-            float slope_y = (float)h * 0.5f * (z_t - z_b);
-
-            smap[    2 * (i + w * j)] = slope_x;
-            smap[1 + 2 * (i + w * j)] = slope_y;
-        }
+    g_terrain.smap.factor = format == HMAP_SLOPE_RG16_SNORM
+                          ? hmap_MaxSlope(texels, w, h) : 1.0f;
+    hmap_ComputeSlopes(texels, w, h, format, g_terrain.smap.factor, &smap[0]);
 
     if (glIsTexture(g_gl.textures[TEXTURE_SMAP]))
         glDeleteTextures(1, &g_gl.textures[TEXTURE_SMAP]);
@@ -966,8 +1136,8 @@ void loadNmapTexture(const djg_texture *dmap)
     glGenTextures(1, &g_gl.textures[TEXTURE_SMAP]);
     glActiveTexture(GL_TEXTURE0 + TEXTURE_SMAP);
     glBindTexture(GL_TEXTURE_2D, g_gl.textures[TEXTURE_SMAP]);
-    glTexStorage2D(GL_TEXTURE_2D, mipcnt, GL_RG32F, w, h);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RG, GL_FLOAT, &smap[0]);
+    glTexStorage2D(GL_TEXTURE_2D, mipcnt, glFormat.internalFormat, w, h);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RG, glFormat.type, &smap[0]);
 
     glGenerateMipmap(GL_TEXTURE_2D);
     glTexParameteri(GL_TEXTURE_2D,
@@ -982,19 +1152,284 @@ void loadNmapTexture(const djg_texture *dmap)
     glActiveTexture(GL_TEXTURE0);
 }
 
+// -----------------------------------------------------------------------------
+/**
+ * Load the Displacement Bounds Texture
+ *
+ * This loads the min/max pyramid of the heights, which the culling test uses
+ * to bound the heights of each node; it is computed from the (z, z^2) texels
+ * of the first level of the displacement texture
+ */
+void loadDmapBoundsTexture(const uint16_t *dmap, int w, int h)
+{
+    int levelCount = hmap_HeightBoundsLevelCount(w, h);
+    std::vector<uint16_t> bounds(2u * std::max(1, w >> 1) * std::max(1, h >> 1));
+    std::vector<uint16_t> nextBounds;
+
+    hmap_ComputeHeightBounds(dmap, w, h, &bounds[0]);
+    w = std::max(1, w >> 1);
+    h = std::max(1, h >> 1);
+
+    if (glIsTexture(g_gl.textures[TEXTURE_DMAP_BOUNDS]))
+        glDeleteTextures(1, &g_gl.textures[TEXTURE_DMAP_BOUNDS]);
+
+    glGenTextures(1, &g_gl.textures[TEXTURE_DMAP_BOUNDS]);
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_DMAP_BOUNDS);
+    glBindTexture(GL_TEXTURE_2D, g_gl.textures[TEXTURE_DMAP_BOUNDS]);
+    glTexStorage2D(GL_TEXTURE_2D, levelCount, GL_RG16, w, h);
+
+    for (int i = 0; i < levelCount; ++i) {
+        glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, w, h,
+                        GL_RG, GL_UNSIGNED_SHORT, &bounds[0]);
+
+        if (i + 1 < levelCount) {
+            nextBounds.resize(2u * std::max(1, w >> 1) * std::max(1, h >> 1));
+            hmap_ComputeNextHeightBounds(&bounds[0], w, h, &nextBounds[0]);
+            bounds.swap(nextBounds);
+            w = std::max(1, w >> 1);
+            h = std::max(1, h >> 1);
+        }
+    }
+
+    // the bounds are fetched texel by texel
+    glTexParameteri(GL_TEXTURE_2D,
+        GL_TEXTURE_MIN_FILTER,
+        GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D,
+        GL_TEXTURE_MAG_FILTER,
+        GL_NEAREST);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * Load the Displacement and Slope Textures from a Heightmap Container
+ *
+ * The container stores every mip level of both textures, which are uploaded
+ * straight from the mapped file
+ */
+void loadHeightmapContainerTextures(const hmap_Heightmap *hmap)
+{
+    SlopeTextureFormat slopeFormat = slopeTextureFormat(hmap->slopeFormat);
+    const GLenum formats[] = {GL_RG16, slopeFormat.internalFormat};
+    const GLenum types[] = {GL_UNSIGNED_SHORT, slopeFormat.type};
+    const int textureIDs[] = {TEXTURE_DMAP, TEXTURE_SMAP};
+
+    g_terrain.smap.format = hmap->slopeFormat;
+    g_terrain.smap.factor = hmap->slopeScale;
+    loadDmapBoundsTexture(hmap->levels[0].dmap, hmap->width, hmap->height);
+
+    for (int i = 0; i < 2; ++i) {
+        int textureID = textureIDs[i];
+
+        if (glIsTexture(g_gl.textures[textureID]))
+            glDeleteTextures(1, &g_gl.textures[textureID]);
+
+        glGenTextures(1, &g_gl.textures[textureID]);
+        glActiveTexture(GL_TEXTURE0 + textureID);
+        glBindTexture(GL_TEXTURE_2D, g_gl.textures[textureID]);
+        glTexStorage2D(GL_TEXTURE_2D, hmap->levelCount, formats[i],
+                       hmap->width, hmap->height);
+
+        for (int j = 0; j < hmap->levelCount; ++j) {
+            const hmap_Level &level = hmap->levels[j];
+            const void *texels = i == 0 ? (const void *)level.dmap
+                                        : (const void *)level.smap;
+
+            glTexSubImage2D(GL_TEXTURE_2D, j, 0, 0, level.width, level.height,
+                            GL_RG, types[i], texels);
+        }
+
+        glTexParameteri(GL_TEXTURE_2D,
+            GL_TEXTURE_MIN_FILTER,
+            GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D,
+            GL_TEXTURE_WRAP_S,
+            GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D,
+            GL_TEXTURE_WRAP_T,
+            GL_CLAMP_TO_EDGE);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * Upload a Tile to the Tile Cache
+ */
+void uploadTile(int layer, const void *dmap, const void *smap)
+{
+    SlopeTextureFormat slopeFormat = slopeTextureFormat(g_tiles.heightmap->slopeFormat);
+    int tileSize = g_tiles.heightmap->tileSize + 2;
+
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_DMAP_TILES);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, tileSize, tileSize, 1,
+                    GL_RG, GL_UNSIGNED_SHORT, dmap);
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_SMAP_TILES);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, tileSize, tileSize, 1,
+                    GL_RG, slopeFormat.type, smap);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// uploads the tile table if tiles were inserted since the last upload
+void uploadTileTable()
+{
+    const uint32_t *table = hmap_UpdateTileTable(g_tiles.cache);
+
+    if (table) {
+        glBindBuffer(GL_TEXTURE_BUFFER, g_gl.buffers[BUFFER_TILE_TABLE]);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0,
+                        sizeof(*table) * g_tiles.heightmap->tileCount, table);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+}
+
+void releaseTileStreaming()
+{
+    if (g_tiles.streamer)
+        hmap_ReleaseTileStreamer(g_tiles.streamer);
+    if (g_tiles.cache)
+        hmap_ReleaseTileCache(g_tiles.cache);
+    if (g_tiles.heightmap)
+        hmap_ReleaseTiled(g_tiles.heightmap);
+    for (int i = 0; i < 2; ++i)
+        if (g_tiles.fences[i])
+            glDeleteSync(g_tiles.fences[i]);
+
+    g_tiles.streamer = NULL;
+    g_tiles.cache = NULL;
+    g_tiles.heightmap = NULL;
+    g_tiles.fences[0] = g_tiles.fences[1] = NULL;
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * Load the Tile Cache
+ *
+ * This allocates the texture arrays that hold the resident tiles of a tiled
+ * heightmap, along with the tile table and the tile request buffers. Only
+ * the coarsest tile is loaded here; the others are streamed as the
+ * subdivision requests them (see lebStreamingPass).
+ */
+bool loadTileCache()
+{
+    const hmap_TiledHeightmap *heightmap = g_tiles.heightmap;
+    SlopeTextureFormat slopeFormat = slopeTextureFormat(heightmap->slopeFormat);
+    const GLenum formats[] = {GL_RG16, slopeFormat.internalFormat};
+    const int textureIDs[] = {TEXTURE_DMAP_TILES, TEXTURE_SMAP_TILES};
+    const int tileSize = heightmap->tileSize + 2;
+    const GLsizeiptr tableByteSize = sizeof(uint32_t) * heightmap->tileCount;
+    const int rootTileIndex = heightmap->tileCount - 1;
+    std::vector<char> rootTile(heightmap->tileByteSize);
+    GLint maxLayerCount;
+    int layerCount;
+
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayerCount);
+    layerCount = std::min(g_tiles.cacheSize, (int)maxLayerCount);
+    g_tiles.cache = hmap_CreateTileCache(heightmap, layerCount);
+    g_tiles.requests.resize(heightmap->tileCount);
+    g_terrain.smap.format = heightmap->slopeFormat;
+    g_terrain.smap.factor = heightmap->slopeScale;
+
+    for (int i = 0; i < 2; ++i) {
+        int textureID = textureIDs[i];
+
+        if (glIsTexture(g_gl.textures[textureID]))
+            glDeleteTextures(1, &g_gl.textures[textureID]);
+
+        glGenTextures(1, &g_gl.textures[textureID]);
+        glActiveTexture(GL_TEXTURE0 + textureID);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, g_gl.textures[textureID]);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, formats[i],
+                       tileSize, tileSize, layerCount);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY,
+            GL_TEXTURE_MIN_FILTER,
+            GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY,
+            GL_TEXTURE_WRAP_S,
+            GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY,
+            GL_TEXTURE_WRAP_T,
+            GL_CLAMP_TO_EDGE);
+    }
+
+    // tile table
+    if (glIsBuffer(g_gl.buffers[BUFFER_TILE_TABLE]))
+        glDeleteBuffers(1, &g_gl.buffers[BUFFER_TILE_TABLE]);
+    if (glIsTexture(g_gl.textures[TEXTURE_TILE_TABLE]))
+        glDeleteTextures(1, &g_gl.textures[TEXTURE_TILE_TABLE]);
+
+    glGenBuffers(1, &g_gl.buffers[BUFFER_TILE_TABLE]);
+    glBindBuffer(GL_TEXTURE_BUFFER, g_gl.buffers[BUFFER_TILE_TABLE]);
+    glBufferData(GL_TEXTURE_BUFFER, tableByteSize, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glGenTextures(1, &g_gl.textures[TEXTURE_TILE_TABLE]);
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_TILE_TABLE);
+    glBindTexture(GL_TEXTURE_BUFFER, g_gl.textures[TEXTURE_TILE_TABLE]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, g_gl.buffers[BUFFER_TILE_TABLE]);
+    glActiveTexture(GL_TEXTURE0);
+
+    // tile requests, written and read back in turns
+    for (int i = 0; i < 2; ++i) {
+        GLuint *buffer = &g_gl.buffers[BUFFER_TILE_REQUESTS0 + i];
+
+        if (glIsBuffer(*buffer))
+            glDeleteBuffers(1, buffer);
+
+        glGenBuffers(1, buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, tableByteSize, NULL, GL_DYNAMIC_READ);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // the coarsest tile is always resident
+    if (!hmap_ReadTile(heightmap, rootTileIndex, &rootTile[0]))
+        return false;
+
+    uploadTile(hmap_InsertTile(g_tiles.cache, rootTileIndex),
+               &rootTile[0],
+               &rootTile[2 * sizeof(uint16_t) * tileSize * tileSize]);
+    uploadTileTable();
+    g_tiles.streamer = hmap_CreateTileStreamer(heightmap, g_tiles.slotCount);
+
+    return (glGetError() == GL_NO_ERROR);
+}
+
 // -----------------------------------------------------------------------------
 /**
  * Load the Displacement Texture
  *
- * This loads an R16 texture used as a displacement map
+ * This loads an R16 texture used as a displacement map; if the heightmap
+ * was preprocessed with the HeightmapConverter, its container is used
+ * instead, and its tiled container is streamed into a tile cache
  */
 bool loadDmapTexture()
 {
-    if (!g_terrain.dmap.pathToFile.empty()) {
+    const std::string &pathToFile = g_terrain.dmap.pathToFile;
+    hmap_Heightmap *hmap = NULL;
+
+    releaseTileStreaming();
+    if (!pathToFile.empty()) {
+        g_tiles.heightmap =
+            hmap_LoadTiled(hmap_ContainerPath(pathToFile, ".htiles").c_str());
+
+        if (!g_tiles.heightmap)
+            hmap = hmap_Load(hmap_ContainerPath(pathToFile, ".hmap").c_str());
+    }
+
+    if (g_tiles.heightmap) {
+        LOG("Loading {Dmap-Texture} (tiled container)\n");
+
+        return loadTileCache();
+    } else if (hmap) {
+        LOG("Loading {Dmap-Texture} (container)\n");
+        loadHeightmapContainerTextures(hmap);
+        hmap_Release(hmap);
+    } else if (!pathToFile.empty()) {
         djg_texture *djgt = djgt_create(1);
 
         LOG("Loading {Dmap-Texture}\n");
-        djgt_push_image_u16(djgt, g_terrain.dmap.pathToFile.c_str(), 1);
+        djgt_push_image_u16(djgt, pathToFile.c_str(), 1);
 
         int w = djgt->next->x;
         int h = djgt->next->y;
@@ -1014,6 +1449,7 @@ bool loadDmapTexture()
 
         // load nmap from dmap
         loadNmapTexture(djgt);
+        loadDmapBoundsTexture(&dmap[0], w, h);
 
         glActiveTexture(GL_TEXTURE0 + TEXTURE_DMAP);
         if (glIsTexture(g_gl.textures[TEXTURE_DMAP]))
@@ -1180,6 +1616,64 @@ bool loadLebBuffer()
     return (glGetError() == GL_NO_ERROR);
 }
 
+// the snapshot of the subdivision, which TerrainUpdateCS refines in quad mode
+const char *lebSnapshotPath(char *buf)
+{
+    return strcat2(buf, g_app.dir.output, "Terrain.leb");
+}
+
+// replaces the subdivision with a snapshot, if its depths match the settings
+bool loadLebBufferFromSnapshot(const char *pathToFile)
+{
+    lebsnap_Snapshot *snapshot = lebsnap_Load(pathToFile, LEBSNAP_MODE_QUAD);
+
+    if (!snapshot)
+        return false;
+
+    if (snapshot->heap.minDepth != 1
+        || snapshot->heap.maxDepth != g_terrain.maxDepth) {
+        LOG("=> Failure <= %s has a max depth of %i instead of %i\n",
+            pathToFile, snapshot->heap.maxDepth, g_terrain.maxDepth);
+        lebsnap_Release(snapshot);
+
+        return false;
+    }
+
+    LOG("Loading {Subd-Buffer} from %s\n", pathToFile);
+    if (glIsBuffer(g_gl.buffers[BUFFER_LEB]))
+        glDeleteBuffers(1, &g_gl.buffers[BUFFER_LEB]);
+    glGenBuffers(1, &g_gl.buffers[BUFFER_LEB]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gl.buffers[BUFFER_LEB]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 snapshot->gpuBufferByteSize,
+                 snapshot->gpuBuffer,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+                     BUFFER_LEB,
+                     g_gl.buffers[BUFFER_LEB]);
+
+    lebsnap_Release(snapshot);
+
+    return (glGetError() == GL_NO_ERROR);
+}
+
+// saves the current subdivision, which loadLebBufferFromSnapshot then loads
+bool saveLebBuffer()
+{
+    const GLsizeiptr byteSize = leb__HeapByteSize(g_terrain.maxDepth)
+                              + 2 * sizeof(int32_t);
+    std::vector<char> data(byteSize);
+    char buf[1024];
+
+    LOG("Saving {Subd-Buffer} to %s\n", lebSnapshotPath(buf));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gl.buffers[BUFFER_LEB]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, byteSize, &data[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return lebsnap_SaveBuffer(buf, &data[0], LEBSNAP_MODE_QUAD);
+}
+
 // -----------------------------------------------------------------------------
 /**
  * Load the indirect command buffer
@@ -1511,6 +2005,8 @@ void init()
 
     if (v) v &= loadTextures();
     if (v) v &= loadBuffers();
+    if (v && g_app.pathToSubdivision)
+        v &= loadLebBufferFromSnapshot(g_app.pathToSubdivision);
     if (v) v &= loadFramebuffers();
     if (v) v &= loadVertexArrays();
     if (v) v &= loadPrograms();
@@ -1524,6 +2020,8 @@ void release()
 {
     int i;
 
+    releaseTileStreaming();
+
     for (i = 0; i < CLOCK_COUNT; ++i)
         if (g_gl.clocks[i])
             djgc_release(g_gl.clocks[i]);
@@ -1708,6 +2206,75 @@ void lebBatchingPass()
     djgc_stop(g_gl.clocks[CLOCK_BATCH]);
 }
 
+// -----------------------------------------------------------------------------
+/**
+ * Streaming Pass (tiled heightmaps only)
+ *
+ * The streaming pass forwards the tile requests of a previous frame to the
+ * tile cache once they can be read back without stalling, uploads the
+ * tiles read by the streamer since, and records the tile requests of the
+ * current subdivision.
+ */
+void lebStreamingPass()
+{
+    const GLsizeiptr requestByteSize = sizeof(uint32_t) * g_tiles.heightmap->tileCount;
+    GLsync *readbackFence = &g_tiles.fences[1 - g_tiles.pingPong];
+    hmap_StreamedTile tile;
+
+    djgc_start(g_gl.clocks[CLOCK_STREAM]);
+
+    // forward the requests
+    if (*readbackFence) {
+        GLenum status = glClientWaitSync(*readbackFence, 0, 0);
+
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            glDeleteSync(*readbackFence);
+            *readbackFence = NULL;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER,
+                         g_gl.buffers[BUFFER_TILE_REQUESTS0 + 1 - g_tiles.pingPong]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, requestByteSize,
+                               &g_tiles.requests[0]);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            hmap_RequestTiles(g_tiles.cache, g_tiles.streamer, &g_tiles.requests[0]);
+        }
+    }
+
+    // upload the streamed tiles
+    for (int i = 0; i < g_tiles.uploadCount
+                    && hmap_PopStreamedTile(g_tiles.streamer, &tile); ++i) {
+        int layer = hmap_InsertTile(g_tiles.cache, tile.tileIndex);
+
+        if (layer >= 0)
+            uploadTile(layer, tile.dmap, tile.smap);
+
+        hmap_RecycleStreamedTile(g_tiles.streamer, &tile);
+    }
+    uploadTileTable();
+
+    // record the requests, unless they would overwrite pending ones
+    if (g_terrain.flags.displace && !g_tiles.fences[g_tiles.pingPong]) {
+        const uint32_t noRequest = HMAP_NO_REQUEST;
+        const int groupCount = 64; // nodes are visited in a grid-stride loop
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BUFFER_LEB, g_gl.buffers[BUFFER_LEB]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+                         BUFFER_TILE_REQUESTS0,
+                         g_gl.buffers[BUFFER_TILE_REQUESTS0 + g_tiles.pingPong]);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI,
+                          GL_RED_INTEGER, GL_UNSIGNED_INT, &noRequest);
+        glUseProgram(g_gl.programs[PROGRAM_TILE_REQUEST]);
+        glDispatchCompute(groupCount, 1, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BUFFER_TILE_REQUESTS0, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BUFFER_LEB, 0);
+
+        g_tiles.fences[g_tiles.pingPong] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        g_tiles.pingPong = 1 - g_tiles.pingPong;
+    }
+
+    djgc_stop(g_gl.clocks[CLOCK_STREAM]);
+}
+
 // -----------------------------------------------------------------------------
 /**
  * Update Pass
@@ -1879,6 +2446,8 @@ void renderTerrain()
     lebUpdate();
     lebReductionPass();
     lebBatchingPass();
+    if (g_tiles.heightmap)
+        lebStreamingPass();
     lebRender(); // render pass (if applicable)
 
     djgc_stop(g_gl.clocks[CLOCK_ALL]);
@@ -2015,6 +2584,16 @@ void renderViewer()
                     gpuDt < 1. ? gpuDt * 1e3 : gpuDt,
                     gpuDt < 1. ? "ms" : " s");
             }
+            if (g_tiles.heightmap) {
+                djgc_ticks(g_gl.clocks[CLOCK_STREAM], &cpuDt, &gpuDt);
+                ImGui::Text("Streaming -- CPU: %.3f%s",
+                    cpuDt < 1. ? cpuDt * 1e3 : cpuDt,
+                    cpuDt < 1. ? "ms" : " s");
+                ImGui::SameLine();
+                ImGui::Text("GPU: %.3f%s",
+                    gpuDt < 1. ? gpuDt * 1e3 : gpuDt,
+                    gpuDt < 1. ? "ms" : " s");
+            }
             djgc_ticks(g_gl.clocks[CLOCK_ALL], &cpuDt, &gpuDt);
             ImGui::Text("All       -- CPU: %.3f%s",
                 cpuDt < 1. ? cpuDt * 1e3 : cpuDt,
@@ -2092,6 +2671,7 @@ void renderViewer()
             if (ImGui::SliderFloat("DmapScale", &g_terrain.dmap.scale, 0.f, 1.f)) {
                 configureTerrainPrograms();
                 configureTopViewProgram();
+                configureTileRequestProgram();
             }
             if (ImGui::SliderFloat("LodStdev", &g_terrain.minLodStdev, 0.f, 1.0f, "%.4f")) {
                 configureTerrainPrograms();
@@ -2116,6 +2696,20 @@ void renderViewer()
                     ImGui::Text("LEB heap size: %i MBytes", bufSize >> 20);
                 }
             }
+            if (g_tiles.heightmap) {
+                ImGui::Text("Resident tiles: %i / %i",
+                            hmap_ResidentTileCount(g_tiles.cache),
+                            g_tiles.heightmap->tileCount);
+            }
+            if (ImGui::Button("Save Subdivision")) {
+                saveLebBuffer();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Load Subdivision")) {
+                char buf[1024];
+
+                loadLebBufferFromSnapshot(lebSnapshotPath(buf));
+            }
         }
         ImGui::End();
 
@@ -2152,16 +2746,322 @@ void render()
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     renderScene();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, g_app.viewer.w, g_app.viewer.h);
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    renderViewer();
-
+    // there is no window to present to in headless mode
+    if (!g_app.headless.on) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, g_app.viewer.w, g_app.viewer.h);
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        renderViewer();
+    }
 
     ++g_app.frame;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Headless Runner
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// -----------------------------------------------------------------------------
+/**
+ * Load Camera Path
+ *
+ * The camera path is a text file with one keyframe per line, made of the
+ * position of the camera followed by its up and side angles (in radians):
+ *   x y z upAngle sideAngle
+ * Empty lines and lines starting with '#' are skipped.
+ */
+bool loadCameraPath(const char *pathToFile)
+{
+    LOG("Loading {Camera-Path}\n");
+    FILE *pf = fopen(pathToFile, "r");
+    char line[256];
+
+    if (!pf) {
+        LOG("=> Failure <=\n");
+
+        return false;
+    }
+
+    g_app.headless.cameraPath.clear();
+    while (fgets(line, sizeof(line), pf)) {
+        CameraKeyframe keyframe;
+        char c;
+
+        if (sscanf(line, " %c", &c) != 1 || c == '#')
+            continue;
+
+        if (sscanf(line, "%f %f %f %f %f",
+                   &keyframe.pos.x, &keyframe.pos.y, &keyframe.pos.z,
+                   &keyframe.upAngle, &keyframe.sideAngle) != 5) {
+            LOG("=> Failure <= invalid keyframe: %s", line);
+            fclose(pf);
+
+            return false;
+        }
+
+        g_app.headless.cameraPath.push_back(keyframe);
+    }
+    fclose(pf);
+
+    if (g_app.headless.cameraPath.empty()) {
+        LOG("=> Failure <= empty camera path\n");
+
+        return false;
+    }
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * Set Camera From Path
+ *
+ * This procedure moves the camera along the camera path, which is covered
+ * at a constant rate by frames [0, frameCount).
+ */
+void setCameraFromPath(int frame, int frameCount)
+{
+    const std::vector<CameraKeyframe> &path = g_app.headless.cameraPath;
+
+    if (path.empty())
+        return;
+
+    float t = frameCount > 1
+            ? (float)frame / (float)(frameCount - 1) * (float)(path.size() - 1)
+            : 0.0f;
+    int i = std::min((int)t, (int)path.size() - 1);
+    int j = std::min(i + 1, (int)path.size() - 1);
+    float u = t - (float)i;
+
+    g_camera.pos = path[i].pos + (path[j].pos - path[i].pos) * u;
+    g_camera.upAngle = path[i].upAngle + (path[j].upAngle - path[i].upAngle) * u;
+    g_camera.sideAngle = path[i].sideAngle + (path[j].sideAngle - path[i].sideAngle) * u;
+    updateCameraMatrix();
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * Write Timings
+ *
+ * The timings of the djgc clocks are written as one CSV row per frame,
+ * in milliseconds.
+ */
+static const struct { int clock; const char *name; } g_timedClocks[] = {
+    {CLOCK_ALL, "all"},
+    {CLOCK_UPDATE, "update"},
+    {CLOCK_REDUCTION, "reduction"},
+    {CLOCK_BATCH, "batch"},
+    {CLOCK_RENDER, "render"},
+    {CLOCK_STREAM, "stream"}   // last, as it only runs for tiled heightmaps
+};
+
+// the stream clock only runs when a tiled heightmap is streamed
+int timedClockCount()
+{
+    return BUFFER_SIZE(g_timedClocks) - (g_tiles.heightmap ? 0 : 1);
+}
+
+void writeTimingsHeader(FILE *pf)
+{
+    fprintf(pf, "frame");
+    for (int i = 0; i < timedClockCount(); ++i)
+        fprintf(pf, ",%sCpuMs,%sGpuMs", g_timedClocks[i].name, g_timedClocks[i].name);
+    fprintf(pf, "\n");
+}
+
+void writeTimings(FILE *pf, int frame, double cpuSums[], double gpuSums[])
+{
+    fprintf(pf, "%i", frame);
+    for (int i = 0; i < timedClockCount(); ++i) {
+        double cpuDt, gpuDt;
+
+        djgc_ticks(g_gl.clocks[g_timedClocks[i].clock], &cpuDt, &gpuDt);
+        fprintf(pf, ",%.4f,%.4f", cpuDt * 1e3, gpuDt * 1e3);
+        cpuSums[i]+= cpuDt * 1e3;
+        gpuSums[i]+= gpuDt * 1e3;
+    }
+    fprintf(pf, "\n");
+}
+
+// -----------------------------------------------------------------------------
+/**
+ * Headless OpenGL Context
+ *
+ * The headless runner renders without a window through a surfaceless EGL
+ * context, which Mesa's software rasterizer (llvmpipe) provides on machines
+ * without a display server.
+ */
+#if TERRAIN_HEADLESS_EGL
+struct HeadlessContext {
+    EGLDisplay display;
+    EGLContext context;
+} g_egl = {EGL_NO_DISPLAY, EGL_NO_CONTEXT};
+
+void releaseHeadlessContext()
+{
+    if (g_egl.display == EGL_NO_DISPLAY)
+        return;
+
+    eglMakeCurrent(g_egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (g_egl.context != EGL_NO_CONTEXT)
+        eglDestroyContext(g_egl.display, g_egl.context);
+    eglTerminate(g_egl.display);
+    g_egl.display = EGL_NO_DISPLAY;
+    g_egl.context = EGL_NO_CONTEXT;
+}
+
+bool loadHeadlessContext()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_CONTEXT_FLAGS_KHR, EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount;
+
+    LOG("Loading {EGL-Context}\n");
+    if (getPlatformDisplay)
+        g_egl.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                           EGL_DEFAULT_DISPLAY, NULL);
+    if (g_egl.display == EGL_NO_DISPLAY)
+        g_egl.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if (g_egl.display == EGL_NO_DISPLAY
+        || !eglInitialize(g_egl.display, NULL, NULL)
+        || !eglBindAPI(EGL_OPENGL_API)
+        || !eglChooseConfig(g_egl.display, configAttribs, &config, 1, &configCount)
+        || configCount == 0) {
+        LOG("=> Failure <= no EGL display for OpenGL\n");
+        releaseHeadlessContext();
+
+        return false;
+    }
+
+    g_egl.context = eglCreateContext(g_egl.display, config,
+                                     EGL_NO_CONTEXT, contextAttribs);
+    if (g_egl.context == EGL_NO_CONTEXT
+        || !eglMakeCurrent(g_egl.display,
+                           EGL_NO_SURFACE, EGL_NO_SURFACE,
+                           g_egl.context)) {
+        LOG("=> Failure <= no surfaceless OpenGL 4.5 context\n");
+        releaseHeadlessContext();
+
+        return false;
+    }
+
+    LOG("Loading {OpenGL}\n");
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        LOG("gladLoadGLLoader failed\n");
+        releaseHeadlessContext();
+
+        return false;
+    }
+
+    return true;
+}
+#else
+void releaseHeadlessContext() {}
+
+bool loadHeadlessContext()
+{
+    LOG("=> Failure <= headless mode requires a build linked against EGL\n");
+
+    return false;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+/**
+ * Run Headless
+ *
+ * This procedure renders the terrain offscreen, without ImGui, for a fixed
+ * number of frames along the camera path, and writes the timings of each
+ * frame to a file.
+ */
+int runHeadless()
+{
+    char buf[1024];
+    const char *pathToTimings = g_app.headless.pathToTimings
+                              ? g_app.headless.pathToTimings
+                              : strcat2(buf, g_app.dir.output, "TerrainTimings.csv");
+    double cpuSums[BUFFER_SIZE(g_timedClocks)] = {0};
+    double gpuSums[BUFFER_SIZE(g_timedClocks)] = {0};
+    FILE *pf = NULL;
+
+    if (!loadHeadlessContext())
+        return EXIT_FAILURE;
+
+    LOG("-- Begin -- Headless\n");
+    try {
+        if (g_app.headless.pathToCameraPath
+            && !loadCameraPath(g_app.headless.pathToCameraPath))
+            throw std::runtime_error("failed to load the camera path");
+
+        int frameCount = g_app.frameLimit >= 0
+                       ? g_app.frameLimit
+                       : std::max(1, (int)g_app.headless.cameraPath.size());
+
+        // the top view is a debugging aid and would pollute the timings
+        g_terrain.flags.topView = false;
+
+        LOG("-- Begin -- Init\n");
+        log_debug_output();
+        init();
+        LOG("-- End -- Init\n");
+
+        if (!(pf = fopen(pathToTimings, "w")))
+            throw std::runtime_error(std::string("failed to open ") + pathToTimings);
+
+        writeTimingsHeader(pf);
+        for (int frame = 0; frame < frameCount; ++frame) {
+            setCameraFromPath(frame, frameCount);
+            render();
+
+            // wait for the GPU so that the clocks hold this frame's timings
+            glFinish();
+            writeTimings(pf, frame, cpuSums, gpuSums);
+        }
+        fclose(pf);
+        pf = NULL;
+
+        for (int i = 0; i < timedClockCount(); ++i) {
+            LOG("%-9s -- CPU: %.3fms GPU: %.3fms (mean)\n",
+                g_timedClocks[i].name,
+                cpuSums[i] / std::max(1, frameCount),
+                gpuSums[i] / std::max(1, frameCount));
+        }
+        LOG("Timings written to %s\n", pathToTimings);
+
+        release();
+        releaseHeadlessContext();
+    }
+    catch (std::exception& e) {
+        LOG("%s\n", e.what());
+        if (pf)
+            fclose(pf);
+        release();
+        releaseHeadlessContext();
+        LOG("(!) Headless Run Killed (!)\n");
+
+        return EXIT_FAILURE;
+    }
+    LOG("-- End -- Headless\n");
+
+    return 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 // -----------------------------------------------------------------------------
@@ -2248,12 +3148,68 @@ void mouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 void usage(const char *app)
 {
     printf("%s -- OpenGL Terrain Renderer\n", app);
-    printf("usage: %s --shader-dir path_to_shader_dir\n", app);
+    printf("usage: %s [options]\n"
+           "  --shader-dir DIR/      path to the shader directory\n"
+           "  --subdivision FILE     start from a subdivision saved with the\n"
+           "                         'Save Subdivision' button\n"
+           "  --headless             render offscreen, without a window nor ImGui\n"
+           "  --camera-path FILE     camera keyframes of the headless run, one\n"
+           "                         'x y z upAngle sideAngle' line per keyframe\n"
+           "  --frames N             frames of the headless run (default: one per\n"
+           "                         keyframe)\n"
+           "  --timings FILE         per-frame timings of the headless run (CSV)\n"
+           "                         (default: TerrainTimings.csv)\n",
+           app);
+}
+
+void parseCommandLine(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!strcmp(arg, "--help")) {
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        } else if (!strcmp(arg, "--headless")) {
+            g_app.headless.on = true;
+            continue;
+        } else if (!value) {
+            throw std::runtime_error(std::string("missing value for ") + arg);
+        }
+
+        if (!strcmp(arg, "--shader-dir")) {
+            g_app.dir.shader = value;
+        } else if (!strcmp(arg, "--subdivision")) {
+            g_app.pathToSubdivision = value;
+        } else if (!strcmp(arg, "--camera-path")) {
+            g_app.headless.pathToCameraPath = value;
+        } else if (!strcmp(arg, "--frames")) {
+            g_app.frameLimit = std::max(0, atoi(value));
+        } else if (!strcmp(arg, "--timings")) {
+            g_app.headless.pathToTimings = value;
+        } else {
+            throw std::runtime_error(std::string("unknown option ") + arg);
+        }
+        ++i;
+    }
 }
 
 // -----------------------------------------------------------------------------
-int main(int, char **)
+int main(int argc, char **argv)
 {
+    try {
+        parseCommandLine(argc, argv);
+    } catch (std::exception& e) {
+        LOG("%s\n", e.what());
+        usage(argv[0]);
+
+        return EXIT_FAILURE;
+    }
+
+    if (g_app.headless.on)
+        return runHeadless();
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
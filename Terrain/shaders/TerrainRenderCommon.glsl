@@ -13,13 +13,100 @@ uniform PerFrameVariables {
 uniform float u_TargetEdgeLength;
 uniform float u_LodFactor;
 #if FLAG_DISPLACE
+#   if FLAG_STREAM
+layout(binding = TEXTURE_BINDING_DMAP_TILES) uniform sampler2DArray u_DmapTileSampler;
+layout(binding = TEXTURE_BINDING_SMAP_TILES) uniform sampler2DArray u_SmapTileSampler;
+layout(binding = TEXTURE_BINDING_TILE_TABLE) uniform usamplerBuffer u_TileTableSampler;
+#   else
 uniform sampler2D u_DmapSampler;
 uniform sampler2D u_SmapSampler;
+uniform sampler2D u_DmapBoundsSampler;
+#   endif
 uniform float u_DmapFactor;
+uniform float u_SmapFactor;
 uniform float u_MinLodVariance;
 #endif
 
 
+#if FLAG_DISPLACE && FLAG_STREAM
+/*******************************************************************************
+ * Tile Streaming -- Samples the heightmap from the tile cache
+ *
+ * Each level of the heightmap is split into tiles of TILE_SIZE^2 texels,
+ * stored with a border of one texel in the layers of the tile cache. The
+ * tile table gives, for each tile, the layer of the finest resident tile
+ * that covers it, and the level of that tile.
+ *
+ */
+ivec2 TileGridSize(int level)
+{
+    ivec2 levelSize = max(ivec2(TILE_HEIGHTMAP_WIDTH, TILE_HEIGHTMAP_HEIGHT) >> level,
+                          ivec2(1));
+
+    return (levelSize + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+vec2 TileTexel(vec2 texCoord, int level)
+{
+    ivec2 levelSize = max(ivec2(TILE_HEIGHTMAP_WIDTH, TILE_HEIGHTMAP_HEIGHT) >> level,
+                          ivec2(1));
+
+    return clamp(texCoord, 0.0, 1.0) * vec2(levelSize);
+}
+
+ivec2 TileCoordinate(vec2 texel, int level)
+{
+    return min(ivec2(texel) / TILE_SIZE, TileGridSize(level) - 1);
+}
+
+int TileIndex(vec2 texCoord, int level)
+{
+    int offset = 0;
+
+    for (int i = 0; i < level; ++i) {
+        ivec2 gridSize = TileGridSize(i);
+
+        offset+= gridSize.x * gridSize.y;
+    }
+
+    ivec2 tile = TileCoordinate(TileTexel(texCoord, level), level);
+
+    return offset + tile.x + TileGridSize(level).x * tile.y;
+}
+
+// texture coordinates in the tile cache of the finest resident tile that
+// covers texCoord at the given level of detail, or coarser
+vec3 TileTexCoord(vec2 texCoord, float lod)
+{
+    int level = int(clamp(lod, 0.0, float(TILE_LEVEL_COUNT - 1)));
+    uint entry = texelFetch(u_TileTableSampler, TileIndex(texCoord, level)).r;
+    int tileLevel = int(entry >> 16u);
+    vec2 texel = TileTexel(texCoord, tileLevel);
+    vec2 tileTexel = texel - vec2(TileCoordinate(texel, tileLevel) * TILE_SIZE);
+
+    return vec3((tileTexel + 1.0) / float(TILE_SIZE + 2), float(entry & 0xFFFFu));
+}
+
+// level of detail of a texture footprint, as selected by textureGrad
+float TileLod(vec2 dx, vec2 dy)
+{
+    vec2 size = vec2(TILE_HEIGHTMAP_WIDTH, TILE_HEIGHTMAP_HEIGHT);
+
+    return log2(max(length(dx * size), length(dy * size)));
+}
+
+vec2 SampleDmapTiles(vec2 texCoord, float lod)
+{
+    return textureLod(u_DmapTileSampler, TileTexCoord(texCoord, lod), 0.0).rg;
+}
+
+vec2 SampleSmapTiles(vec2 texCoord, float lod)
+{
+    return textureLod(u_SmapTileSampler, TileTexCoord(texCoord, lod), 0.0).rg;
+}
+#endif
+
+
 /*******************************************************************************
  * DecodeTriangleVertices -- Decodes the triangle vertices in local space
  *
@@ -32,7 +119,11 @@ vec4[3] DecodeTriangleVertices(in const leb_Node node)
     vec4 p2 = vec4(pos[0][1], pos[1][1], 0.0, 1.0);
     vec4 p3 = vec4(pos[0][2], pos[1][2], 0.0, 1.0);
 
-#if FLAG_DISPLACE
+#if FLAG_DISPLACE && FLAG_STREAM
+    p1.z = u_DmapFactor * SampleDmapTiles(p1.xy, 0.0).r;
+    p2.z = u_DmapFactor * SampleDmapTiles(p2.xy, 0.0).r;
+    p3.z = u_DmapFactor * SampleDmapTiles(p3.xy, 0.0).r;
+#elif FLAG_DISPLACE
     p1.z = u_DmapFactor * texture(u_DmapSampler, p1.xy).r;
     p2.z = u_DmapFactor * texture(u_DmapSampler, p2.xy).r;
     p3.z = u_DmapFactor * texture(u_DmapSampler, p3.xy).r;
@@ -156,7 +247,11 @@ bool DisplacementVarianceTest(in const vec4[3] patchVertices)
     vec2 P = (P0 + P1 + P2) / 3.0;
     vec2 dx = (P0 - P1);
     vec2 dy = (P2 - P1);
+#if FLAG_STREAM
+    vec2 dmap = SampleDmapTiles(P, TileLod(dx, dy));
+#else
     vec2 dmap = textureGrad(u_DmapSampler, P, dx, dy).rg;
+#endif
     float dmapVariance = clamp(dmap.y - dmap.x * dmap.x, 0.0, 1.0);
 
     return (dmapVariance >= u_MinLodVariance);
@@ -166,6 +261,39 @@ bool DisplacementVarianceTest(in const vec4[3] patchVertices)
 }
 #endif
 
+#if FLAG_DISPLACE && !FLAG_STREAM
+/*******************************************************************************
+ * DisplacementBounds -- Bounds the heights of a region of the terrain
+ *
+ * Level l of the min/max pyramid of the displacement map bounds blocks of
+ * 2^(l+1) x 2^(l+1) texels. The texels that bilinear lookups within the
+ * region may fetch are bounded by 2x2 texels of the pyramid, at the finest
+ * level where they span at most two blocks along each axis.
+ *
+ */
+vec2 DisplacementBounds(vec2 texCoordMin, vec2 texCoordMax)
+{
+    ivec2 dmapSize = textureSize(u_DmapSampler, 0);
+    ivec2 texelMin = ivec2(floor(clamp(texCoordMin, 0.0, 1.0) * vec2(dmapSize) - 0.5));
+    ivec2 texelMax = ivec2(floor(clamp(texCoordMax, 0.0, 1.0) * vec2(dmapSize) - 0.5)) + 1;
+    texelMin = clamp(texelMin, ivec2(0), dmapSize - 1);
+    texelMax = clamp(texelMax, ivec2(0), dmapSize - 1);
+    int extent = max(texelMax.x - texelMin.x, texelMax.y - texelMin.y);
+    int level = min(extent > 2 ? findMSB(extent - 1) : 0,
+                    textureQueryLevels(u_DmapBoundsSampler) - 1);
+    ivec2 boundsSize = textureSize(u_DmapBoundsSampler, level);
+    ivec2 t0 = min(texelMin >> (level + 1), boundsSize - 1);
+    ivec2 t1 = min(texelMax >> (level + 1), boundsSize - 1);
+    vec2 b00 = texelFetch(u_DmapBoundsSampler, ivec2(t0.x, t0.y), level).rg;
+    vec2 b10 = texelFetch(u_DmapBoundsSampler, ivec2(t1.x, t0.y), level).rg;
+    vec2 b01 = texelFetch(u_DmapBoundsSampler, ivec2(t0.x, t1.y), level).rg;
+    vec2 b11 = texelFetch(u_DmapBoundsSampler, ivec2(t1.x, t1.y), level).rg;
+
+    return vec2(min(min(b00.x, b10.x), min(b01.x, b11.x)),
+                max(max(b00.y, b10.y), max(b01.y, b11.y)));
+}
+#endif
+
 /*******************************************************************************
  * FrustumCullingTest -- Checks if the triangle lies inside the view frutsum
  *
@@ -176,9 +304,14 @@ bool FrustumCullingTest(in const vec4[3] patchVertices)
 {
     vec3 bmin = min(min(patchVertices[0].xyz, patchVertices[1].xyz), patchVertices[2].xyz);
     vec3 bmax = max(max(patchVertices[0].xyz, patchVertices[1].xyz), patchVertices[2].xyz);
-#   if FLAG_DISPLACE
+#   if FLAG_DISPLACE && FLAG_STREAM
     bmin.z = 0.0;
     bmax.z = u_DmapFactor;
+#   elif FLAG_DISPLACE
+    vec2 bounds = DisplacementBounds(bmin.xy, bmax.xy);
+
+    bmin.z = u_DmapFactor * bounds.x;
+    bmax.z = u_DmapFactor * bounds.y;
 #   endif
 
     return FrustumCullingTest(u_FrustumPlanes, bmin, bmax);
@@ -248,7 +381,11 @@ ClipSpaceAttribute TessellateClipSpaceTriangle(
 #if FLAG_DISPLACE
     // displace the surface in clip space
     vec4 upDir = u_ModelViewProjectionMatrix[2];
+#   if FLAG_STREAM
+    float z = u_DmapFactor * SampleDmapTiles(texCoord, 0.0).r;
+#   else
     float z = u_DmapFactor * textureLod(u_DmapSampler, texCoord, 0.0).r;
+#   endif
 
     position+= upDir * z;
 #endif
@@ -264,8 +401,12 @@ ClipSpaceAttribute TessellateClipSpaceTriangle(
 #ifdef FRAGMENT_SHADER
 vec4 ShadeFragment(vec2 texCoord)
 {
-#if FLAG_DISPLACE
-    vec2 smap = texture(u_SmapSampler, texCoord).rg * u_DmapFactor;
+#if FLAG_DISPLACE && FLAG_STREAM
+    float lod = TileLod(dFdx(texCoord), dFdy(texCoord));
+    vec2 smap = SampleSmapTiles(texCoord, lod) * u_SmapFactor * u_DmapFactor;
+    vec3 n = normalize(vec3(-smap, 1));
+#elif FLAG_DISPLACE
+    vec2 smap = texture(u_SmapSampler, texCoord).rg * u_SmapFactor * u_DmapFactor;
     vec3 n = normalize(vec3(-smap, 1));
 #else
     vec3 n = vec3(0, 0, 1);
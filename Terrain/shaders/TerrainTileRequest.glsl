@@ -0,0 +1,54 @@
+/* TerrainTileRequest.glsl - public domain
+by Jonathan Dupuy
+
+    This code has dependencies on the following GLSL sources:
+    - FrustumCulling.glsl
+    - LongestEdgeBisection.glsl
+    - TerrainRenderCommon.glsl
+*/
+
+// this shader records the heightmap tiles needed by the visible nodes,
+// i.e., for each tile, the distance to the closest node that samples it
+layout(std430, binding = BUFFER_BINDING_TILE_REQUESTS)
+buffer TileRequestBuffer {
+    uint u_TileRequests[];
+};
+
+#ifdef COMPUTE_SHADER
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+
+// the level whose texels are about half as large as the longest edge of a
+// node is the coarsest one that resolves the heights at its vertices
+int TileLevel(in const vec4[3] patchVertices)
+{
+    vec2 edge = patchVertices[2].xy - patchVertices[0].xy;
+    float texelCount = length(edge) * float(max(TILE_HEIGHTMAP_WIDTH, TILE_HEIGHTMAP_HEIGHT));
+
+    return clamp(int(floor(log2(texelCount))) - 1, 0, TILE_LEVEL_COUNT - 1);
+}
+
+void main()
+{
+    const int lebID = 0;
+    uint nodeCount = leb_NodeCount(lebID);
+    uint threadCount = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+
+    for (uint nodeID = gl_GlobalInvocationID.x; nodeID < nodeCount; nodeID+= threadCount) {
+        leb_Node node = leb_DecodeNode(lebID, nodeID);
+        vec4 triangleVertices[3] = DecodeTriangleVertices(node);
+
+        if (!FrustumCullingTest(triangleVertices))
+            continue;
+
+        vec4 center = (triangleVertices[0] + triangleVertices[1] + triangleVertices[2]) / 3.0;
+        float nodeDistance = length((u_ModelViewMatrix * center).xyz);
+        int level = TileLevel(triangleVertices);
+
+        for (int i = 0; i < 3; ++i) {
+            int tileID = TileIndex(triangleVertices[i].xy, level);
+
+            atomicMin(u_TileRequests[tileID], floatBitsToUint(nodeDistance));
+        }
+    }
+}
+#endif
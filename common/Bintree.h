@@ -0,0 +1,588 @@
+/* Bintree.h - public domain
+by Jonathan Dupuy
+
+    CPU subdivision refined around a target disk, or a set of target disks,
+    shared by the ApiDebug demo and the headless benchmark. The update
+    alternates between a split pass, which splits the leaves that intersect
+    the target, and a merge pass, which merges the diamonds that no longer do.
+    Other threads may read the tree while it is updated through the copies of
+    a lebcpu_PublishedHeap (see bintree::m_published).
+
+    This code has dependencies on the following sources:
+    - dj_algebra.h
+    - LongestEdgeBisection.h
+    - LongestEdgeBisectionCPU.h
+    - LongestEdgeBisectionSnapshot.h
+*/
+#ifndef BINTREE_INCLUDE_BINTREE_H
+#define BINTREE_INCLUDE_BINTREE_H
+
+#include "dj_algebra.h"
+#include "LongestEdgeBisection.h"
+#include "LongestEdgeBisectionCPU.h"
+#include "LongestEdgeBisectionSnapshot.h"
+
+inline float wedge(const dja::vec2& a, const dja::vec2& b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+struct triangle {
+    dja::vec2 v[3];
+    triangle(const dja::vec2& a, const dja::vec2& b, const dja::vec2& c) {
+        v[0].x = a.x; v[0].y = a.y;
+        v[1].x = b.x; v[1].y = b.y;
+        v[2].x = c.x; v[2].y = c.y;
+    }
+
+    bool contains(const dja::vec2 &p) const {
+        const float e = 0.0f;
+        float w1 = wedge(v[1] - v[0], p - v[0]);
+        float w2 = wedge(v[2] - v[1], p - v[1]);
+        float w3 = wedge(v[0] - v[2], p - v[2]);
+
+        return (w1 <= e && w2 <= e && w3 <= e) || (w1 >= -e && w2 >= -e && w3 >= -e);
+    }
+
+    // exact disk test
+    bool contains(const dja::vec2 &p, float r) const {
+        const float x[3] = {v[0].x, v[1].x, v[2].x};
+        const float y[3] = {v[0].y, v[1].y, v[2].y};
+
+        return lebcpu_DiskTriangleTest(p.x, p.y, r, x, y);
+    }
+};
+
+// subdivision refined around a target disk; the subdivision is stored either
+// in a leb_Heap (m_leb) or, for deep trees, in a lebcpu_SparseHeap (m_sparse)
+struct bintree {
+    leb_Heap *m_leb;
+    lebcpu_SparseHeap *m_sparse;
+    lebsnap_Snapshot *m_snapshot; // owns m_leb when loaded from a file
+    lebcpu_ThreadPool *m_pool;
+    lebcpu_DirtyMask *m_dirty;
+    lebcpu_VertexWelder *m_welder; // scratch memory of extractMesh
+    lebcpu_PointLocator *m_locator; // scratch memory of boundingNodes
+    lebcpu_HeapDelta *m_delta; // if set, collects the modified words of m_leb
+    // if set, receives a copy of m_leb after each change, for the threads that
+    // read the tree while it is updated (leb_Heap storage only)
+    lebcpu_PublishedHeap *m_published;
+    lebcpu_HeapDelta m_publishDelta; // words modified since the last publication
+    bool m_publishPending; // the last publication was deferred
+    lebcpu_Mode m_mode;
+    float m_radius;     // radius of the target disk
+    bool m_freeze;      // disables the split and merge passes
+    uint32_t m_reductionNodeCount;
+    uint32_t m_splitCount, m_mergeCount; // nodes split (merged) by updateOnce
+    uint32_t m_version; // incremented whenever the leaves change
+    int m_idlePassCount; // consecutive passes that left the tree unchanged
+    int m_pingPong;
+    // target of the last update, to detect that the inputs changed
+    dja::vec2 m_lastTarget;
+    float m_lastRadius;
+    std::vector<lebcpu_Disk> m_lastDisks;
+
+    bintree(lebcpu_Mode mode, int minDepth, int maxDepth, int threadCount,
+            bool sparse = false) {
+        m_leb = NULL;
+        m_sparse = NULL;
+        m_snapshot = NULL;
+        m_dirty = NULL;
+        m_welder = NULL;
+        m_locator = NULL;
+        m_delta = NULL;
+        m_published = NULL;
+        m_publishPending = false;
+        m_pool = lebcpu_CreateThreadPool(threadCount);
+        m_mode = mode;
+        m_radius = 0.0f;
+        m_freeze = false;
+        m_reductionNodeCount = 0u;
+        m_splitCount = m_mergeCount = 0u;
+        m_version = 0u;
+        m_idlePassCount = 0;
+        m_pingPong = 0;
+        m_lastRadius = -1.0f;
+        createHeap(minDepth, maxDepth, sparse);
+    }
+
+    ~bintree() {
+        releaseHeap();
+        if (m_welder)
+            lebcpu_ReleaseVertexWelder(m_welder);
+        if (m_locator)
+            lebcpu_ReleasePointLocator(m_locator);
+        lebcpu_ReleaseThreadPool(m_pool);
+    }
+
+    bintree(const bintree &) = delete;
+    bintree &operator=(const bintree &) = delete;
+
+    void setThreadCount(int threadCount) {
+        lebcpu_ReleaseThreadPool(m_pool);
+        m_pool = lebcpu_CreateThreadPool(threadCount);
+    }
+
+    // collects the words modified by the writes to m_leb; they reach m_delta
+    // through publish() when the tree is published
+    lebcpu_HeapDelta *writeDelta() {
+        return m_published ? &m_publishDelta : m_delta;
+    }
+
+    void fillDelta() {
+        lebcpu_HeapDelta *delta = writeDelta();
+
+        if (delta && m_leb)
+            lebcpu_FillHeapDelta(delta, m_leb);
+    }
+
+    // copies the tree to m_published; if readers still hold the copy to
+    // overwrite, the next update retries
+    void publish() {
+        if (!m_published || !m_leb)
+            return;
+
+        if (m_delta) {
+            m_delta->ranges.insert(m_delta->ranges.end(),
+                                   m_publishDelta.ranges.begin(),
+                                   m_publishDelta.ranges.end());
+        }
+        m_publishPending = !lebcpu_PublishHeap(m_published, m_leb,
+                                               &m_publishDelta, m_pool);
+        lebcpu_ClearHeapDelta(&m_publishDelta);
+    }
+
+    void createHeap(int minDepth, int maxDepth, bool sparse) {
+        if (sparse) {
+            m_sparse = lebcpu_CreateSparseHeap(minDepth, maxDepth);
+        } else {
+            m_leb = leb_CreateMinMax(minDepth, maxDepth);
+            m_dirty = lebcpu_CreateDirtyMask(m_leb);
+            leb_ResetToRoot(m_leb);
+            fillDelta();
+        }
+    }
+
+    void releaseHeap() {
+        if (m_sparse) {
+            lebcpu_ReleaseSparseHeap(m_sparse);
+            m_sparse = NULL;
+        } else {
+            lebcpu_ReleaseDirtyMask(m_dirty);
+            if (m_snapshot)
+                lebsnap_Release(m_snapshot);
+            else
+                leb_Release(m_leb);
+            m_snapshot = NULL;
+            m_dirty = NULL;
+            m_leb = NULL;
+        }
+    }
+
+    void reset(lebcpu_Mode mode, int minDepth, int maxDepth) {
+        bool sparse = m_sparse != NULL;
+
+        m_mode = mode;
+        releaseHeap();
+        createHeap(minDepth, maxDepth, sparse);
+        m_idlePassCount = 0;
+        ++m_version;
+        publish();
+    }
+
+    lebsnap_Mode snapshotMode() const {
+        return m_mode == LEBCPU_MODE_TRIANGLE ? LEBSNAP_MODE_TRIANGLE
+                                              : LEBSNAP_MODE_QUAD;
+    }
+
+    // adopts the heap of a snapshot file of the current mode in place of the
+    // current one; the depths of the tree are those of the snapshot
+    bool loadSnapshot(const char *pathToFile) {
+        lebsnap_Snapshot *snapshot = lebsnap_Load(pathToFile, snapshotMode());
+
+        if (!snapshot)
+            return false;
+
+        releaseHeap();
+        m_snapshot = snapshot;
+        m_leb = &snapshot->heap;
+        m_dirty = lebcpu_CreateDirtyMask(m_leb);
+        fillDelta();
+        m_idlePassCount = 0;
+        m_pingPong = 0;
+        ++m_version;
+        publish();
+
+        return true;
+    }
+
+    bool saveSnapshot(const char *pathToFile) const {
+        return m_leb && lebsnap_Save(pathToFile, m_leb, snapshotMode());
+    }
+
+    // the serial update is only available for leb_Heap storage
+    template <typename Target>
+    void build(const Target &target, int maxLevel, bool serial = false) {
+        if (m_sparse) {
+            lebcpu_ResetSparseHeapToRoot(m_sparse);
+        } else {
+            leb_ResetToRoot(m_leb);
+            lebcpu_ClearDirtyMask(m_dirty);
+            fillDelta();
+        }
+        ++m_version;
+        m_idlePassCount = 0;
+        m_pingPong = 0;
+
+        for (int i = 0; i < maxLevel; ++i) {
+            if (serial && !m_sparse)
+                updateOnceSerial(target);
+            else
+                updateOnce(target);
+        }
+    }
+
+    // builds the subdivision the updates converge to for a target, in a single
+    // top-down descent
+    template <typename Target>
+    void buildTopDown(const Target &target) {
+        const float attribArray[][3] = {
+            {0.0f, 0.0f, 1.0f},
+            {1.0f, 0.0f, 0.0f}
+        };
+        auto shouldSplit = [&](const leb_Node *nodes, int nodeCount,
+                               const lebcpu_TriangleBatch *batch) {
+            return testTargetBatch(nodes, nodeCount, batch, target);
+        };
+
+        if (m_sparse) {
+            lebcpu_BuildBatch(m_sparse, m_mode, attribArray, shouldSplit, m_pool);
+        } else {
+            lebcpu_BuildBatch(m_leb, m_mode, attribArray, shouldSplit, m_pool);
+            lebcpu_ClearDirtyMask(m_dirty);
+            fillDelta();
+        }
+        ++m_version;
+        m_idlePassCount = 0;
+        m_pingPong = 0;
+        publish();
+    }
+
+    // the Mode parameters are either lebcpu_TriangleMode or lebcpu_QuadMode,
+    // and must match m_mode
+    template <typename Mode>
+    bool testTarget(const leb_Node &node, const dja::vec2 &target) const
+    {
+        float attribArray[][3] = {
+            {0.0f, 0.0f, 1.0f},
+            {1.0f, 0.0f, 0.0f}
+        };
+
+        Mode::DecodeNodeAttributeArray(node, 2, attribArray);
+
+        dja::vec2 a = dja::vec2(attribArray[0][0], attribArray[1][0]),
+                  b = dja::vec2(attribArray[0][1], attribArray[1][1]),
+                  c = dja::vec2(attribArray[0][2], attribArray[1][2]);
+
+        return triangle(a, b, c).contains(target, m_radius);
+    }
+
+    template <typename Mode>
+    bool testTarget(const leb_Node &node, const lebcpu_DiskGrid &targets) const
+    {
+        float attribArray[][3] = {
+            {0.0f, 0.0f, 1.0f},
+            {1.0f, 0.0f, 0.0f}
+        };
+
+        Mode::DecodeNodeAttributeArray(node, 2, attribArray);
+
+        return lebcpu_DiskGridTest(&targets, attribArray[0], attribArray[1],
+                                   node.depth);
+    }
+
+    // returns the bitmask of the nodes that intersect the target
+    template <typename Mode> uint32_t
+    testTargetBatch(const leb_Node *nodes, int nodeCount, const dja::vec2 &target) const
+    {
+        const float attribArray[][3] = {
+            {0.0f, 0.0f, 1.0f},
+            {1.0f, 0.0f, 0.0f}
+        };
+        lebcpu_TriangleBatch batch;
+
+        lebcpu_DecodeTriangleBatch<Mode>(nodes, nodeCount, attribArray, &batch);
+
+        return testTargetBatch(nodes, nodeCount, &batch, target);
+    }
+
+    // same as above, for nodes whose vertices are already decoded
+    uint32_t
+    testTargetBatch(const leb_Node *, int,
+                    const lebcpu_TriangleBatch *batch,
+                    const dja::vec2 &target) const
+    {
+        return lebcpu_DiskTriangleTestBatch(target.x, target.y, m_radius, batch);
+    }
+
+    uint32_t
+    testTargetBatch(const leb_Node *nodes, int nodeCount,
+                    const lebcpu_TriangleBatch *batch,
+                    const lebcpu_DiskGrid &targets) const
+    {
+        return lebcpu_DiskGridTestBatch(&targets, nodes, nodeCount, batch);
+    }
+
+    template <typename Mode> uint32_t
+    testTargetBatch(const leb_Node *nodes, int nodeCount,
+                    const lebcpu_DiskGrid &targets) const
+    {
+        const float attribArray[][3] = {
+            {0.0f, 0.0f, 1.0f},
+            {1.0f, 0.0f, 0.0f}
+        };
+        lebcpu_TriangleBatch batch;
+
+        lebcpu_DecodeTriangleBatch<Mode>(nodes, nodeCount, attribArray, &batch);
+
+        return testTargetBatch(nodes, nodeCount, &batch, targets);
+    }
+
+    // the target is either a single disk centered at a dja::vec2 of radius
+    // m_radius, or a set of disks stored in a lebcpu_DiskGrid
+    template <typename Mode, typename Heap, typename Target>
+    uint32_t updatePasses(Heap *heap, const Target &target)
+    {
+        if /* splitting pass */(m_pingPong == 0 && !m_freeze) {
+            return lebcpu_SplitPassBatch<Mode>(heap,
+                                  [&](const leb_Node *nodes, int nodeCount) {
+                return testTargetBatch<Mode>(nodes, nodeCount, target);
+            }, m_pool, m_dirty);
+        } else if /* merging pass */(m_pingPong == 1 && !m_freeze) {
+            return lebcpu_MergePassBatch<Mode>(heap,
+                                  [&](const leb_DiamondParent *diamonds, int nodeCount) {
+                leb_Node base[LEBCPU_BATCH_SIZE] = {}, top[LEBCPU_BATCH_SIZE] = {};
+
+                for (int i = 0; i < nodeCount; ++i) {
+                    base[i] = diamonds[i].base;
+                    top[i] = diamonds[i].top;
+                }
+
+                return ~(testTargetBatch<Mode>(base, nodeCount, target)
+                       | testTargetBatch<Mode>(top, nodeCount, target));
+            }, m_pool, m_dirty);
+        }
+
+        return 0u;
+    }
+
+    // instantiates the passes once per mode
+    template <typename Heap, typename Target>
+    uint32_t updatePasses(Heap *heap, const Target &target)
+    {
+        if (m_mode == LEBCPU_MODE_TRIANGLE)
+            return updatePasses<lebcpu_TriangleMode>(heap, target);
+        else
+            return updatePasses<lebcpu_QuadMode>(heap, target);
+    }
+
+    // records the target of an update; returns true if it differs from the
+    // previous one
+    bool retarget(const dja::vec2 &target) {
+        bool changed = !m_lastDisks.empty() || m_lastRadius != m_radius
+                    || m_lastTarget.x != target.x || m_lastTarget.y != target.y;
+
+        m_lastTarget = target;
+        m_lastRadius = m_radius;
+        m_lastDisks.clear();
+
+        return changed;
+    }
+
+    bool retarget(const lebcpu_DiskGrid &targets) {
+        const std::vector<lebcpu_Disk> &disks = targets.disks;
+        bool changed = m_lastRadius >= 0.0f || disks.size() != m_lastDisks.size();
+
+        for (size_t i = 0; i < disks.size() && !changed; ++i) {
+            changed = disks[i].x != m_lastDisks[i].x
+                   || disks[i].y != m_lastDisks[i].y
+                   || disks[i].radius != m_lastDisks[i].radius
+                   || disks[i].maxDepth != m_lastDisks[i].maxDepth;
+        }
+
+        m_lastRadius = -1.0f;
+        m_lastDisks = disks;
+
+        return changed;
+    }
+
+    // the tree is stable once a split pass and a merge pass in a row left it
+    // unchanged for the same target
+    bool converged() const {
+        return m_idlePassCount >= 2;
+    }
+
+    // multithreaded update; produces the same tree as updateOnceSerial, and
+    // does nothing once the tree has converged for the target
+    template <typename Target>
+    void updateOnce(const Target &target)
+    {
+        uint32_t changeCount;
+
+        if (retarget(target) || m_freeze)
+            m_idlePassCount = 0;
+
+        m_splitCount = m_mergeCount = 0u;
+        // the skipped pass would not change the tree either
+        if (converged()) {
+            if (m_publishPending)
+                publish();
+            m_reductionNodeCount = 0u;
+            m_pingPong = 1 - m_pingPong;
+            return;
+        }
+
+        if (m_sparse) {
+            changeCount = updatePasses(m_sparse, target);
+            // number of modified pages rather than reduction nodes
+            m_reductionNodeCount = lebcpu_ComputeSumReduction(m_sparse);
+        } else {
+            changeCount = updatePasses(m_leb, target);
+            m_reductionNodeCount = lebcpu_UpdateSumReduction(m_leb, m_dirty,
+                                                             m_pool, writeDelta());
+        }
+
+        if (m_pingPong == 0)
+            m_splitCount = changeCount;
+        else
+            m_mergeCount = changeCount;
+
+        if (m_reductionNodeCount > 0u)
+            ++m_version;
+        if (m_reductionNodeCount > 0u || m_publishPending)
+            publish();
+
+        if (changeCount == 0u && !m_freeze)
+            ++m_idlePassCount;
+        else
+            m_idlePassCount = 0;
+
+        m_pingPong = 1 - m_pingPong;
+    }
+
+    // reference single-threaded update
+    template <typename Target>
+    void updateOnceSerial(const Target &target)
+    {
+        if (m_mode == LEBCPU_MODE_TRIANGLE)
+            updateOnceSerial<lebcpu_TriangleMode>(target);
+        else
+            updateOnceSerial<lebcpu_QuadMode>(target);
+    }
+
+    template <typename Mode, typename Target>
+    void updateOnceSerial(const Target &target)
+    {
+        uint32_t cnt = leb_NodeCount(m_leb);
+
+        // update
+        for (uint32_t i = 0; i < cnt; ++i) {
+            leb_Node node = leb_DecodeNode(m_leb, i);
+
+            if /* splitting pass */(m_pingPong == 0 && !m_freeze) {
+                bool isInside = testTarget<Mode>(node, target);
+
+                /* split */
+                if (isInside)
+                    Mode::SplitNodeConforming(m_leb, node);
+            } else if /* merging pass */(m_pingPong == 1 && !m_freeze) {
+                leb_DiamondParent diamond = Mode::DecodeDiamondParent(node);
+                bool shouldMerge = !testTarget<Mode>(diamond.base, target)
+                                 && !testTarget<Mode>(diamond.top, target);
+
+                if (shouldMerge)
+                    Mode::MergeNodeConforming(m_leb, node, diamond);
+            }
+        }
+
+        leb_ComputeSumReduction(m_leb);
+        fillDelta();
+        m_idlePassCount = 0;
+        ++m_version;
+        publish();
+
+        m_pingPong = 1 - m_pingPong;
+    }
+
+
+    template <typename Heap>
+    void precomputeNodes(const Heap *heap, uint32_t *dataOut) const
+    {
+        lebcpu_ParallelFor(m_pool, lebcpu_NodeCount(heap), LEBCPU_GRAIN_SIZE,
+                           [&](uint32_t begin, uint32_t end) {
+            lebcpu_ForEachLeaf(heap, begin, end,
+                               [&](uint32_t handle, const leb_Node node) {
+                dataOut[handle] = node.id;
+            });
+        });
+    }
+
+    // writes the IDs of the leaves in order; dataOut must hold size() entries
+    void precomputeNodes(uint32_t *dataOut) const
+    {
+        if (m_sparse)
+            precomputeNodes(m_sparse, dataOut);
+        else
+            precomputeNodes(m_leb, dataOut);
+    }
+
+    // writes the leaves as an indexed mesh with shared vertices; verticesOut
+    // must hold size() + 2 vertices and indicesOut 3 * size() indices; returns
+    // the number of vertices
+    uint32_t extractMesh(float (*verticesOut)[2], uint32_t *indicesOut)
+    {
+        const float attribArray[][3] = {
+            {0.0f, 0.0f, 1.0f},
+            {1.0f, 0.0f, 0.0f}
+        };
+
+        if (!m_welder)
+            m_welder = lebcpu_CreateVertexWelder();
+
+        if (m_sparse)
+            return lebcpu_ExtractMesh(m_sparse, m_mode, attribArray, m_welder,
+                                      verticesOut, indicesOut, m_pool);
+        else
+            return lebcpu_ExtractMesh(m_leb, m_mode, attribArray, m_welder,
+                                      verticesOut, indicesOut, m_pool);
+    }
+
+    // writes the leaf containing each point (x[i], y[i]) to nodesOut[i]
+    void boundingNodes(const float *x, const float *y, uint32_t pointCount,
+                       leb_Node *nodesOut)
+    {
+        if (!m_locator)
+            m_locator = lebcpu_CreatePointLocator();
+
+        if (m_sparse)
+            lebcpu_BoundingNodeBatch(m_sparse, m_mode, x, y, pointCount,
+                                     m_locator, nodesOut, m_pool);
+        else
+            lebcpu_BoundingNodeBatch(m_leb, m_mode, x, y, pointCount,
+                                     m_locator, nodesOut, m_pool);
+    }
+
+    int size() const {
+        return (int)(m_sparse ? lebcpu_NodeCount(m_sparse)
+                              : leb_NodeCount(m_leb));
+    }
+
+    // memory used by the subdivision
+    size_t heapByteSize() const {
+        return m_sparse ? lebcpu_SparseHeapByteSize(m_sparse)
+                        : (size_t)leb__HeapByteSize(m_leb->maxDepth);
+    }
+
+};
+
+#endif // BINTREE_INCLUDE_BINTREE_H
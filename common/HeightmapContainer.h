@@ -0,0 +1,1878 @@
+/* HeightmapContainer.h - public domain
+by Jonathan Dupuy
+
+    Preprocessed heightmaps for the Terrain demo, stored with all the mip
+    levels of its textures so that they can be uploaded as is.
+
+    A container holds, for each mip level of a 16-bit heightmap, the texels
+    of the displacement texture, i.e., the height z and its square z^2 as
+    RG16 (used by the shaders to compute the variance of the height), and the
+    texels of the slope texture, i.e., the height derivatives as RG32F, RG16F
+    or RG16_SNORM. The levels are those glGenerateMipmap would have produced
+    from the first one: level l has size max(1, w >> l) x max(1, h >> l), and
+    its texels average the 2x2 texels above them.
+
+    RG16_SNORM slopes are divided by the slope scale of the container, i.e.,
+    the largest slope of the heightmap, which the shaders multiply back.
+
+        offset  size        content
+        0       4           magic "HMAP"
+        4       4           format version (HMAP_VERSION)
+        8       4           width of the first level
+        12      4           height of the first level
+        16      4           level count
+        20      4           slope format (hmap_SlopeFormat)
+        24      4           slope scale (32-bit float)
+        28      4           reserved (0)
+        32      24 * count  levels, i.e., width, height (32-bit each) and the
+                            file offsets of the dmap and smap texels (64-bit
+                            each)
+        ...                 texels, each array starting on a 64-byte boundary
+
+    Loading maps the file in memory, so that the texels can be passed to
+    glTexSubImage2D without any copy. Values are stored in the byte order of
+    the host.
+
+    Heightmaps too large to be loaded at once are stored in tiled containers
+    instead, which split each level into tiles of tileSize x tileSize texels,
+    down to the first level that fits in a single tile. Each tile is stored
+    with a border of one texel, i.e., as (tileSize + 2)^2 dmap texels followed
+    by as many smap texels, so that it can be filtered on its own.
+
+        offset  size        content
+        0       4           magic "HTIL"
+        4       4           format version (HMAP_VERSION)
+        8       4           width of the first level
+        12      4           height of the first level
+        16      4           tile size (a power of two)
+        20      4           level count
+        24      4           slope format (hmap_SlopeFormat)
+        28      4           slope scale (32-bit float)
+        64      ...         tiles, level by level and row by row, each
+                            starting on a 64-byte boundary
+
+    Tiles are read on demand by a tile streamer, which loads them on a
+    background thread into a fixed number of staging slots, and kept in a
+    tile cache of fixed capacity, which decides which tiles to stream and
+    which to evict, and maintains the tile table the shaders sample them
+    through.
+
+    Do this:
+        #define HMAP_IMPLEMENTATION
+    before you include this file in *one* C++ file to create the
+    implementation.
+*/
+#ifndef HMAP_INCLUDE_HMAP_H
+#define HMAP_INCLUDE_HMAP_H
+
+#ifdef HMAP_STATIC
+#   define HMAPDEF static
+#else
+#   define HMAPDEF extern
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define HMAP_VERSION 2
+
+typedef enum {
+    HMAP_SLOPE_RG32F,
+    HMAP_SLOPE_RG16F,
+    HMAP_SLOPE_RG16_SNORM
+} hmap_SlopeFormat;
+
+typedef struct {
+    int width, height;
+    const uint16_t *dmap; // (z, z^2) pairs in [0, 2^16 - 1]
+    const void *smap;     // (dz/du, dz/dv) pairs
+} hmap_Level;
+
+typedef struct {
+    int width, height;
+    int levelCount;
+    hmap_SlopeFormat slopeFormat;
+    float slopeScale;
+    hmap_Level *levels;
+    void *mapping;        // base address of the mapping
+    size_t mappingByteSize;
+} hmap_Heightmap;
+
+// number of mip levels of a texture of size width x height
+HMAPDEF int hmap_LevelCount(int width, int height);
+
+// size of a slope texel, in bytes
+HMAPDEF int hmap_SlopeByteSize(hmap_SlopeFormat format);
+
+// largest slope of a 16-bit heightmap, along either axis; slopes are scaled
+// by it in the RG16_SNORM format
+HMAPDEF float
+hmap_MaxSlope(
+    const uint16_t *heights,
+    int width,
+    int height,
+    int threadCount = 0
+);
+
+// computes the slopes of a 16-bit heightmap by central differences, and
+// stores them in the given format; scale is that of hmap_MaxSlope for the
+// RG16_SNORM format, and is ignored otherwise. The heightmap is processed in
+// bands of rows distributed over threadCount threads, or all the cores if 0
+HMAPDEF void
+hmap_ComputeSlopes(
+    const uint16_t *heights,
+    int width,
+    int height,
+    hmap_SlopeFormat format,
+    float scale,
+    void *slopesOut,
+    int threadCount = 0
+);
+
+// converts count (dz/du, dz/dv) pairs from RG32F to the given format
+HMAPDEF void
+hmap_EncodeSlopes(
+    const float *slopes,
+    size_t count,
+    hmap_SlopeFormat format,
+    float scale,
+    void *slopesOut
+);
+
+// computes the texels of the first level from the heights of a 16-bit
+// heightmap; dmapOut holds 2 * width * height values, and so does smapOut
+HMAPDEF void
+hmap_ComputeLevel(
+    const uint16_t *heights,
+    int width,
+    int height,
+    uint16_t *dmapOut,
+    float *smapOut,
+    int threadCount = 0
+);
+
+// computes the texels of a level from those of the level above it
+HMAPDEF void
+hmap_ComputeNextLevel(
+    const uint16_t *dmap,
+    const float *smap,
+    int width,
+    int height,
+    uint16_t *dmapOut,
+    float *smapOut
+);
+
+// number of levels of the min/max pyramid of a heightmap of size width x height
+HMAPDEF int hmap_HeightBoundsLevelCount(int width, int height);
+
+// computes the first level of the min/max pyramid of a heightmap from the dmap
+// texels of its first level. Level l of the pyramid holds
+// max(1, width >> (l + 1)) x max(1, height >> (l + 1)) (min, max) pairs, each
+// of which bounds the heights of the 2^(l + 1) x 2^(l + 1) texels it covers;
+// the pairs of the last row (resp. column) also cover the row (resp. column)
+// left over by odd sizes
+HMAPDEF void
+hmap_ComputeHeightBounds(
+    const uint16_t *dmap,
+    int width,
+    int height,
+    uint16_t *boundsOut,
+    int threadCount = 0
+);
+
+// computes a level of the min/max pyramid from the level above it, whose size
+// is width x height
+HMAPDEF void
+hmap_ComputeNextHeightBounds(
+    const uint16_t *bounds,
+    int width,
+    int height,
+    uint16_t *boundsOut
+);
+
+// writes the container of a 16-bit heightmap; returns false on failure
+HMAPDEF bool
+hmap_Save(
+    const char *pathToFile,
+    const uint16_t *heights,
+    int width,
+    int height,
+    hmap_SlopeFormat slopeFormat = HMAP_SLOPE_RG16F,
+    int threadCount = 0
+);
+
+// maps a container file; returns NULL if the file is missing or invalid
+HMAPDEF hmap_Heightmap *hmap_Load(const char *pathToFile);
+HMAPDEF void hmap_Release(hmap_Heightmap *heightmap);
+
+// path of the container of an image, whose extension is replaced by the one
+// of the container, i.e., ".hmap" or ".htiles"
+HMAPDEF std::string
+hmap_ContainerPath(const std::string &pathToImage, const char *extension);
+
+// -----------------------------------------------------------------------------
+// Tiled Containers
+
+typedef struct {
+    int width, height;    // size of the first level
+    int tileSize;         // size of a tile, without its borders
+    int levelCount;       // the last level holds a single tile
+    int tileCount;        // over all levels
+    hmap_SlopeFormat slopeFormat;
+    float slopeScale;
+    size_t tileByteSize;  // dmap texels of a tile followed by its smap texels
+    void *file;
+} hmap_TiledHeightmap;
+
+// number of tiled levels of a heightmap of size width x height
+HMAPDEF int hmap_TiledLevelCount(int width, int height, int tileSize);
+
+// number of tiles along each axis of a level, and index of a tile
+HMAPDEF void
+hmap_TileGridSize(
+    const hmap_TiledHeightmap *heightmap,
+    int level,
+    int *xOut,
+    int *yOut
+);
+HMAPDEF int
+hmap_TileIndex(const hmap_TiledHeightmap *heightmap, int level, int x, int y);
+
+// writes the tiled container of a 16-bit heightmap; returns false on failure
+HMAPDEF bool
+hmap_SaveTiled(
+    const char *pathToFile,
+    const uint16_t *heights,
+    int width,
+    int height,
+    int tileSize,
+    hmap_SlopeFormat slopeFormat = HMAP_SLOPE_RG16F,
+    int threadCount = 0
+);
+
+// opens a tiled container and reads its header; the texels are left on disk
+HMAPDEF hmap_TiledHeightmap *hmap_LoadTiled(const char *pathToFile);
+HMAPDEF void hmap_ReleaseTiled(hmap_TiledHeightmap *heightmap);
+
+// reads the texels of a tile into tileOut, which holds tileByteSize bytes;
+// the file is not shared between threads, so this must not be called while
+// a tile streamer reads from the same heightmap
+HMAPDEF bool
+hmap_ReadTile(
+    const hmap_TiledHeightmap *heightmap,
+    int tileIndex,
+    void *tileOut
+);
+
+// -----------------------------------------------------------------------------
+// Tile Streaming
+
+typedef struct hmap_TileStreamer hmap_TileStreamer;
+typedef struct {
+    int tileIndex;
+    const uint16_t *dmap; // (tileSize + 2)^2 (z, z^2) pairs
+    const void *smap;     // (tileSize + 2)^2 slopes
+    int slot;
+} hmap_StreamedTile;
+
+// starts a thread that reads tiles into slotCount staging slots
+HMAPDEF hmap_TileStreamer *
+hmap_CreateTileStreamer(const hmap_TiledHeightmap *heightmap, int slotCount);
+HMAPDEF void hmap_ReleaseTileStreamer(hmap_TileStreamer *streamer);
+
+// replaces the tiles waiting to be read, given by decreasing priority
+HMAPDEF void
+hmap_StreamTiles(hmap_TileStreamer *streamer, const int *tileIndices, int count);
+
+// retrieves a tile that has been read; its slot is reused once recycled
+HMAPDEF bool hmap_PopStreamedTile(hmap_TileStreamer *streamer, hmap_StreamedTile *tile);
+HMAPDEF void hmap_RecycleStreamedTile(hmap_TileStreamer *streamer, const hmap_StreamedTile *tile);
+
+// -----------------------------------------------------------------------------
+// Tile Cache
+//
+// The cache holds layerCount tiles; the tile of the last level is always
+// resident, so that every tile table entry is valid once it was inserted.
+
+typedef struct hmap_TileCache hmap_TileCache;
+
+#define HMAP_NO_REQUEST 0xFFFFFFFFu
+
+HMAPDEF hmap_TileCache *
+hmap_CreateTileCache(const hmap_TiledHeightmap *heightmap, int layerCount);
+HMAPDEF void hmap_ReleaseTileCache(hmap_TileCache *cache);
+
+// takes the tiles requested for the current frame, i.e., for each tile, the
+// bits of the (non-negative) distance to the closest node that needs it, or
+// HMAP_NO_REQUEST; requested tiles, and their coarser ancestors, that are not
+// resident are streamed coarsest first and closest first. Returns the number
+// of tiles sent to the streamer
+HMAPDEF int
+hmap_RequestTiles(
+    hmap_TileCache *cache,
+    hmap_TileStreamer *streamer,
+    const uint32_t *requests
+);
+
+// allocates the layer of a streamed tile, evicting the least recently
+// requested tile if needed; returns -1 if all the tiles are in use
+HMAPDEF int hmap_InsertTile(hmap_TileCache *cache, int tileIndex);
+HMAPDEF int hmap_ResidentTileCount(const hmap_TileCache *cache);
+
+// entries of the tile table, i.e., for each tile, the layer of the finest
+// resident tile that covers it and its level, as (level << 16) | layer;
+// returns NULL if the table did not change since the last call
+HMAPDEF const uint32_t *hmap_UpdateTileTable(hmap_TileCache *cache);
+
+#endif // HMAP_INCLUDE_HMAP_H
+
+
+/*******************************************************************************
+ * Implementation
+ *
+ */
+#if defined(HMAP_IMPLEMENTATION) && !defined(HMAP__IMPLEMENTATION_INCLUDED)
+#define HMAP__IMPLEMENTATION_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define HMAP__SSE2
+#   if defined(__F16C__)
+#       include <immintrin.h>
+#       define HMAP__F16C
+#   endif
+#endif
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#   define HMAP__FSEEK64 _fseeki64
+#else
+#   define HMAP__FSEEK64 fseeko
+#endif
+
+#ifndef HMAP_LOG
+#   define HMAP_LOG(format, ...) do { fprintf(stderr, format, ##__VA_ARGS__); fflush(stderr); } while(0)
+#endif
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t levelCount;
+    uint32_t slopeFormat;
+    float slopeScale;
+    uint32_t reserved;
+} hmap__Header;
+
+typedef struct {
+    uint32_t width, height;
+    uint64_t dmapOffset, smapOffset;
+} hmap__LevelHeader;
+
+static const char hmap__Magic[4] = {'H', 'M', 'A', 'P'};
+
+#define HMAP__ALIGNMENT 64u
+
+
+/*******************************************************************************
+ * Texels -- Computes the texels of each level
+ *
+ */
+HMAPDEF int hmap_LevelCount(int width, int height)
+{
+    int levelCount = 1;
+
+    while ((std::max(width, height) >> levelCount) > 0)
+        ++levelCount;
+
+    return levelCount;
+}
+
+// rows of the bands of BAND_SIZE rows are processed in tiles of TILE_SIZE
+// texels, whose slopes are staged in RG32F before they are stored
+#define HMAP__BAND_SIZE 16
+#define HMAP__TILE_SIZE 512
+
+// runs kernel(begin, end) over bands of rows of [0, rowCount)
+static void
+hmap__ParallelRows(
+    int rowCount,
+    int threadCount,
+    const std::function<void(int, int)> &kernel
+) {
+    const int bandCount = (rowCount + HMAP__BAND_SIZE - 1) / HMAP__BAND_SIZE;
+    std::atomic<int> next(0);
+    std::vector<std::thread> threads;
+    auto worker = [&]() {
+        for (int bandID = next++; bandID < bandCount; bandID = next++) {
+            kernel(bandID * HMAP__BAND_SIZE,
+                   std::min(rowCount, (bandID + 1) * HMAP__BAND_SIZE));
+        }
+    };
+
+    if (threadCount <= 0)
+        threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, bandCount);
+
+    for (int i = 1; i < threadCount; ++i)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+}
+
+HMAPDEF int hmap_SlopeByteSize(hmap_SlopeFormat format)
+{
+    return format == HMAP_SLOPE_RG32F ? 2 * (int)sizeof(float)
+                                      : 2 * (int)sizeof(uint16_t);
+}
+
+// float to half conversion with rounding to nearest even
+static uint16_t hmap__FloatToHalf(float x)
+{
+    uint32_t bits, sign, exponent, mantissa;
+
+    memcpy(&bits, &x, sizeof(bits));
+    sign = (bits >> 16) & 0x8000u;
+    exponent = (bits >> 23) & 0xFFu;
+    mantissa = bits & 0x7FFFFFu;
+
+    if (exponent == 0xFFu) // inf or NaN
+        return (uint16_t)(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+    if (exponent > 142u) // overflows
+        return (uint16_t)(sign | 0x7C00u);
+    if (exponent < 113u) { // subnormal or zero
+        if (exponent < 102u)
+            return (uint16_t)sign;
+
+        uint32_t shift = 126u - exponent;
+        uint32_t m = mantissa | 0x800000u;
+        uint32_t half = m >> shift;
+        uint32_t rest = m & ((1u << shift) - 1u);
+        uint32_t midpoint = 1u << (shift - 1u);
+
+        if (rest > midpoint || (rest == midpoint && (half & 1u)))
+            ++half;
+
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((exponent - 112u) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1FFFu;
+
+    // a carry into the exponent yields the next power of two, or inf
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+        ++half;
+
+    return (uint16_t)(sign | half);
+}
+
+#if defined(HMAP__SSE2) && !defined(HMAP__F16C)
+// same as hmap__FloatToHalf, four values at a time; the halves are returned in
+// the low 16 bits of each lane, sign extended
+static __m128i hmap__FloatToHalf4(__m128 x)
+{
+    const __m128i infinity = _mm_set1_epi32(0x7C00);
+    const __m128i nanBit = _mm_set1_epi32(0x200);
+    const __m128i maxExponent = _mm_set1_epi32((127 + 16) << 23);
+    const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+    const __m128i subnormalMagic = _mm_set1_epi32(126 << 23); // 0.5f
+    const __m128i normalBias = _mm_set1_epi32(0xFFF - ((127 - 15) << 23));
+    __m128 sign = _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u)));
+    __m128 absx = _mm_xor_ps(x, sign);
+    __m128i bits = _mm_castps_si128(absx);
+    __m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absx, absx));
+    __m128i isFinite = _mm_cmpgt_epi32(maxExponent, bits);
+    __m128i isSubnormal = _mm_cmpgt_epi32(minNormal, bits);
+    __m128i special = _mm_or_si128(infinity, _mm_and_si128(isNaN, nanBit));
+
+    // subnormals: the addition rounds the mantissa to the nearest even
+    __m128i subnormal = _mm_sub_epi32(
+        _mm_castps_si128(_mm_add_ps(absx, _mm_castsi128_ps(subnormalMagic))),
+        subnormalMagic);
+
+    // normals: rounds up from halfway if the mantissa of the half is odd
+    __m128i isOdd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+    __m128i normal = _mm_srli_epi32(
+        _mm_sub_epi32(_mm_add_epi32(bits, normalBias), isOdd), 13);
+
+    __m128i finite = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal),
+                                  _mm_andnot_si128(isSubnormal, normal));
+    __m128i half = _mm_or_si128(_mm_and_si128(isFinite, finite),
+                                _mm_andnot_si128(isFinite, special));
+
+    return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+#endif
+
+// rounds to the nearest even integer, as _mm_cvtps_epi32 does
+static int16_t hmap__FloatToSnorm(float x, float rcpScale)
+{
+    float v = std::min(std::max(x * rcpScale, -1.0f), 1.0f) * 32767.0f;
+
+    return (int16_t)lrintf(v);
+}
+
+HMAPDEF void
+hmap_EncodeSlopes(
+    const float *slopes,
+    size_t count,
+    hmap_SlopeFormat format,
+    float scale,
+    void *slopesOut
+) {
+    if (format == HMAP_SLOPE_RG32F) {
+        memmove(slopesOut, slopes, 2 * count * sizeof(float));
+    } else if (format == HMAP_SLOPE_RG16F) {
+        uint16_t *out = (uint16_t *)slopesOut;
+        size_t i = 0;
+
+#if defined(HMAP__F16C)
+        for (; i + 4 <= 2 * count; i+= 4) {
+            __m128i h = _mm_cvtps_ph(_mm_loadu_ps(&slopes[i]), _MM_FROUND_TO_NEAREST_INT);
+
+            _mm_storel_epi64((__m128i *)&out[i], h);
+        }
+#elif defined(HMAP__SSE2)
+        for (; i + 8 <= 2 * count; i+= 8) {
+            __m128i a = hmap__FloatToHalf4(_mm_loadu_ps(&slopes[i]));
+            __m128i b = hmap__FloatToHalf4(_mm_loadu_ps(&slopes[i + 4]));
+
+            _mm_storeu_si128((__m128i *)&out[i], _mm_packs_epi32(a, b));
+        }
+#endif
+        for (; i < 2 * count; ++i)
+            out[i] = hmap__FloatToHalf(slopes[i]);
+    } else {
+        int16_t *out = (int16_t *)slopesOut;
+        float rcpScale = scale > 0.0f ? 1.0f / scale : 0.0f;
+        size_t i = 0;
+
+#ifdef HMAP__SSE2
+        const __m128 one = _mm_set1_ps(1.0f), minusOne = _mm_set1_ps(-1.0f);
+        const __m128 factor = _mm_set1_ps(32767.0f);
+
+        for (; i + 8 <= 2 * count; i+= 8) {
+            __m128 a = _mm_mul_ps(_mm_loadu_ps(&slopes[i]), _mm_set1_ps(rcpScale));
+            __m128 b = _mm_mul_ps(_mm_loadu_ps(&slopes[i + 4]), _mm_set1_ps(rcpScale));
+
+            a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(a, minusOne), one), factor);
+            b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(b, minusOne), one), factor);
+            _mm_storeu_si128((__m128i *)&out[i],
+                             _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+        }
+#endif
+        for (; i < 2 * count; ++i)
+            out[i] = hmap__FloatToSnorm(slopes[i], rcpScale);
+    }
+}
+
+// computes the RG32F slopes of texels [begin, end) of a row; the first and
+// last texels of a row, which need clamping, are left to the caller. The
+// differences of heights are exact integers, which kx and ky scale to slopes
+// (at -O3, compilers vectorize the scalar loop about as well as the SSE2 one)
+static void
+hmap__SlopeTile(
+    const uint16_t *row,
+    const uint16_t *rowBelow,
+    const uint16_t *rowAbove,
+    int begin,
+    int end,
+    float kx,
+    float ky,
+    float *slopesOut
+) {
+    int i = begin;
+
+#ifdef HMAP__SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 kx4 = _mm_set1_ps(kx), ky4 = _mm_set1_ps(ky);
+
+    // same operations as the scalar loop, eight texels at a time
+    for (; i + 8 <= end; i+= 8) {
+        __m128i l = _mm_loadu_si128((const __m128i *)&row[i - 1]);
+        __m128i r = _mm_loadu_si128((const __m128i *)&row[i + 1]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&rowBelow[i]);
+        __m128i t = _mm_loadu_si128((const __m128i *)&rowAbove[i]);
+        __m128i dx[2] = {
+            _mm_sub_epi32(_mm_unpacklo_epi16(r, zero), _mm_unpacklo_epi16(l, zero)),
+            _mm_sub_epi32(_mm_unpackhi_epi16(r, zero), _mm_unpackhi_epi16(l, zero))
+        };
+        __m128i dy[2] = {
+            _mm_sub_epi32(_mm_unpacklo_epi16(t, zero), _mm_unpacklo_epi16(b, zero)),
+            _mm_sub_epi32(_mm_unpackhi_epi16(t, zero), _mm_unpackhi_epi16(b, zero))
+        };
+
+        for (int k = 0; k < 2; ++k) {
+            __m128 sx = _mm_mul_ps(kx4, _mm_cvtepi32_ps(dx[k]));
+            __m128 sy = _mm_mul_ps(ky4, _mm_cvtepi32_ps(dy[k]));
+            float *out = &slopesOut[2 * (i - begin) + 8 * k];
+
+            _mm_storeu_ps(&out[0], _mm_unpacklo_ps(sx, sy));
+            _mm_storeu_ps(&out[4], _mm_unpackhi_ps(sx, sy));
+        }
+    }
+#endif
+    for (; i < end; ++i) {
+        int dx = (int)row[i + 1] - (int)row[i - 1];
+        int dy = (int)rowAbove[i] - (int)rowBelow[i];
+
+        slopesOut[2 * (i - begin)    ] = kx * (float)dx;
+        slopesOut[2 * (i - begin) + 1] = ky * (float)dy;
+    }
+}
+
+// same as hmap__SlopeTile, for a texel whose neighbors may be clamped
+static void
+hmap__SlopeTexel(
+    const uint16_t *row,
+    const uint16_t *rowBelow,
+    const uint16_t *rowAbove,
+    int i,
+    int width,
+    float kx,
+    float ky,
+    float *slopeOut
+) {
+    int dx = (int)row[std::min(width - 1, i + 1)] - (int)row[std::max(0, i - 1)];
+    int dy = (int)rowAbove[i] - (int)rowBelow[i];
+
+    slopeOut[0] = kx * (float)dx;
+    slopeOut[1] = ky * (float)dy;
+}
+
+// calls store(j, begin, end, slopes) for each tile of the slopes of rows
+// [rowBegin, rowEnd) of the heightmap, with begin and end the texels of row j
+// held in slopes (RG32F)
+template <typename Store> static void
+hmap__ForEachSlopeTile(
+    const uint16_t *heights,
+    int width,
+    int height,
+    int rowBegin,
+    int rowEnd,
+    int threadCount,
+    const Store &store
+) {
+    // the heights are in [0, 2^16 - 1]
+    const float kx = (float)width * 0.5f / 65535.0f;
+    const float ky = (float)height * 0.5f / 65535.0f;
+
+    hmap__ParallelRows(rowEnd - rowBegin, threadCount, [&](int bandBegin, int bandEnd) {
+        float slopes[2 * HMAP__TILE_SIZE];
+
+        for (int j = rowBegin + bandBegin; j < rowBegin + bandEnd; ++j) {
+            const uint16_t *row = &heights[(size_t)width * j];
+            const uint16_t *rowBelow = &heights[(size_t)width * std::max(0, j - 1)];
+            const uint16_t *rowAbove = &heights[(size_t)width * std::min(height - 1, j + 1)];
+
+            for (int begin = 0; begin < width; begin+= HMAP__TILE_SIZE) {
+                int end = std::min(width, begin + HMAP__TILE_SIZE);
+                int innerBegin = std::max(begin, 1);
+                int innerEnd = std::min(end, width - 1);
+
+                if (innerBegin < innerEnd) {
+                    hmap__SlopeTile(row, rowBelow, rowAbove, innerBegin, innerEnd,
+                                    kx, ky, &slopes[2 * (innerBegin - begin)]);
+                }
+                if (begin == 0) {
+                    hmap__SlopeTexel(row, rowBelow, rowAbove, 0, width, kx, ky,
+                                     &slopes[0]);
+                }
+                if (end == width && width > 1) {
+                    hmap__SlopeTexel(row, rowBelow, rowAbove, width - 1, width,
+                                     kx, ky, &slopes[2 * (width - 1 - begin)]);
+                }
+
+                store(j, begin, end, slopes);
+            }
+        }
+    });
+}
+
+HMAPDEF float
+hmap_MaxSlope(
+    const uint16_t *heights,
+    int width,
+    int height,
+    int threadCount
+) {
+    std::atomic<uint32_t> maxBits(0u);
+
+    hmap__ForEachSlopeTile(heights, width, height, 0, height, threadCount,
+                           [&](int, int begin, int end, const float *slopes) {
+        float maxSlope = 0.0f;
+        uint32_t bits, current;
+
+        for (int i = 0; i < 2 * (end - begin); ++i)
+            maxSlope = std::max(maxSlope, std::abs(slopes[i]));
+
+        // positive floats compare as their bits
+        memcpy(&bits, &maxSlope, sizeof(bits));
+        current = maxBits.load();
+        while (bits > current && !maxBits.compare_exchange_weak(current, bits));
+    });
+
+    float maxSlope;
+    uint32_t bits = maxBits.load();
+
+    memcpy(&maxSlope, &bits, sizeof(maxSlope));
+
+    return maxSlope;
+}
+
+HMAPDEF void
+hmap_ComputeSlopes(
+    const uint16_t *heights,
+    int width,
+    int height,
+    hmap_SlopeFormat format,
+    float scale,
+    void *slopesOut,
+    int threadCount
+) {
+    const size_t texelByteSize = (size_t)hmap_SlopeByteSize(format);
+
+    hmap__ForEachSlopeTile(heights, width, height, 0, height, threadCount,
+                           [&](int j, int begin, int end, const float *slopes) {
+        size_t texelID = (size_t)width * j + begin;
+
+        hmap_EncodeSlopes(slopes, (size_t)(end - begin), format, scale,
+                          (char *)slopesOut + texelByteSize * texelID);
+    });
+}
+
+// computes the texels of rows [rowBegin, rowEnd) of the first level; the
+// texels of row rowBegin are the first ones written to dmapOut and smapOut
+static void
+hmap__ComputeLevelRows(
+    const uint16_t *heights,
+    int width,
+    int height,
+    int rowBegin,
+    int rowEnd,
+    uint16_t *dmapOut,
+    float *smapOut,
+    int threadCount
+) {
+    const size_t firstTexelID = (size_t)width * rowBegin;
+
+    hmap__ParallelRows(rowEnd - rowBegin, threadCount, [&](int bandBegin, int bandEnd) {
+        for (size_t i = (size_t)width * bandBegin; i < (size_t)width * bandEnd; ++i) {
+            uint16_t z = heights[firstTexelID + i]; // in [0,2^16-1]
+            float zf = float(z) / float((1 << 16) - 1);
+
+            dmapOut[2 * i    ] = z;
+            dmapOut[2 * i + 1] = (uint16_t)(zf * zf * ((1 << 16) - 1));
+        }
+    });
+    hmap__ForEachSlopeTile(heights, width, height, rowBegin, rowEnd, threadCount,
+                           [&](int j, int begin, int end, const float *slopes) {
+        size_t texelID = (size_t)width * (j - rowBegin) + begin;
+
+        memcpy(&smapOut[2 * texelID], slopes, 2 * (end - begin) * sizeof(float));
+    });
+}
+
+HMAPDEF void
+hmap_ComputeLevel(
+    const uint16_t *heights,
+    int width,
+    int height,
+    uint16_t *dmapOut,
+    float *smapOut,
+    int threadCount
+) {
+    hmap__ComputeLevelRows(heights, width, height, 0, height, dmapOut, smapOut,
+                           threadCount);
+}
+
+HMAPDEF void
+hmap_ComputeNextLevel(
+    const uint16_t *dmap,
+    const float *smap,
+    int width,
+    int height,
+    uint16_t *dmapOut,
+    float *smapOut
+) {
+    const int w = std::max(1, width >> 1), h = std::max(1, height >> 1);
+
+    for (int j = 0; j < h; ++j)
+    for (int i = 0; i < w; ++i) {
+        const int x[2] = {std::min(2 * i, width - 1), std::min(2 * i + 1, width - 1)};
+        const int y[2] = {std::min(2 * j, height - 1), std::min(2 * j + 1, height - 1)};
+
+        for (int c = 0; c < 2; ++c) {
+            uint32_t dsum = 2u; // rounds to nearest
+            float ssum = 0.0f;
+
+            for (int k = 0; k < 4; ++k) {
+                size_t texelID = x[k & 1] + (size_t)width * y[k >> 1];
+
+                dsum+= dmap[c + 2 * texelID];
+                ssum+= smap[c + 2 * texelID];
+            }
+
+            dmapOut[c + 2 * (i + (size_t)w * j)] = (uint16_t)(dsum >> 2);
+            smapOut[c + 2 * (i + (size_t)w * j)] = 0.25f * ssum;
+        }
+    }
+}
+
+
+/*******************************************************************************
+ * Height Bounds -- Computes the min/max pyramid of the heights
+ *
+ */
+HMAPDEF int hmap_HeightBoundsLevelCount(int width, int height)
+{
+    return hmap_LevelCount(std::max(1, width >> 1), std::max(1, height >> 1));
+}
+
+// bounds the texels of rows [2 * rowBegin, 2 * rowEnd) of a level; the
+// minimum is read from the first channel of the texels and the maximum from
+// channel maxChannelID
+static void
+hmap__ReduceHeightBounds(
+    const uint16_t *texels,
+    int maxChannelID,
+    int width,
+    int height,
+    int rowBegin,
+    int rowEnd,
+    uint16_t *boundsOut
+) {
+    const int w = std::max(1, width >> 1), h = std::max(1, height >> 1);
+
+    for (int j = rowBegin; j < rowEnd; ++j)
+    for (int i = 0; i < w; ++i) {
+        const int xMax = i + 1 < w ? 2 * i + 1 : width - 1;
+        const int yMax = j + 1 < h ? 2 * j + 1 : height - 1;
+        uint16_t zMin = 0xFFFF, zMax = 0;
+
+        for (int y = 2 * j; y <= yMax; ++y)
+        for (int x = 2 * i; x <= xMax; ++x) {
+            const uint16_t *texel = &texels[2 * (x + (size_t)width * y)];
+
+            zMin = std::min(zMin, texel[0]);
+            zMax = std::max(zMax, texel[maxChannelID]);
+        }
+
+        boundsOut[2 * (i + (size_t)w * j)    ] = zMin;
+        boundsOut[2 * (i + (size_t)w * j) + 1] = zMax;
+    }
+}
+
+HMAPDEF void
+hmap_ComputeHeightBounds(
+    const uint16_t *dmap,
+    int width,
+    int height,
+    uint16_t *boundsOut,
+    int threadCount
+) {
+    hmap__ParallelRows(std::max(1, height >> 1), threadCount,
+                       [&](int rowBegin, int rowEnd) {
+        hmap__ReduceHeightBounds(dmap, 0, width, height, rowBegin, rowEnd,
+                                 boundsOut);
+    });
+}
+
+HMAPDEF void
+hmap_ComputeNextHeightBounds(
+    const uint16_t *bounds,
+    int width,
+    int height,
+    uint16_t *boundsOut
+) {
+    hmap__ReduceHeightBounds(bounds, 1, width, height, 0,
+                             std::max(1, height >> 1), boundsOut);
+}
+
+
+/*******************************************************************************
+ * Save -- Writes the header, the level table, and the texels level by level
+ *
+ */
+static uint64_t hmap__Align(uint64_t offset)
+{
+    return (offset + HMAP__ALIGNMENT - 1u) & ~(uint64_t)(HMAP__ALIGNMENT - 1u);
+}
+
+// pads the file up to offset and writes the data there; position tracks the
+// end of the file, as the arrays are written in order
+static bool
+hmap__WriteAt(
+    FILE *pf,
+    uint64_t *position,
+    uint64_t offset,
+    const void *data,
+    size_t byteSize
+) {
+    static const char zeros[HMAP__ALIGNMENT] = {0};
+    size_t padding = (size_t)(offset - *position);
+
+    if (*position > offset || padding > sizeof(zeros)
+        || fwrite(zeros, 1, padding, pf) != padding
+        || fwrite(data, byteSize, 1, pf) != 1) {
+        return false;
+    }
+    *position = offset + byteSize;
+
+    return true;
+}
+
+HMAPDEF bool
+hmap_Save(
+    const char *pathToFile,
+    const uint16_t *heights,
+    int width,
+    int height,
+    hmap_SlopeFormat slopeFormat,
+    int threadCount
+) {
+    const int levelCount = hmap_LevelCount(width, height);
+    const size_t slopeByteSize = (size_t)hmap_SlopeByteSize(slopeFormat);
+    std::vector<hmap__LevelHeader> levels(levelCount);
+    hmap__Header header;
+    uint64_t offset = sizeof(header) + levelCount * sizeof(hmap__LevelHeader);
+    FILE *pf;
+    bool success;
+
+    memcpy(header.magic, hmap__Magic, sizeof(header.magic));
+    header.version = HMAP_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.levelCount = (uint32_t)levelCount;
+    header.slopeFormat = (uint32_t)slopeFormat;
+    header.slopeScale = slopeFormat == HMAP_SLOPE_RG16_SNORM
+                      ? hmap_MaxSlope(heights, width, height, threadCount)
+                      : 1.0f;
+    header.reserved = 0u;
+
+    for (int i = 0; i < levelCount; ++i) {
+        uint64_t texelCount;
+
+        levels[i].width = (uint32_t)std::max(1, width >> i);
+        levels[i].height = (uint32_t)std::max(1, height >> i);
+        texelCount = (uint64_t)levels[i].width * levels[i].height;
+        levels[i].dmapOffset = offset = hmap__Align(offset);
+        offset+= 2u * sizeof(uint16_t) * texelCount;
+        levels[i].smapOffset = offset = hmap__Align(offset);
+        offset+= slopeByteSize * texelCount;
+    }
+
+    pf = fopen(pathToFile, "wb");
+    if (!pf) {
+        HMAP_LOG("hmap: fopen failed (%s)\n", pathToFile);
+
+        return false;
+    }
+
+    success = fwrite(&header, sizeof(header), 1, pf) == 1
+           && fwrite(&levels[0], sizeof(levels[0]), levelCount, pf)
+              == (size_t)levelCount;
+    offset = sizeof(header) + levelCount * sizeof(hmap__LevelHeader);
+
+    // only the current level and the next one are kept in memory
+    std::vector<uint16_t> dmap((size_t)2 * width * height), nextDmap;
+    std::vector<float> smap((size_t)2 * width * height), nextSmap;
+    std::vector<char> encodedSmap(slopeByteSize * width * height);
+
+    hmap_ComputeLevel(heights, width, height, &dmap[0], &smap[0], threadCount);
+
+    for (int i = 0; i < levelCount && success; ++i) {
+        const hmap__LevelHeader &level = levels[i];
+        size_t texelCount = (size_t)level.width * level.height;
+
+        hmap_EncodeSlopes(&smap[0], texelCount, slopeFormat, header.slopeScale,
+                          &encodedSmap[0]);
+        success = hmap__WriteAt(pf, &offset, level.dmapOffset, &dmap[0],
+                                dmap.size() * sizeof(dmap[0]))
+               && hmap__WriteAt(pf, &offset, level.smapOffset, &encodedSmap[0],
+                                slopeByteSize * texelCount);
+
+        if (i + 1 < levelCount) {
+            nextDmap.resize((size_t)2 * levels[i + 1].width * levels[i + 1].height);
+            nextSmap.resize((size_t)2 * levels[i + 1].width * levels[i + 1].height);
+            hmap_ComputeNextLevel(&dmap[0], &smap[0], level.width, level.height,
+                                  &nextDmap[0], &nextSmap[0]);
+            dmap.swap(nextDmap);
+            smap.swap(nextSmap);
+        }
+    }
+    success = (fclose(pf) == 0) && success;
+
+    if (!success)
+        HMAP_LOG("hmap: write failed (%s)\n", pathToFile);
+
+    return success;
+}
+
+
+/*******************************************************************************
+ * Load -- Maps the file and validates its header
+ *
+ */
+static void *hmap__Map(const char *pathToFile, size_t *byteSize)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(pathToFile, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE mapping;
+    LARGE_INTEGER fileSize;
+    void *data = NULL;
+
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            *byteSize = (size_t)fileSize.QuadPart;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+
+    return data;
+#else
+    int fd = open(pathToFile, O_RDONLY);
+    struct stat st;
+    void *data = NULL;
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+            data = NULL;
+        else
+            *byteSize = (size_t)st.st_size;
+    }
+    close(fd);
+
+    return data;
+#endif
+}
+
+static void hmap__Unmap(void *data, size_t byteSize)
+{
+#ifdef _WIN32
+    (void)byteSize;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, byteSize);
+#endif
+}
+
+HMAPDEF hmap_Heightmap *hmap_Load(const char *pathToFile)
+{
+    size_t byteSize = 0;
+    void *data = hmap__Map(pathToFile, &byteSize);
+    const hmap__Header *header = (const hmap__Header *)data;
+    const hmap__LevelHeader *levels;
+    hmap_Heightmap *heightmap;
+    bool valid;
+
+    if (!data)
+        return NULL;
+
+    valid = byteSize >= sizeof(*header)
+         && !memcmp(header->magic, hmap__Magic, sizeof(header->magic))
+         && header->version == HMAP_VERSION
+         && header->width > 0u && header->height > 0u
+         && (int)header->levelCount == hmap_LevelCount(header->width, header->height)
+         && header->slopeFormat <= (uint32_t)HMAP_SLOPE_RG16_SNORM
+         && byteSize >= sizeof(*header) + header->levelCount * sizeof(*levels);
+    levels = (const hmap__LevelHeader *)(header + 1);
+
+    for (uint32_t i = 0; valid && i < header->levelCount; ++i) {
+        uint64_t texelCount = (uint64_t)levels[i].width * levels[i].height;
+
+        valid = levels[i].width == std::max(1u, header->width >> i)
+             && levels[i].height == std::max(1u, header->height >> i)
+             && levels[i].dmapOffset % HMAP__ALIGNMENT == 0u
+             && levels[i].smapOffset % HMAP__ALIGNMENT == 0u
+             && levels[i].dmapOffset + 2u * sizeof(uint16_t) * texelCount <= byteSize
+             && levels[i].smapOffset
+                + hmap_SlopeByteSize((hmap_SlopeFormat)header->slopeFormat)
+                * texelCount <= byteSize;
+    }
+
+    if (!valid) {
+        HMAP_LOG("hmap: invalid container (%s)\n", pathToFile);
+        hmap__Unmap(data, byteSize);
+
+        return NULL;
+    }
+
+    heightmap = (hmap_Heightmap *)malloc(sizeof(*heightmap));
+    heightmap->width = (int)header->width;
+    heightmap->height = (int)header->height;
+    heightmap->levelCount = (int)header->levelCount;
+    heightmap->slopeFormat = (hmap_SlopeFormat)header->slopeFormat;
+    heightmap->slopeScale = header->slopeScale;
+    heightmap->levels = (hmap_Level *)malloc(header->levelCount * sizeof(hmap_Level));
+    heightmap->mapping = data;
+    heightmap->mappingByteSize = byteSize;
+
+    for (uint32_t i = 0; i < header->levelCount; ++i) {
+        hmap_Level *level = &heightmap->levels[i];
+
+        level->width = (int)levels[i].width;
+        level->height = (int)levels[i].height;
+        level->dmap = (const uint16_t *)((const char *)data + levels[i].dmapOffset);
+        level->smap = (const char *)data + levels[i].smapOffset;
+    }
+
+    return heightmap;
+}
+
+HMAPDEF void hmap_Release(hmap_Heightmap *heightmap)
+{
+    hmap__Unmap(heightmap->mapping, heightmap->mappingByteSize);
+    free(heightmap->levels);
+    free(heightmap);
+}
+
+HMAPDEF std::string
+hmap_ContainerPath(const std::string &pathToImage, const char *extension)
+{
+    size_t dot = pathToImage.find_last_of('.');
+    size_t slash = pathToImage.find_last_of("/\\");
+
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return pathToImage + extension;
+
+    return pathToImage.substr(0, dot) + extension;
+}
+
+
+/*******************************************************************************
+ * Tiled Containers -- Stores each level as tiles with a border of one texel
+ *
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t tileSize;
+    uint32_t levelCount;
+    uint32_t slopeFormat;
+    float slopeScale;
+} hmap__TiledHeader;
+
+static const char hmap__TiledMagic[4] = {'H', 'T', 'I', 'L'};
+#define HMAP__TILED_HEADER_BYTE_SIZE 64u
+
+HMAPDEF int hmap_TiledLevelCount(int width, int height, int tileSize)
+{
+    int levelCount = 1;
+
+    while (std::max(width >> (levelCount - 1), height >> (levelCount - 1)) > tileSize)
+        ++levelCount;
+
+    return levelCount;
+}
+
+static void
+hmap__TileGridSize(
+    int width,
+    int height,
+    int tileSize,
+    int level,
+    int *xOut,
+    int *yOut
+) {
+    *xOut = (std::max(1, width >> level) + tileSize - 1) / tileSize;
+    *yOut = (std::max(1, height >> level) + tileSize - 1) / tileSize;
+}
+
+HMAPDEF void
+hmap_TileGridSize(
+    const hmap_TiledHeightmap *heightmap,
+    int level,
+    int *xOut,
+    int *yOut
+) {
+    hmap__TileGridSize(heightmap->width, heightmap->height, heightmap->tileSize,
+                       level, xOut, yOut);
+}
+
+HMAPDEF int
+hmap_TileIndex(const hmap_TiledHeightmap *heightmap, int level, int x, int y)
+{
+    int offset = 0, gridX, gridY;
+
+    for (int i = 0; i < level; ++i) {
+        hmap_TileGridSize(heightmap, i, &gridX, &gridY);
+        offset+= gridX * gridY;
+    }
+    hmap_TileGridSize(heightmap, level, &gridX, &gridY);
+
+    return offset + x + gridX * y;
+}
+
+static size_t hmap__TileDmapByteSize(int tileSize)
+{
+    return 2u * sizeof(uint16_t) * (tileSize + 2) * (tileSize + 2);
+}
+
+static size_t hmap__TileByteSize(int tileSize, hmap_SlopeFormat slopeFormat)
+{
+    return (size_t)(2 * sizeof(uint16_t) + hmap_SlopeByteSize(slopeFormat))
+         * (tileSize + 2) * (tileSize + 2);
+}
+
+// copies the texels of a tile and its border, clamped to the level; dmap and
+// smap hold the rows of the level from firstRow on
+static void
+hmap__CopyTile(
+    const uint16_t *dmap,
+    const float *smap,
+    int width,
+    int height,
+    int firstRow,
+    int tileSize,
+    int tileX,
+    int tileY,
+    uint16_t *dmapOut,
+    float *smapOut
+) {
+    const int size = tileSize + 2;
+
+    for (int j = 0; j < size; ++j) {
+        int y = std::min(std::max(tileY * tileSize + j - 1, 0), height - 1);
+
+        for (int i = 0; i < size; ++i) {
+            int x = std::min(std::max(tileX * tileSize + i - 1, 0), width - 1);
+            size_t texelID = (size_t)x + (size_t)width * (y - firstRow);
+
+            dmapOut[2 * (i + size * j)    ] = dmap[2 * texelID    ];
+            dmapOut[2 * (i + size * j) + 1] = dmap[2 * texelID + 1];
+            smapOut[2 * (i + size * j)    ] = smap[2 * texelID    ];
+            smapOut[2 * (i + size * j) + 1] = smap[2 * texelID + 1];
+        }
+    }
+}
+
+// rows of a level that are kept in memory while the container is written:
+// the rows of the tiles that are not written yet, along with their borders,
+// and the rows the next level is not reduced from yet
+struct hmap__TiledLevel {
+    int width, height;
+    int gridX, gridY;
+    int firstTileIndex;
+    int firstRow, rowCount;   // rows held in dmap and smap
+    int tileRow;              // next row of tiles to write
+    int nextLevelRow;         // next row of the next level to reduce
+    std::vector<uint16_t> dmap;
+    std::vector<float> smap;
+};
+
+struct hmap__TiledWriter {
+    FILE *pf;
+    int tileSize;
+    hmap_SlopeFormat slopeFormat;
+    float slopeScale;
+    std::vector<hmap__TiledLevel> levels;
+    std::vector<uint16_t> tileDmap;
+    std::vector<float> tileSmap;
+    std::vector<char> tile;   // padded to the alignment of the tiles
+    bool success;
+};
+
+// tiles have a fixed size, so that each one is written at its own offset
+static void
+hmap__WriteTile(hmap__TiledWriter *writer, const hmap__TiledLevel &level, int x, int y)
+{
+    const int tileTexelCount = (writer->tileSize + 2) * (writer->tileSize + 2);
+    const size_t dmapByteSize = hmap__TileDmapByteSize(writer->tileSize);
+    const int tileIndex = level.firstTileIndex + x + level.gridX * y;
+    uint64_t offset = HMAP__TILED_HEADER_BYTE_SIZE
+                    + (uint64_t)writer->tile.size() * (uint64_t)tileIndex;
+
+    hmap__CopyTile(&level.dmap[0], &level.smap[0], level.width, level.height,
+                   level.firstRow, writer->tileSize, x, y,
+                   &writer->tileDmap[0], &writer->tileSmap[0]);
+    memcpy(&writer->tile[0], &writer->tileDmap[0], dmapByteSize);
+    hmap_EncodeSlopes(&writer->tileSmap[0], tileTexelCount, writer->slopeFormat,
+                      writer->slopeScale, &writer->tile[dmapByteSize]);
+
+    writer->success = writer->success
+                   && HMAP__FSEEK64(writer->pf, offset, SEEK_SET) == 0
+                   && fwrite(&writer->tile[0], writer->tile.size(), 1, writer->pf) == 1;
+}
+
+// appends the next rowCount rows of a level, writes the rows of tiles they
+// complete, and reduces the rows of the next level they complete
+static void
+hmap__AppendTiledRows(
+    hmap__TiledWriter *writer,
+    int levelID,
+    const uint16_t *dmap,
+    const float *smap,
+    int rowCount
+) {
+    hmap__TiledLevel &level = writer->levels[levelID];
+    const int tileSize = writer->tileSize;
+    const size_t rowTexelCount = (size_t)2 * level.width;
+    int rowEnd, keepRow;
+
+    level.dmap.insert(level.dmap.end(), dmap, dmap + rowTexelCount * rowCount);
+    level.smap.insert(level.smap.end(), smap, smap + rowTexelCount * rowCount);
+    level.rowCount+= rowCount;
+    rowEnd = level.firstRow + level.rowCount;
+
+    // rows of tiles whose texels and borders are all available
+    while (writer->success && level.tileRow < level.gridY
+           && rowEnd >= std::min(level.height, (level.tileRow + 1) * tileSize + 1)) {
+        for (int x = 0; x < level.gridX; ++x)
+            hmap__WriteTile(writer, level, x, level.tileRow);
+        ++level.tileRow;
+    }
+    keepRow = std::min(rowEnd, std::max(0, level.tileRow * tileSize - 1));
+
+    // rows of the next level whose 2x2 texels are all available
+    if (levelID + 1 < (int)writer->levels.size()) {
+        const hmap__TiledLevel &next = writer->levels[levelID + 1];
+        int nextRowEnd = std::min(next.height, level.height > 1 ? rowEnd / 2 : 1);
+        int nextRowCount = nextRowEnd - level.nextLevelRow;
+
+        if (writer->success && nextRowCount > 0) {
+            const size_t texelID = rowTexelCount
+                                 * (2 * level.nextLevelRow - level.firstRow);
+            std::vector<uint16_t> nextDmap((size_t)2 * next.width * nextRowCount);
+            std::vector<float> nextSmap((size_t)2 * next.width * nextRowCount);
+
+            hmap_ComputeNextLevel(&level.dmap[texelID], &level.smap[texelID],
+                                  level.width, std::min(level.height, 2 * nextRowCount),
+                                  &nextDmap[0], &nextSmap[0]);
+            level.nextLevelRow = nextRowEnd;
+            hmap__AppendTiledRows(writer, levelID + 1,
+                                  &nextDmap[0], &nextSmap[0], nextRowCount);
+        }
+        keepRow = std::min(keepRow, 2 * level.nextLevelRow);
+    }
+
+    // rows that are no longer needed
+    if (keepRow > level.firstRow) {
+        size_t count = rowTexelCount * (keepRow - level.firstRow);
+
+        level.dmap.erase(level.dmap.begin(), level.dmap.begin() + count);
+        level.smap.erase(level.smap.begin(), level.smap.begin() + count);
+        level.rowCount-= keepRow - level.firstRow;
+        level.firstRow = keepRow;
+    }
+}
+
+// the first level is computed in bands of rows, and each level only keeps
+// the rows its next tiles and the next level need, so that heightmaps much
+// larger than the memory can be converted
+HMAPDEF bool
+hmap_SaveTiled(
+    const char *pathToFile,
+    const uint16_t *heights,
+    int width,
+    int height,
+    int tileSize,
+    hmap_SlopeFormat slopeFormat,
+    int threadCount
+) {
+    const int levelCount = hmap_TiledLevelCount(width, height, tileSize);
+    const int bandRowCount = std::max(tileSize, 256);
+    const int tileTexelCount = (tileSize + 2) * (tileSize + 2);
+    char headerBytes[HMAP__TILED_HEADER_BYTE_SIZE] = {0};
+    hmap__TiledHeader header;
+    hmap__TiledWriter writer;
+    int tileIndex = 0;
+
+    if (tileSize < 2 || (tileSize & (tileSize - 1))) {
+        HMAP_LOG("hmap: tile size must be a power of two\n");
+
+        return false;
+    }
+
+    memcpy(header.magic, hmap__TiledMagic, sizeof(header.magic));
+    header.version = HMAP_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.tileSize = (uint32_t)tileSize;
+    header.levelCount = (uint32_t)levelCount;
+    header.slopeFormat = (uint32_t)slopeFormat;
+    header.slopeScale = slopeFormat == HMAP_SLOPE_RG16_SNORM
+                      ? hmap_MaxSlope(heights, width, height, threadCount)
+                      : 1.0f;
+    memcpy(headerBytes, &header, sizeof(header));
+
+    writer.pf = fopen(pathToFile, "wb");
+    if (!writer.pf) {
+        HMAP_LOG("hmap: fopen failed (%s)\n", pathToFile);
+
+        return false;
+    }
+    writer.tileSize = tileSize;
+    writer.slopeFormat = slopeFormat;
+    writer.slopeScale = header.slopeScale;
+    writer.levels.resize(levelCount);
+    writer.tileDmap.resize(2 * tileTexelCount);
+    writer.tileSmap.resize(2 * tileTexelCount);
+    writer.tile.resize((size_t)hmap__Align(hmap__TileByteSize(tileSize, slopeFormat)), 0);
+    writer.success = fwrite(headerBytes, sizeof(headerBytes), 1, writer.pf) == 1;
+
+    for (int i = 0; i < levelCount; ++i) {
+        hmap__TiledLevel &level = writer.levels[i];
+
+        level.width = std::max(1, width >> i);
+        level.height = std::max(1, height >> i);
+        hmap__TileGridSize(width, height, tileSize, i, &level.gridX, &level.gridY);
+        level.firstTileIndex = tileIndex;
+        level.firstRow = level.rowCount = 0;
+        level.tileRow = level.nextLevelRow = 0;
+        tileIndex+= level.gridX * level.gridY;
+    }
+
+    // the other levels are reduced as the rows of the first one are appended
+    std::vector<uint16_t> dmap((size_t)2 * width * std::min(height, bandRowCount));
+    std::vector<float> smap((size_t)2 * width * std::min(height, bandRowCount));
+
+    for (int j = 0; j < height && writer.success; j+= bandRowCount) {
+        int rowCount = std::min(height - j, bandRowCount);
+
+        hmap__ComputeLevelRows(heights, width, height, j, j + rowCount,
+                               &dmap[0], &smap[0], threadCount);
+        hmap__AppendTiledRows(&writer, 0, &dmap[0], &smap[0], rowCount);
+    }
+    writer.success = (fclose(writer.pf) == 0) && writer.success;
+
+    if (!writer.success)
+        HMAP_LOG("hmap: write failed (%s)\n", pathToFile);
+
+    return writer.success;
+}
+
+HMAPDEF hmap_TiledHeightmap *hmap_LoadTiled(const char *pathToFile)
+{
+    FILE *pf = fopen(pathToFile, "rb");
+    hmap__TiledHeader header;
+    hmap_TiledHeightmap *heightmap;
+    bool valid;
+
+    if (!pf)
+        return NULL;
+
+    valid = fread(&header, sizeof(header), 1, pf) == 1
+         && !memcmp(header.magic, hmap__TiledMagic, sizeof(header.magic))
+         && header.version == HMAP_VERSION
+         && header.width > 0u && header.height > 0u
+         && header.tileSize >= 2u && header.tileSize <= (1u << 15)
+         && !(header.tileSize & (header.tileSize - 1u))
+         && (int)header.levelCount == hmap_TiledLevelCount(header.width,
+                                                             header.height,
+                                                             header.tileSize)
+         && header.slopeFormat <= (uint32_t)HMAP_SLOPE_RG16_SNORM;
+
+    if (!valid) {
+        HMAP_LOG("hmap: invalid tiled container (%s)\n", pathToFile);
+        fclose(pf);
+
+        return NULL;
+    }
+
+    heightmap = (hmap_TiledHeightmap *)malloc(sizeof(*heightmap));
+    heightmap->width = (int)header.width;
+    heightmap->height = (int)header.height;
+    heightmap->tileSize = (int)header.tileSize;
+    heightmap->levelCount = (int)header.levelCount;
+    heightmap->slopeFormat = (hmap_SlopeFormat)header.slopeFormat;
+    heightmap->slopeScale = header.slopeScale;
+    heightmap->tileByteSize = hmap__TileByteSize(heightmap->tileSize,
+                                                 heightmap->slopeFormat);
+    heightmap->tileCount = hmap_TileIndex(heightmap, heightmap->levelCount - 1, 0, 0) + 1;
+    heightmap->file = pf;
+
+    return heightmap;
+}
+
+HMAPDEF void hmap_ReleaseTiled(hmap_TiledHeightmap *heightmap)
+{
+    fclose((FILE *)heightmap->file);
+    free(heightmap);
+}
+
+HMAPDEF bool
+hmap_ReadTile(
+    const hmap_TiledHeightmap *heightmap,
+    int tileIndex,
+    void *tileOut
+) {
+    FILE *pf = (FILE *)heightmap->file;
+    uint64_t offset = HMAP__TILED_HEADER_BYTE_SIZE
+                    + hmap__Align(heightmap->tileByteSize) * (uint64_t)tileIndex;
+
+    if (tileIndex < 0 || tileIndex >= heightmap->tileCount
+        || HMAP__FSEEK64(pf, offset, SEEK_SET) != 0
+        || fread(tileOut, heightmap->tileByteSize, 1, pf) != 1) {
+        HMAP_LOG("hmap: failed to read tile %i\n", tileIndex);
+
+        return false;
+    }
+
+    return true;
+}
+
+
+/*******************************************************************************
+ * Tile Streaming -- Reads tiles on a background thread
+ *
+ * Requests are served by decreasing priority; the thread sleeps whenever no
+ * tile is requested or all the staging slots hold tiles not yet recycled.
+ */
+enum {
+    HMAP__TILE_IDLE,    // neither read nor waiting to be recycled
+    HMAP__TILE_BUSY,    // read or waiting to be recycled
+    HMAP__TILE_FAILED   // never requested again
+};
+
+struct hmap_TileStreamer {
+    const hmap_TiledHeightmap *heightmap;
+    std::vector<char> staging;
+    std::vector<int> freeSlots;
+    std::vector<uint8_t> tileStates;
+    std::vector<int> queue;           // tiles to read by decreasing priority
+    size_t queueHead;
+    std::deque<hmap_StreamedTile> streamedTiles;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+    bool quit;
+};
+
+static void hmap__StreamerThread(hmap_TileStreamer *streamer)
+{
+    const hmap_TiledHeightmap *heightmap = streamer->heightmap;
+    const size_t dmapByteSize = hmap__TileDmapByteSize(heightmap->tileSize);
+    std::unique_lock<std::mutex> lock(streamer->mutex);
+
+    for (;;) {
+        streamer->condition.wait(lock, [&]() {
+            return streamer->quit
+                || (streamer->queueHead < streamer->queue.size()
+                    && !streamer->freeSlots.empty());
+        });
+
+        if (streamer->quit)
+            break;
+
+        int tileIndex = streamer->queue[streamer->queueHead++];
+
+        if (tileIndex < 0 || streamer->tileStates[tileIndex] != HMAP__TILE_IDLE)
+            continue;
+
+        int slot = streamer->freeSlots.back();
+        char *data = &streamer->staging[slot * heightmap->tileByteSize];
+        bool success;
+
+        streamer->freeSlots.pop_back();
+        streamer->tileStates[tileIndex] = HMAP__TILE_BUSY;
+
+        lock.unlock();
+        success = hmap_ReadTile(heightmap, tileIndex, data);
+        lock.lock();
+
+        if (success) {
+            hmap_StreamedTile tile = {
+                tileIndex, (const uint16_t *)data, data + dmapByteSize, slot
+            };
+
+            streamer->streamedTiles.push_back(tile);
+        } else {
+            streamer->tileStates[tileIndex] = HMAP__TILE_FAILED;
+            streamer->freeSlots.push_back(slot);
+        }
+    }
+}
+
+HMAPDEF hmap_TileStreamer *
+hmap_CreateTileStreamer(const hmap_TiledHeightmap *heightmap, int slotCount)
+{
+    hmap_TileStreamer *streamer = new hmap_TileStreamer;
+
+    streamer->heightmap = heightmap;
+    streamer->staging.resize(slotCount * heightmap->tileByteSize);
+    for (int i = slotCount - 1; i >= 0; --i)
+        streamer->freeSlots.push_back(i);
+    streamer->tileStates.resize(heightmap->tileCount, HMAP__TILE_IDLE);
+    streamer->queueHead = 0;
+    streamer->quit = false;
+    streamer->thread = std::thread(hmap__StreamerThread, streamer);
+
+    return streamer;
+}
+
+HMAPDEF void hmap_ReleaseTileStreamer(hmap_TileStreamer *streamer)
+{
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+
+        streamer->quit = true;
+    }
+    streamer->condition.notify_one();
+    streamer->thread.join();
+    delete streamer;
+}
+
+HMAPDEF void
+hmap_StreamTiles(hmap_TileStreamer *streamer, const int *tileIndices, int count)
+{
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+
+        streamer->queue.assign(tileIndices, tileIndices + count);
+        streamer->queueHead = 0;
+    }
+    streamer->condition.notify_one();
+}
+
+HMAPDEF bool
+hmap_PopStreamedTile(hmap_TileStreamer *streamer, hmap_StreamedTile *tile)
+{
+    std::lock_guard<std::mutex> lock(streamer->mutex);
+
+    if (streamer->streamedTiles.empty())
+        return false;
+
+    *tile = streamer->streamedTiles.front();
+    streamer->streamedTiles.pop_front();
+
+    return true;
+}
+
+HMAPDEF void
+hmap_RecycleStreamedTile(hmap_TileStreamer *streamer, const hmap_StreamedTile *tile)
+{
+    {
+        std::lock_guard<std::mutex> lock(streamer->mutex);
+        std::vector<int> &queue = streamer->queue;
+
+        // the tile may still be queued by requests issued while it was read
+        for (size_t i = streamer->queueHead; i < queue.size(); ++i)
+            if (queue[i] == tile->tileIndex)
+                queue[i] = -1;
+
+        streamer->tileStates[tile->tileIndex] = HMAP__TILE_IDLE;
+        streamer->freeSlots.push_back(tile->slot);
+    }
+    streamer->condition.notify_one();
+}
+
+
+/*******************************************************************************
+ * Tile Cache -- Tracks the resident tiles and builds the tile table
+ *
+ */
+struct hmap_TileCache {
+    const hmap_TiledHeightmap *heightmap;
+    std::vector<int> tileLayers;       // -1 if the tile is not resident
+    std::vector<int> layerTiles;       // -1 if the layer is free
+    std::vector<uint32_t> layerFrames; // last frame the tile was requested
+    std::vector<int> tileLevels;
+    std::vector<int> tileParents;      // -1 for the tile of the last level
+    std::vector<uint32_t> requests;    // requests propagated to the ancestors
+    std::vector<uint32_t> table;
+    std::vector<int> streamQueue;
+    uint32_t frame;
+    int residentCount;
+    bool tableDirty;
+};
+
+HMAPDEF hmap_TileCache *
+hmap_CreateTileCache(const hmap_TiledHeightmap *heightmap, int layerCount)
+{
+    hmap_TileCache *cache = new hmap_TileCache;
+    const int tileCount = heightmap->tileCount;
+
+    cache->heightmap = heightmap;
+    cache->tileLayers.resize(tileCount, -1);
+    cache->layerTiles.resize(layerCount, -1);
+    cache->layerFrames.resize(layerCount, 0u);
+    cache->tileLevels.resize(tileCount);
+    cache->tileParents.resize(tileCount, -1);
+    cache->requests.resize(tileCount);
+    cache->table.resize(tileCount, 0u);
+    cache->frame = 0u;
+    cache->residentCount = 0;
+    cache->tableDirty = true;
+
+    // tiles are ordered from the finest level to the coarsest, so that the
+    // parent of a tile always comes after it
+    for (int level = 0; level < heightmap->levelCount; ++level) {
+        int gridX, gridY, parentGridX, parentGridY;
+
+        hmap_TileGridSize(heightmap, level, &gridX, &gridY);
+        hmap_TileGridSize(heightmap, level + 1, &parentGridX, &parentGridY);
+
+        for (int y = 0; y < gridY; ++y)
+        for (int x = 0; x < gridX; ++x) {
+            int tileIndex = hmap_TileIndex(heightmap, level, x, y);
+
+            cache->tileLevels[tileIndex] = level;
+            if (level + 1 < heightmap->levelCount)
+                cache->tileParents[tileIndex] =
+                    hmap_TileIndex(heightmap, level + 1,
+                                   std::min(x >> 1, parentGridX - 1),
+                                   std::min(y >> 1, parentGridY - 1));
+        }
+    }
+
+    return cache;
+}
+
+HMAPDEF void hmap_ReleaseTileCache(hmap_TileCache *cache)
+{
+    delete cache;
+}
+
+HMAPDEF int
+hmap_RequestTiles(
+    hmap_TileCache *cache,
+    hmap_TileStreamer *streamer,
+    const uint32_t *requests
+) {
+    const int tileCount = cache->heightmap->tileCount;
+    std::vector<uint32_t> &distances = cache->requests;
+    std::vector<int> &queue = cache->streamQueue;
+
+    ++cache->frame;
+    distances.assign(requests, requests + tileCount);
+    queue.clear();
+
+    // a tile needs its ancestors, which are sampled until it is resident
+    for (int i = 0; i < tileCount; ++i) {
+        int parent = cache->tileParents[i];
+
+        if (parent >= 0)
+            distances[parent] = std::min(distances[parent], distances[i]);
+    }
+
+    for (int i = 0; i < tileCount; ++i) {
+        int layer = cache->tileLayers[i];
+
+        if (distances[i] == HMAP_NO_REQUEST)
+            continue;
+
+        if (layer >= 0)
+            cache->layerFrames[layer] = cache->frame;
+        else
+            queue.push_back(i);
+    }
+
+    // coarsest first, then closest first; the bits of non-negative floats
+    // compare as the floats themselves
+    std::sort(queue.begin(), queue.end(), [&](int a, int b) {
+        if (cache->tileLevels[a] != cache->tileLevels[b])
+            return cache->tileLevels[a] > cache->tileLevels[b];
+
+        return distances[a] < distances[b];
+    });
+    hmap_StreamTiles(streamer, queue.empty() ? NULL : &queue[0], (int)queue.size());
+
+    return (int)queue.size();
+}
+
+HMAPDEF int hmap_InsertTile(hmap_TileCache *cache, int tileIndex)
+{
+    const int layerCount = (int)cache->layerTiles.size();
+    const int rootIndex = cache->heightmap->tileCount - 1;
+    int layer = -1;
+
+    if (cache->tileLayers[tileIndex] >= 0)
+        return cache->tileLayers[tileIndex];
+
+    if (cache->residentCount < layerCount) {
+        layer = cache->residentCount++;
+    } else {
+        // evict the least recently requested tile, unless it is still needed
+        for (int i = 0; i < layerCount; ++i) {
+            if (cache->layerTiles[i] != rootIndex
+                && cache->layerFrames[i] < cache->frame
+                && (layer < 0 || cache->layerFrames[i] < cache->layerFrames[layer])) {
+                layer = i;
+            }
+        }
+
+        if (layer < 0)
+            return -1;
+
+        cache->tileLayers[cache->layerTiles[layer]] = -1;
+    }
+
+    cache->layerTiles[layer] = tileIndex;
+    cache->layerFrames[layer] = cache->frame;
+    cache->tileLayers[tileIndex] = layer;
+    cache->tableDirty = true;
+
+    return layer;
+}
+
+HMAPDEF int hmap_ResidentTileCount(const hmap_TileCache *cache)
+{
+    return cache->residentCount;
+}
+
+HMAPDEF const uint32_t *hmap_UpdateTileTable(hmap_TileCache *cache)
+{
+    if (!cache->tableDirty)
+        return NULL;
+
+    // parents come after their children, so the table is filled from the
+    // coarsest tile to the finest ones
+    for (int i = cache->heightmap->tileCount - 1; i >= 0; --i) {
+        int layer = cache->tileLayers[i];
+        int parent = cache->tileParents[i];
+
+        if (layer >= 0)
+            cache->table[i] = ((uint32_t)cache->tileLevels[i] << 16) | (uint32_t)layer;
+        else if (parent >= 0)
+            cache->table[i] = cache->table[parent];
+    }
+    cache->tableDirty = false;
+
+    return &cache->table[0];
+}
+
+#endif // HMAP_IMPLEMENTATION
@@ -0,0 +1,3901 @@
+/* LongestEdgeBisectionCPU.h - public domain
+by Jonathan Dupuy
+
+    Multithreaded CPU routines for the LongestEdgeBisection.h library.
+
+    The routines below operate directly on the memory of a leb_Heap, i.e.,
+    a bitfield of 2^(maxDepth + 2) bits storing the sum-reduction tree of the
+    subdivision; a node of depth d uses (maxDepth - d + 1) bits located at
+    bit offset 2^(d + 1) + id * (maxDepth - d + 1). All writes to the bitfield
+    are performed with atomic bit operations so that split and merge passes
+    can be distributed over a pool of threads.
+
+    For deep subdivisions, a lebcpu_SparseHeap offers the same operations
+    with a memory footprint proportional to the number of leaves.
+
+    This code has dependencies on the following sources:
+    - LongestEdgeBisection.h
+*/
+#ifndef LEBCPU_INCLUDE_LEBCPU_H
+#define LEBCPU_INCLUDE_LEBCPU_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#ifdef _MSC_VER
+#   include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define LEBCPU_SIMD_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#   include <arm_neon.h>
+#   define LEBCPU_SIMD_NEON
+#endif
+
+// number of lanes processed by batched routines
+#define LEBCPU_BATCH_SIZE 8
+
+#ifndef LEBCPU_GRAIN_SIZE
+#   define LEBCPU_GRAIN_SIZE 256u
+#endif
+
+// shallowest depth at which a reduction level is distributed over threads
+// (must be at least 5 so that groups of 32 nodes start on a word boundary)
+#ifndef LEBCPU_PARALLEL_REDUCTION_DEPTH
+#   define LEBCPU_PARALLEL_REDUCTION_DEPTH 14
+#endif
+
+enum lebcpu_Mode { LEBCPU_MODE_TRIANGLE, LEBCPU_MODE_QUAD };
+
+
+// *****************************************************************************
+// Thread Pool
+//
+// The pool holds threadCount - 1 workers; the calling thread participates in
+// every job as thread 0, so a pool of 1 thread runs everything serially.
+
+struct lebcpu_ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable jobCondition, doneCondition;
+    const std::function<void(int)> *job;
+    uint32_t jobID;
+    int busyCount;
+    bool stop;
+};
+
+inline int lebcpu_HardwareThreadCount()
+{
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+inline void lebcpu__WorkerLoop(lebcpu_ThreadPool *pool, int threadID)
+{
+    uint32_t jobID = 0u;
+
+    for (;;) {
+        const std::function<void(int)> *job;
+
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+
+            pool->jobCondition.wait(lock, [&] {
+                return pool->stop || pool->jobID != jobID;
+            });
+            if (pool->stop)
+                return;
+            jobID = pool->jobID;
+            job = pool->job;
+        }
+
+        (*job)(threadID);
+
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+
+            if (--pool->busyCount == 0)
+                pool->doneCondition.notify_one();
+        }
+    }
+}
+
+inline lebcpu_ThreadPool *lebcpu_CreateThreadPool(int threadCount)
+{
+    lebcpu_ThreadPool *pool = new lebcpu_ThreadPool;
+
+    pool->job = NULL;
+    pool->jobID = 0u;
+    pool->busyCount = 0;
+    pool->stop = false;
+    for (int i = 1; i < threadCount; ++i)
+        pool->workers.push_back(std::thread(&lebcpu__WorkerLoop, pool, i));
+
+    return pool;
+}
+
+inline void lebcpu_ReleaseThreadPool(lebcpu_ThreadPool *pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+
+        pool->stop = true;
+    }
+    pool->jobCondition.notify_all();
+    for (size_t i = 0; i < pool->workers.size(); ++i)
+        pool->workers[i].join();
+
+    delete pool;
+}
+
+inline int lebcpu_ThreadCount(const lebcpu_ThreadPool *pool)
+{
+    return pool ? (int)pool->workers.size() + 1 : 1;
+}
+
+// runs job(threadID) once on every thread of the pool and waits for completion
+inline void
+lebcpu_Execute(lebcpu_ThreadPool *pool, const std::function<void(int)> &job)
+{
+    if (!pool || pool->workers.empty()) {
+        job(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+
+        pool->job = &job;
+        pool->busyCount = (int)pool->workers.size();
+        ++pool->jobID;
+    }
+    pool->jobCondition.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->doneCondition.wait(lock, [&] { return pool->busyCount == 0; });
+}
+
+// runs kernel(begin, end) over [0, count) in chunks of grainSize elements
+inline void
+lebcpu_ParallelFor(
+    lebcpu_ThreadPool *pool,
+    uint32_t count,
+    uint32_t grainSize,
+    const std::function<void(uint32_t, uint32_t)> &kernel
+) {
+    if (lebcpu_ThreadCount(pool) == 1 || count <= grainSize) {
+        if (count > 0u)
+            kernel(0u, count);
+        return;
+    }
+
+    std::atomic<uint32_t> next(0u);
+
+    lebcpu_Execute(pool, [&](int) {
+        for (;;) {
+            uint32_t begin = next.fetch_add(grainSize);
+
+            if (begin >= count)
+                break;
+
+            kernel(begin, std::min(begin + grainSize, count));
+        }
+    });
+}
+
+
+// tasks [begin, end) owned by a thread, packed in a 64-bit atomic
+struct lebcpu__TaskShare {
+    std::atomic<uint64_t> range;
+    char padding[64 - sizeof(std::atomic<uint64_t>)]; // one per cache line
+};
+
+inline uint64_t lebcpu__PackTaskRange(uint32_t begin, uint32_t end)
+{
+    return (uint64_t)begin << 32u | end;
+}
+
+// runs kernel(taskID) for every task of [0, taskCount), for tasks of uneven
+// cost. Each thread starts with a contiguous share of the tasks, which it
+// consumes from the front; once its share is exhausted, it steals the back
+// half of the share of another thread. Consuming and stealing are both a
+// single compare-and-swap.
+inline void
+lebcpu_ParallelForStealing(
+    lebcpu_ThreadPool *pool,
+    uint32_t taskCount,
+    const std::function<void(uint32_t)> &kernel
+) {
+    const int threadCount = lebcpu_ThreadCount(pool);
+
+    if (threadCount == 1 || taskCount <= 1u) {
+        for (uint32_t taskID = 0u; taskID < taskCount; ++taskID)
+            kernel(taskID);
+        return;
+    }
+
+    std::vector<lebcpu__TaskShare> shares(threadCount);
+
+    for (int i = 0; i < threadCount; ++i) {
+        uint32_t begin = (uint32_t)((uint64_t)taskCount * i / threadCount);
+        uint32_t end = (uint32_t)((uint64_t)taskCount * (i + 1) / threadCount);
+
+        shares[i].range = lebcpu__PackTaskRange(begin, end);
+    }
+
+    lebcpu_Execute(pool, [&](int threadID) {
+        std::atomic<uint64_t> &share = shares[threadID].range;
+
+        for (;;) {
+            uint64_t range = share.load();
+            bool stolen = false;
+
+            // consume the own share
+            while ((uint32_t)(range >> 32u) < (uint32_t)range) {
+                uint32_t begin = (uint32_t)(range >> 32u);
+
+                if (share.compare_exchange_weak(
+                        range, lebcpu__PackTaskRange(begin + 1u, (uint32_t)range))) {
+                    kernel(begin);
+                    range = share.load();
+                }
+            }
+
+            // steal the back half of another share; the stolen tasks are
+            // owned by this thread until published in its own share, which
+            // other threads find empty in the meantime
+            for (int i = 1; i < threadCount && !stolen; ++i) {
+                std::atomic<uint64_t> &victim = shares[(threadID + i) % threadCount].range;
+                uint64_t victimRange = victim.load();
+
+                while ((uint32_t)(victimRange >> 32u) < (uint32_t)victimRange) {
+                    uint32_t begin = (uint32_t)(victimRange >> 32u);
+                    uint32_t end = (uint32_t)victimRange;
+                    uint32_t mid = begin + (end - begin) / 2u;
+
+                    if (victim.compare_exchange_weak(
+                            victimRange, lebcpu__PackTaskRange(begin, mid))) {
+                        share = lebcpu__PackTaskRange(mid, end);
+                        stolen = true;
+                        break;
+                    }
+                }
+            }
+
+            // tasks are never created, so all shares stay empty from now on
+            if (!stolen)
+                break;
+        }
+    });
+}
+
+// *****************************************************************************
+// Atomic Bit Operations
+
+inline uint32_t lebcpu__LoadWord(const uint32_t *word)
+{
+#ifdef _MSC_VER
+    return *(const volatile uint32_t *)word;
+#else
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+#endif
+}
+
+inline uint32_t lebcpu__AtomicOr(uint32_t *word, uint32_t mask)
+{
+#ifdef _MSC_VER
+    return (uint32_t)_InterlockedOr((volatile long *)word, (long)mask);
+#else
+    return __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
+#endif
+}
+
+inline uint32_t lebcpu__AtomicAnd(uint32_t *word, uint32_t mask)
+{
+#ifdef _MSC_VER
+    return (uint32_t)_InterlockedAnd((volatile long *)word, (long)mask);
+#else
+    return __atomic_fetch_and(word, mask, __ATOMIC_RELAXED);
+#endif
+}
+
+inline uint32_t lebcpu__TrailingZeros32(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long bitID;
+
+    _BitScanForward(&bitID, x);
+
+    return (uint32_t)bitID;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+inline uint32_t lebcpu__TrailingZeros64(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long bitID;
+
+    _BitScanForward64(&bitID, x);
+
+    return (uint32_t)bitID;
+#elif defined(_MSC_VER)
+    return (uint32_t)x ? lebcpu__TrailingZeros32((uint32_t)x)
+                       : 32u + lebcpu__TrailingZeros32((uint32_t)(x >> 32));
+#else
+    return (uint32_t)__builtin_ctzll(x);
+#endif
+}
+
+inline uint32_t lebcpu__Popcount64(uint64_t x)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    return (uint32_t)__popcnt64(x);
+#elif defined(_MSC_VER)
+    return (uint32_t)(__popcnt((uint32_t)x) + __popcnt((uint32_t)(x >> 32)));
+#else
+    return (uint32_t)__builtin_popcountll(x);
+#endif
+}
+
+
+// *****************************************************************************
+// 4-wide Float Vectors
+//
+// Thin wrappers over SSE2 and AArch64 NEON, with a scalar fallback; batched
+// routines process LEBCPU_BATCH_SIZE lanes as two vectors.
+
+#if defined(LEBCPU_SIMD_SSE2)
+typedef __m128 lebcpu__f32x4;
+typedef __m128 lebcpu__m32x4;
+
+inline lebcpu__f32x4 lebcpu__Load(const float *x) {return _mm_loadu_ps(x);}
+inline void lebcpu__Store(float *x, lebcpu__f32x4 a) {_mm_storeu_ps(x, a);}
+inline lebcpu__f32x4 lebcpu__Set1(float x) {return _mm_set1_ps(x);}
+inline lebcpu__f32x4 lebcpu__Add(lebcpu__f32x4 a, lebcpu__f32x4 b) {return _mm_add_ps(a, b);}
+inline lebcpu__f32x4 lebcpu__Sub(lebcpu__f32x4 a, lebcpu__f32x4 b) {return _mm_sub_ps(a, b);}
+inline lebcpu__f32x4 lebcpu__Mul(lebcpu__f32x4 a, lebcpu__f32x4 b) {return _mm_mul_ps(a, b);}
+inline lebcpu__f32x4 lebcpu__Div(lebcpu__f32x4 a, lebcpu__f32x4 b) {return _mm_div_ps(a, b);}
+inline lebcpu__f32x4 lebcpu__Min(lebcpu__f32x4 a, lebcpu__f32x4 b) {return _mm_min_ps(a, b);}
+inline lebcpu__f32x4 lebcpu__Max(lebcpu__f32x4 a, lebcpu__f32x4 b) {return _mm_max_ps(a, b);}
+inline lebcpu__m32x4 lebcpu__LessEqual(lebcpu__f32x4 a, lebcpu__f32x4 b) {return _mm_cmple_ps(a, b);}
+inline lebcpu__m32x4 lebcpu__And(lebcpu__m32x4 a, lebcpu__m32x4 b) {return _mm_and_ps(a, b);}
+inline lebcpu__m32x4 lebcpu__Or(lebcpu__m32x4 a, lebcpu__m32x4 b) {return _mm_or_ps(a, b);}
+inline uint32_t lebcpu__MoveMask(lebcpu__m32x4 a) {return (uint32_t)_mm_movemask_ps(a);}
+inline lebcpu__f32x4 lebcpu__Select(lebcpu__m32x4 m, lebcpu__f32x4 a, lebcpu__f32x4 b)
+{
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+typedef __m128i lebcpu__u32x4;
+
+inline lebcpu__u32x4 lebcpu__LoadU32(const uint32_t *x) {return _mm_loadu_si128((const __m128i *)x);}
+inline lebcpu__m32x4 lebcpu__TestBit(lebcpu__u32x4 a, int bitID)
+{
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i bit = _mm_and_si128(_mm_srl_epi32(a, _mm_cvtsi32_si128(bitID)), one);
+
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(bit, one));
+}
+inline lebcpu__m32x4 lebcpu__Greater(lebcpu__u32x4 a, int b)
+{
+    return _mm_castsi128_ps(_mm_cmpgt_epi32(a, _mm_set1_epi32(b)));
+}
+inline lebcpu__m32x4 lebcpu__Equal(lebcpu__u32x4 a, int b)
+{
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(a, _mm_set1_epi32(b)));
+}
+#elif defined(LEBCPU_SIMD_NEON)
+typedef float32x4_t lebcpu__f32x4;
+typedef uint32x4_t lebcpu__m32x4;
+
+inline lebcpu__f32x4 lebcpu__Load(const float *x) {return vld1q_f32(x);}
+inline void lebcpu__Store(float *x, lebcpu__f32x4 a) {vst1q_f32(x, a);}
+inline lebcpu__f32x4 lebcpu__Set1(float x) {return vdupq_n_f32(x);}
+inline lebcpu__f32x4 lebcpu__Add(lebcpu__f32x4 a, lebcpu__f32x4 b) {return vaddq_f32(a, b);}
+inline lebcpu__f32x4 lebcpu__Sub(lebcpu__f32x4 a, lebcpu__f32x4 b) {return vsubq_f32(a, b);}
+inline lebcpu__f32x4 lebcpu__Mul(lebcpu__f32x4 a, lebcpu__f32x4 b) {return vmulq_f32(a, b);}
+inline lebcpu__f32x4 lebcpu__Div(lebcpu__f32x4 a, lebcpu__f32x4 b) {return vdivq_f32(a, b);}
+inline lebcpu__f32x4 lebcpu__Min(lebcpu__f32x4 a, lebcpu__f32x4 b) {return vminq_f32(a, b);}
+inline lebcpu__f32x4 lebcpu__Max(lebcpu__f32x4 a, lebcpu__f32x4 b) {return vmaxq_f32(a, b);}
+inline lebcpu__m32x4 lebcpu__LessEqual(lebcpu__f32x4 a, lebcpu__f32x4 b) {return vcleq_f32(a, b);}
+inline lebcpu__m32x4 lebcpu__And(lebcpu__m32x4 a, lebcpu__m32x4 b) {return vandq_u32(a, b);}
+inline lebcpu__m32x4 lebcpu__Or(lebcpu__m32x4 a, lebcpu__m32x4 b) {return vorrq_u32(a, b);}
+inline uint32_t lebcpu__MoveMask(lebcpu__m32x4 a)
+{
+    const uint32_t bits[4] = {1u, 2u, 4u, 8u};
+
+    return vaddvq_u32(vandq_u32(a, vld1q_u32(bits)));
+}
+inline lebcpu__f32x4 lebcpu__Select(lebcpu__m32x4 m, lebcpu__f32x4 a, lebcpu__f32x4 b)
+{
+    return vbslq_f32(m, a, b);
+}
+
+typedef uint32x4_t lebcpu__u32x4;
+
+inline lebcpu__u32x4 lebcpu__LoadU32(const uint32_t *x) {return vld1q_u32(x);}
+inline lebcpu__m32x4 lebcpu__TestBit(lebcpu__u32x4 a, int bitID)
+{
+    return vtstq_u32(vshlq_u32(a, vdupq_n_s32(-bitID)), vdupq_n_u32(1u));
+}
+inline lebcpu__m32x4 lebcpu__Greater(lebcpu__u32x4 a, int b)
+{
+    return vcgtq_u32(a, vdupq_n_u32((uint32_t)b));
+}
+inline lebcpu__m32x4 lebcpu__Equal(lebcpu__u32x4 a, int b)
+{
+    return vceqq_u32(a, vdupq_n_u32((uint32_t)b));
+}
+#else
+struct lebcpu__f32x4 {float v[4];};
+typedef lebcpu__f32x4 lebcpu__m32x4; // lanes hold 0 or 1
+
+#define LEBCPU__MAP(expr) \
+    lebcpu__f32x4 c; for (int i = 0; i < 4; ++i) c.v[i] = (expr); return c;
+inline lebcpu__f32x4 lebcpu__Load(const float *x) {LEBCPU__MAP(x[i])}
+inline void lebcpu__Store(float *x, lebcpu__f32x4 a) {for (int i = 0; i < 4; ++i) x[i] = a.v[i];}
+inline lebcpu__f32x4 lebcpu__Set1(float x) {LEBCPU__MAP(x)}
+inline lebcpu__f32x4 lebcpu__Add(lebcpu__f32x4 a, lebcpu__f32x4 b) {LEBCPU__MAP(a.v[i] + b.v[i])}
+inline lebcpu__f32x4 lebcpu__Sub(lebcpu__f32x4 a, lebcpu__f32x4 b) {LEBCPU__MAP(a.v[i] - b.v[i])}
+inline lebcpu__f32x4 lebcpu__Mul(lebcpu__f32x4 a, lebcpu__f32x4 b) {LEBCPU__MAP(a.v[i] * b.v[i])}
+inline lebcpu__f32x4 lebcpu__Div(lebcpu__f32x4 a, lebcpu__f32x4 b) {LEBCPU__MAP(a.v[i] / b.v[i])}
+inline lebcpu__f32x4 lebcpu__Min(lebcpu__f32x4 a, lebcpu__f32x4 b) {LEBCPU__MAP(std::min(a.v[i], b.v[i]))}
+inline lebcpu__f32x4 lebcpu__Max(lebcpu__f32x4 a, lebcpu__f32x4 b) {LEBCPU__MAP(std::max(a.v[i], b.v[i]))}
+inline lebcpu__m32x4 lebcpu__LessEqual(lebcpu__f32x4 a, lebcpu__f32x4 b) {LEBCPU__MAP(a.v[i] <= b.v[i] ? 1.0f : 0.0f)}
+inline lebcpu__m32x4 lebcpu__And(lebcpu__m32x4 a, lebcpu__m32x4 b) {LEBCPU__MAP(a.v[i] * b.v[i])}
+inline lebcpu__m32x4 lebcpu__Or(lebcpu__m32x4 a, lebcpu__m32x4 b) {LEBCPU__MAP(std::max(a.v[i], b.v[i]))}
+inline uint32_t lebcpu__MoveMask(lebcpu__m32x4 a)
+{
+    uint32_t mask = 0u;
+
+    for (int i = 0; i < 4; ++i)
+        mask|= (a.v[i] != 0.0f ? 1u : 0u) << i;
+
+    return mask;
+}
+inline lebcpu__f32x4 lebcpu__Select(lebcpu__m32x4 m, lebcpu__f32x4 a, lebcpu__f32x4 b)
+{
+    LEBCPU__MAP(m.v[i] != 0.0f ? a.v[i] : b.v[i])
+}
+
+struct lebcpu__u32x4 {uint32_t v[4];};
+
+inline lebcpu__u32x4 lebcpu__LoadU32(const uint32_t *x)
+{
+    lebcpu__u32x4 c;
+
+    for (int i = 0; i < 4; ++i)
+        c.v[i] = x[i];
+
+    return c;
+}
+inline lebcpu__m32x4 lebcpu__TestBit(lebcpu__u32x4 a, int bitID) {LEBCPU__MAP((float)((a.v[i] >> bitID) & 1u))}
+inline lebcpu__m32x4 lebcpu__Greater(lebcpu__u32x4 a, int b) {LEBCPU__MAP(a.v[i] > (uint32_t)b ? 1.0f : 0.0f)}
+inline lebcpu__m32x4 lebcpu__Equal(lebcpu__u32x4 a, int b) {LEBCPU__MAP(a.v[i] == (uint32_t)b ? 1.0f : 0.0f)}
+#undef LEBCPU__MAP
+#endif
+
+
+// *****************************************************************************
+// Dirty Mask
+//
+// Records which 64-bit words of the leaf bitfield were modified, one bit per
+// word, so that the sum reduction can be updated incrementally. A summary
+// level with one bit per 32-bit word of the mask keeps scans proportional to
+// the number of modified words.
+
+struct lebcpu_DirtyMask {
+    std::vector<uint32_t> bits, summary;
+    int maxDepth;
+};
+
+inline lebcpu_DirtyMask *lebcpu_CreateDirtyMask(const leb_Heap *leb)
+{
+    lebcpu_DirtyMask *mask = new lebcpu_DirtyMask;
+    uint32_t leafWordCount = std::max(1u, (1u << leb->maxDepth) >> 6u);
+    uint32_t maskWordCount = (leafWordCount + 31u) >> 5u;
+
+    mask->bits.resize(maskWordCount, 0u);
+    mask->summary.resize((maskWordCount + 31u) >> 5u, 0u);
+    mask->maxDepth = leb->maxDepth;
+
+    return mask;
+}
+
+inline void lebcpu_ReleaseDirtyMask(lebcpu_DirtyMask *mask)
+{
+    delete mask;
+}
+
+inline void lebcpu_ClearDirtyMask(lebcpu_DirtyMask *mask)
+{
+    std::fill(mask->bits.begin(), mask->bits.end(), 0u);
+    std::fill(mask->summary.begin(), mask->summary.end(), 0u);
+}
+
+// flags the leaf word holding a bit of the leaf bitfield
+inline void lebcpu__MarkDirty(lebcpu_DirtyMask *mask, uint32_t leafBitID)
+{
+    uint32_t leafWordID = (leafBitID - (3u << mask->maxDepth)) >> 6u;
+    uint32_t maskWordID = leafWordID >> 5u;
+    uint32_t *word = &mask->bits[maskWordID];
+    uint32_t bit = 1u << (leafWordID & 31u);
+
+    if (!(lebcpu__LoadWord(word) & bit) && !lebcpu__AtomicOr(word, bit)) {
+        lebcpu__AtomicOr(&mask->summary[maskWordID >> 5u],
+                         1u << (maskWordID & 31u));
+    }
+}
+
+
+// *****************************************************************************
+// Heap Deltas
+//
+// Ranges of 32-bit heap words written since the delta was last cleared, so
+// that a copy of the heap, e.g., on the GPU, can be patched rather than
+// re-uploaded. Ranges accumulate across updates; lebcpu_CoalesceHeapDelta
+// sorts them and merges the ones that are less than a given number of words
+// apart, which trades a few redundant words for fewer uploads.
+
+struct lebcpu_WordRange {
+    uint32_t begin, end;    // [begin, end) in 32-bit words
+};
+
+struct lebcpu_HeapDelta {
+    std::vector<lebcpu_WordRange> ranges;
+};
+
+inline void lebcpu_ClearHeapDelta(lebcpu_HeapDelta *delta)
+{
+    delta->ranges.clear();
+}
+
+// flags the whole heap
+inline void lebcpu_FillHeapDelta(lebcpu_HeapDelta *delta, const leb_Heap *leb)
+{
+    lebcpu_WordRange range = {0u, leb__HeapByteSize(leb->maxDepth) >> 2u};
+
+    delta->ranges.assign(1, range);
+}
+
+// flags the words overlapping bits [bitID, bitID + bitCount)
+inline void
+lebcpu__AppendHeapDelta(lebcpu_HeapDelta *delta, uint32_t bitID, uint32_t bitCount)
+{
+    lebcpu_WordRange range = {bitID >> 5u, ((bitID + bitCount - 1u) >> 5u) + 1u};
+
+    delta->ranges.push_back(range);
+}
+
+inline void lebcpu_CoalesceHeapDelta(lebcpu_HeapDelta *delta, uint32_t maxGap)
+{
+    std::vector<lebcpu_WordRange> &ranges = delta->ranges;
+    size_t n = 0;
+
+    std::sort(ranges.begin(), ranges.end(),
+              [](const lebcpu_WordRange &a, const lebcpu_WordRange &b) {
+        return a.begin < b.begin;
+    });
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (n > 0 && ranges[i].begin <= ranges[n - 1].end + maxGap)
+            ranges[n - 1].end = std::max(ranges[n - 1].end, ranges[i].end);
+        else
+            ranges[n++] = ranges[i];
+    }
+    ranges.resize(n);
+}
+
+// returns the number of words covered by the ranges, once coalesced
+inline uint32_t lebcpu_HeapDeltaWordCount(const lebcpu_HeapDelta *delta)
+{
+    uint32_t wordCount = 0u;
+
+    for (size_t i = 0; i < delta->ranges.size(); ++i)
+        wordCount+= delta->ranges[i].end - delta->ranges[i].begin;
+
+    return wordCount;
+}
+
+
+// *****************************************************************************
+// Published Heaps
+//
+// Two copies of a leb_Heap that let threads read a consistent subdivision
+// while another thread updates it. The writer copies its heap into the copy
+// that is not current and then increments the epoch, whose parity designates
+// the current copy. Readers register on the current copy through its reader
+// count and never wait: if the epoch changed while they registered, they
+// retry on the new copy. In turn, the writer never overwrites a copy that
+// still has readers; the publication is deferred instead, and the words it
+// would have copied accumulate until the next one succeeds. Only the words
+// modified since a copy was last written are copied.
+
+#ifndef LEBCPU_PUBLISH_MAX_RANGES
+#   define LEBCPU_PUBLISH_MAX_RANGES 4096u
+#endif
+
+struct lebcpu_PublishedHeap {
+    leb_Heap *heaps[2];                     // heaps[epoch & 1] is current
+    std::atomic<uint32_t> epoch;            // number of publications
+    std::atomic<uint32_t> readerCounts[2];
+    lebcpu_HeapDelta pending[2];            // words to copy into each heap
+    // statistics of the writer
+    uint32_t publishCount, deferredCount;
+    uint64_t copiedWordCount;
+};
+
+// a copy acquired by a reader; heap is NULL before the first publication
+struct lebcpu_HeapView {
+    const leb_Heap *heap;
+    uint32_t epoch;
+};
+
+inline lebcpu_PublishedHeap *lebcpu_CreatePublishedHeap()
+{
+    lebcpu_PublishedHeap *published = new lebcpu_PublishedHeap;
+
+    for (int i = 0; i < 2; ++i) {
+        published->heaps[i] = NULL;
+        published->readerCounts[i] = 0u;
+    }
+    published->epoch = 0u;
+    published->publishCount = published->deferredCount = 0u;
+    published->copiedWordCount = 0u;
+
+    return published;
+}
+
+// must not be called while readers hold a view
+inline void lebcpu_ReleasePublishedHeap(lebcpu_PublishedHeap *published)
+{
+    for (int i = 0; i < 2; ++i)
+        if (published->heaps[i])
+            leb_Release(published->heaps[i]);
+
+    delete published;
+}
+
+// returns the current copy; it remains valid, and unchanged, until released
+inline lebcpu_HeapView lebcpu_AcquireHeap(lebcpu_PublishedHeap *published)
+{
+    for (;;) {
+        uint32_t epoch = published->epoch.load();
+        std::atomic<uint32_t> &readerCount = published->readerCounts[epoch & 1u];
+
+        readerCount.fetch_add(1u);
+
+        // the writer may have started to overwrite the copy in the meantime
+        if (published->epoch.load() == epoch) {
+            lebcpu_HeapView view = {published->heaps[epoch & 1u], epoch};
+
+            return view;
+        }
+
+        readerCount.fetch_sub(1u);
+    }
+}
+
+inline void
+lebcpu_ReleaseHeap(lebcpu_PublishedHeap *published, const lebcpu_HeapView &view)
+{
+    published->readerCounts[view.epoch & 1u].fetch_sub(1u);
+}
+
+// makes a copy of leb current; delta holds the words of leb modified since
+// the previous call. Returns false, without waiting, if readers still hold
+// the copy to overwrite, in which case the words of delta are copied by the
+// next successful call. A change of depth reallocates the copies. Must be
+// called by a single thread.
+inline bool
+lebcpu_PublishHeap(
+    lebcpu_PublishedHeap *published,
+    const leb_Heap *leb,
+    const lebcpu_HeapDelta *delta,
+    lebcpu_ThreadPool *pool = NULL
+) {
+    const uint32_t epoch = published->epoch.load(std::memory_order_relaxed);
+    const uint32_t slot = (epoch + 1u) & 1u;
+    leb_Heap *&heap = published->heaps[slot];
+    std::vector<lebcpu_WordRange> chunks;
+
+    for (int i = 0; i < 2; ++i) {
+        lebcpu_HeapDelta *pending = &published->pending[i];
+
+        pending->ranges.insert(pending->ranges.end(),
+                               delta->ranges.begin(), delta->ranges.end());
+        if (pending->ranges.size() > LEBCPU_PUBLISH_MAX_RANGES)
+            lebcpu_CoalesceHeapDelta(pending, 16u);
+    }
+
+    if (published->readerCounts[slot].load() > 0u) {
+        ++published->deferredCount;
+
+        return false;
+    }
+
+    if (!heap || heap->minDepth != leb->minDepth
+        || heap->maxDepth != leb->maxDepth) {
+        if (heap)
+            leb_Release(heap);
+        heap = leb_CreateMinMax(leb->minDepth, leb->maxDepth);
+        lebcpu_FillHeapDelta(&published->pending[slot], leb);
+    }
+
+    // copy in chunks of at most 64Ki words
+    lebcpu_CoalesceHeapDelta(&published->pending[slot], 0u);
+    for (size_t i = 0; i < published->pending[slot].ranges.size(); ++i) {
+        const lebcpu_WordRange range = published->pending[slot].ranges[i];
+
+        for (uint32_t begin = range.begin; begin < range.end; begin+= 1u << 16) {
+            lebcpu_WordRange chunk = {begin, std::min(begin + (1u << 16), range.end)};
+
+            chunks.push_back(chunk);
+            published->copiedWordCount+= chunk.end - chunk.begin;
+        }
+    }
+    lebcpu_ParallelFor(pool, (uint32_t)chunks.size(), 1u,
+                       [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            memcpy(&heap->buffer[chunks[i].begin], &leb->buffer[chunks[i].begin],
+                   sizeof(uint32_t) * (chunks[i].end - chunks[i].begin));
+        }
+    });
+    lebcpu_ClearHeapDelta(&published->pending[slot]);
+
+    ++published->publishCount;
+    published->epoch.store(epoch + 1u);
+
+    return true;
+}
+
+// *****************************************************************************
+// Heap Accessors
+
+inline leb_Node lebcpu__CreateNode(uint32_t id, int depth)
+{
+    leb_Node node = {id, depth};
+
+    return node;
+}
+
+inline uint32_t lebcpu__NodeBitID(const leb_Heap *leb, const leb_Node node)
+{
+    uint32_t tmp1 = 2u << node.depth;
+    uint32_t tmp2 = (uint32_t)(1 + leb->maxDepth - node.depth);
+
+    return tmp1 + node.id * tmp2;
+}
+
+inline uint32_t lebcpu__NodeBitSize(const leb_Heap *leb, const leb_Node node)
+{
+    return (uint32_t)(leb->maxDepth - node.depth + 1);
+}
+
+inline leb_Node lebcpu__CeilNode(const leb_Heap *leb, const leb_Node node)
+{
+    int depth = leb->maxDepth;
+
+    return lebcpu__CreateNode(node.id << (depth - node.depth), depth);
+}
+
+// reads a bitfield of at most 32 bits that may straddle two words
+inline uint32_t
+lebcpu__BitFieldRead(const uint32_t *buffer, uint32_t bitID, uint32_t bitCount)
+{
+    uint32_t wordID = bitID >> 5u;
+    uint32_t bitOffset = bitID & 31u;
+    uint64_t bits = lebcpu__LoadWord(&buffer[wordID]);
+
+    if (bitOffset + bitCount > 32u)
+        bits|= (uint64_t)lebcpu__LoadWord(&buffer[wordID + 1u]) << 32u;
+
+    return (uint32_t)((bits >> bitOffset) & ((1ull << bitCount) - 1ull));
+}
+
+// non-atomic write; callers must own the words they touch
+inline void
+lebcpu__BitFieldWrite(
+    uint32_t *buffer,
+    uint32_t bitID,
+    uint32_t bitCount,
+    uint32_t value
+) {
+    uint32_t wordID = bitID >> 5u;
+    uint32_t bitOffset = bitID & 31u;
+    uint64_t mask = ((1ull << bitCount) - 1ull) << bitOffset;
+    uint64_t bits = ((uint64_t)value << bitOffset) & mask;
+
+    buffer[wordID] = (buffer[wordID] & ~(uint32_t)mask) | (uint32_t)bits;
+    if (bitOffset + bitCount > 32u) {
+        uint32_t *next = &buffer[wordID + 1u];
+
+        *next = (*next & ~(uint32_t)(mask >> 32u)) | (uint32_t)(bits >> 32u);
+    }
+}
+
+inline uint32_t lebcpu__HeapRead(const leb_Heap *leb, const leb_Node node)
+{
+    return lebcpu__BitFieldRead(leb->buffer,
+                                lebcpu__NodeBitID(leb, node),
+                                lebcpu__NodeBitSize(leb, node));
+}
+
+inline void
+lebcpu__HeapWrite(leb_Heap *leb, const leb_Node node, uint32_t value)
+{
+    lebcpu__BitFieldWrite(leb->buffer,
+                          lebcpu__NodeBitID(leb, node),
+                          lebcpu__NodeBitSize(leb, node),
+                          value);
+}
+
+// atomically sets the bit of the ceil node of a node; returns true if the
+// bit was clear
+inline bool
+lebcpu__HeapSetBit(leb_Heap *leb, const leb_Node node, lebcpu_DirtyMask *mask)
+{
+    uint32_t bitID = lebcpu__NodeBitID(leb, lebcpu__CeilNode(leb, node));
+    uint32_t bit = 1u << (bitID & 31u);
+    uint32_t word = lebcpu__AtomicOr(&leb->buffer[bitID >> 5u], bit);
+
+    if (word & bit)
+        return false;
+    if (mask)
+        lebcpu__MarkDirty(mask, bitID);
+
+    return true;
+}
+
+// atomically clears the bit of the ceil node of a node; returns true if the
+// bit was set
+inline bool
+lebcpu__HeapClearBit(leb_Heap *leb, const leb_Node node, lebcpu_DirtyMask *mask)
+{
+    uint32_t bitID = lebcpu__NodeBitID(leb, lebcpu__CeilNode(leb, node));
+    uint32_t bit = 1u << (bitID & 31u);
+    uint32_t word = lebcpu__AtomicAnd(&leb->buffer[bitID >> 5u], ~bit);
+
+    if (!(word & bit))
+        return false;
+    if (mask)
+        lebcpu__MarkDirty(mask, bitID);
+
+    return true;
+}
+
+inline uint32_t lebcpu_NodeCount(const leb_Heap *leb)
+{
+    return lebcpu__HeapRead(leb, lebcpu__CreateNode(1u, 0));
+}
+
+inline bool lebcpu_IsLeafNode(const leb_Heap *leb, const leb_Node node)
+{
+    return lebcpu__HeapRead(leb, node) == 1u;
+}
+
+// same as leb_DecodeNode, except that all heap reads are atomic
+inline leb_Node lebcpu_DecodeNode(const leb_Heap *leb, uint32_t handle)
+{
+    leb_Node node = lebcpu__CreateNode(1u, 0);
+
+    while (lebcpu__HeapRead(leb, node) > 1u) {
+        leb_Node leftChild = lebcpu__CreateNode(node.id << 1u, node.depth + 1);
+        uint32_t cmp = lebcpu__HeapRead(leb, leftChild);
+        uint32_t b = handle < cmp ? 0u : 1u;
+
+        node = lebcpu__CreateNode(node.id << 1u | b, node.depth + 1);
+        handle-= cmp * b;
+    }
+
+    return node;
+}
+
+
+// *****************************************************************************
+// Leaf Iterator
+//
+// Every leaf of depth d owns the 2^(maxDepth - d) leaf positions spanned by
+// its subtree, and its split bit is the first of them. Leaves are thus
+// enumerated in order by scanning set bits, and the depth of a leaf follows
+// from the distance to the next set bit. The bits are recovered from the 2-bit
+// sums of depth maxDepth - 1 rather than from the leaf bitfield, which split
+// and merge passes modify while they iterate; like leb_DecodeNode, iterators
+// therefore require an up-to-date sum reduction. Runs of empty words are
+// skipped with the popcounts of depth maxDepth - 6.
+
+struct lebcpu_LeafIterator {
+    const leb_Heap *leb;
+    uint64_t bits;      // unvisited set bits of the current word
+    uint32_t wordID;    // current word
+    uint32_t bitID;     // leaf position of the current leaf
+    uint32_t nextBitID; // leaf position of the next leaf
+    leb_Node node;      // current leaf
+};
+
+inline uint32_t lebcpu__LeafWordCount(const leb_Heap *leb)
+{
+    return std::max(1u, (1u << leb->maxDepth) >> 6u);
+}
+
+// returns the leaf bits of a 64-leaf word
+inline uint64_t lebcpu__LoadSplitWord(const leb_Heap *leb, uint32_t wordID)
+{
+    const int depth = leb->maxDepth;
+    const uint64_t m1 = 0x5555555555555555ull;
+    uint64_t x;
+
+    if (depth == 0)
+        return 1u;
+
+    if (depth >= 6) {
+        const uint32_t *words = &leb->buffer[(2u << depth) >> 5u];
+
+        x = (uint64_t)words[2u * wordID]
+          | (uint64_t)words[2u * wordID + 1u] << 32u;
+    } else {
+        x = lebcpu__BitFieldRead(leb->buffer, 2u << depth, 1u << depth);
+    }
+
+    // a 2-bit sum of 1 flags the left leaf, a sum of 2 flags both leaves
+    return ((x | (x >> 1u)) & m1) | ((x & ~m1));
+}
+
+// returns the first word after wordID holding a set bit
+inline uint32_t lebcpu__NextLeafWord(const leb_Heap *leb, uint32_t wordID)
+{
+    const int depth = leb->maxDepth - 6;
+
+    if (wordID + 1u >= lebcpu__LeafWordCount(leb))
+        return lebcpu__LeafWordCount(leb);
+
+    leb_Node node = lebcpu__CreateNode((1u << depth) + wordID + 1u, depth);
+
+    while (lebcpu__HeapRead(leb, node) == 0u) {
+        while (node.id & 1u) {
+            if (node.id == 1u)
+                return lebcpu__LeafWordCount(leb);
+
+            node = lebcpu__CreateNode(node.id >> 1u, node.depth - 1);
+        }
+        ++node.id;
+    }
+
+    while (node.depth < depth) {
+        leb_Node leftChild = lebcpu__CreateNode(node.id << 1u, node.depth + 1);
+
+        node = lebcpu__HeapRead(leb, leftChild) > 0u
+             ? leftChild
+             : lebcpu__CreateNode(node.id << 1u | 1u, node.depth + 1);
+    }
+
+    return node.id - (1u << depth);
+}
+
+inline uint32_t lebcpu__NextLeafBitID(lebcpu_LeafIterator *it)
+{
+    if (it->bits == 0u) {
+        it->wordID = lebcpu__NextLeafWord(it->leb, it->wordID);
+
+        if (it->wordID == lebcpu__LeafWordCount(it->leb))
+            return 1u << it->leb->maxDepth;
+
+        it->bits = lebcpu__LoadSplitWord(it->leb, it->wordID);
+    }
+
+    uint32_t bitID = (it->wordID << 6u) + lebcpu__TrailingZeros64(it->bits);
+
+    it->bits&= it->bits - 1u;
+
+    return bitID;
+}
+
+inline void lebcpu__LeafIteratorUpdateNode(lebcpu_LeafIterator *it)
+{
+    const int maxDepth = it->leb->maxDepth;
+    uint32_t span = it->nextBitID - it->bitID;
+    uint32_t log2Span = lebcpu__TrailingZeros32(span);
+
+    it->node = lebcpu__CreateNode(((1u << maxDepth) + it->bitID) >> log2Span,
+                                  maxDepth - (int)log2Span);
+}
+
+// creates an iterator pointing to the leaf of the given handle
+inline lebcpu_LeafIterator
+lebcpu_CreateLeafIterator(const leb_Heap *leb, uint32_t handle)
+{
+    const int maxDepth = leb->maxDepth;
+    leb_Node node = lebcpu_DecodeNode(leb, handle);
+    lebcpu_LeafIterator it;
+
+    it.leb = leb;
+    it.bitID = (node.id << (maxDepth - node.depth)) - (1u << maxDepth);
+    it.wordID = it.bitID >> 6u;
+    it.bits = lebcpu__LoadSplitWord(leb, it.wordID)
+            & ((~0ull << (it.bitID & 63u)) << 1u);
+    it.nextBitID = lebcpu__NextLeafBitID(&it);
+    it.node = node;
+
+    return it;
+}
+
+// moves the iterator to the next leaf
+inline void lebcpu_LeafIteratorNext(lebcpu_LeafIterator *it)
+{
+    it->bitID = it->nextBitID;
+    it->nextBitID = lebcpu__NextLeafBitID(it);
+    lebcpu__LeafIteratorUpdateNode(it);
+}
+
+// calls f(handle, node) for every leaf of handle in [begin, end); works with
+// both leb_Heap and lebcpu_SparseHeap
+template <typename Heap, typename Function> inline void
+lebcpu_ForEachLeaf(
+    const Heap *leb,
+    uint32_t begin,
+    uint32_t end,
+    const Function &f
+) {
+    if (begin >= end)
+        return;
+
+    auto it = lebcpu_CreateLeafIterator(leb, begin);
+
+    for (uint32_t handle = begin;;) {
+        f(handle, it.node);
+
+        if (++handle == end)
+            break;
+
+        lebcpu_LeafIteratorNext(&it);
+    }
+}
+
+// *****************************************************************************
+// Sparse Heap
+//
+// A heap whose memory scales with the number of leaves rather than with
+// 2^maxDepth. The leaf bitfield is split into pages of 2^pageDepth positions
+// that are allocated when one of their bits gets set, and released by the sum
+// reduction once they are empty; pages are reached through a radix tree of
+// directories. Instead of the levels of the reduction, the sparse heap keeps
+// an ordered list of its pages along with the handle of their first leaf:
+// the sum of a node that spans several pages is the difference between two
+// such handles, and the sum of a node that fits in a page is a popcount.
+//
+// Each page stores its bits twice: split and merge passes modify the live
+// bits, while all reads go through the copy made by the last reduction. A
+// sparse heap thus behaves exactly like a leb_Heap whose reduction is only
+// recomputed after each pass. Depths are limited to 29.
+
+#ifndef LEBCPU_SPARSE_PAGE_DEPTH
+#   define LEBCPU_SPARSE_PAGE_DEPTH 9
+#endif
+
+#ifndef LEBCPU_SPARSE_DIRECTORY_DEPTH
+#   define LEBCPU_SPARSE_DIRECTORY_DEPTH 6
+#endif
+
+#define LEBCPU__SPARSE_PAGE_SIZE (1u << LEBCPU_SPARSE_PAGE_DEPTH)
+#define LEBCPU__SPARSE_DIRECTORY_SIZE (1u << LEBCPU_SPARSE_DIRECTORY_DEPTH)
+
+static_assert(LEBCPU_SPARSE_PAGE_DEPTH >= 6, "pages must hold 64-bit words");
+
+struct lebcpu__SparsePage {
+    uint32_t bits[LEBCPU__SPARSE_PAGE_SIZE / 32u];      // live bits
+    uint64_t leaves[LEBCPU__SPARSE_PAGE_SIZE / 64u];    // as of the last reduction
+};
+
+struct lebcpu__SparseDirectory {
+    std::atomic<void *> children[LEBCPU__SPARSE_DIRECTORY_SIZE];
+};
+
+struct lebcpu__SparsePageRef {
+    uint32_t pageID;
+    uint32_t firstHandle;       // handle of the first leaf of the page
+    const lebcpu__SparsePage *page;
+};
+
+struct lebcpu_SparseHeap {
+    std::atomic<void *> root;   // top directory, or the only page
+    std::atomic<uint32_t> pageCount, directoryCount;
+    std::vector<lebcpu__SparsePageRef> pages; // non-empty pages, in order
+    uint32_t nodeCount;
+    int minDepth, maxDepth;
+    int pageDepth;              // log2 of the number of positions per page
+    int directoryLevelCount;
+};
+
+// returns the page holding a leaf position, or NULL if it is not allocated
+inline const lebcpu__SparsePage *
+lebcpu__FindSparsePage(const lebcpu_SparseHeap *heap, uint32_t bitID)
+{
+    const uint32_t pageID = bitID >> heap->pageDepth;
+    const void *ptr = heap->root.load(std::memory_order_acquire);
+
+    for (int level = 0; ptr && level < heap->directoryLevelCount; ++level) {
+        int shift = LEBCPU_SPARSE_DIRECTORY_DEPTH
+                  * (heap->directoryLevelCount - level - 1);
+        uint32_t slot = (pageID >> shift) & (LEBCPU__SPARSE_DIRECTORY_SIZE - 1u);
+        const lebcpu__SparseDirectory *directory =
+            (const lebcpu__SparseDirectory *)ptr;
+
+        ptr = directory->children[slot].load(std::memory_order_acquire);
+    }
+
+    return (const lebcpu__SparsePage *)ptr;
+}
+
+// loads the child stored in a slot, allocating it if needed; when several
+// threads race for an empty slot, the first one to publish its child wins
+template <typename T> inline T *
+lebcpu__LoadOrCreateSparseChild(
+    std::atomic<void *> *slot,
+    std::atomic<uint32_t> *counter
+) {
+    void *ptr = slot->load(std::memory_order_acquire);
+
+    if (!ptr) {
+        T *child = new T();
+
+        if (slot->compare_exchange_strong(ptr, (void *)child,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+            counter->fetch_add(1u, std::memory_order_relaxed);
+            ptr = child;
+        } else {
+            delete child;
+        }
+    }
+
+    return (T *)ptr;
+}
+
+// atomically sets the bit of the ceil node of a node; returns true if the
+// bit was clear
+inline bool lebcpu__SparseSetBit(lebcpu_SparseHeap *heap, const leb_Node node)
+{
+    const uint32_t bitID = (node.id << (heap->maxDepth - node.depth))
+                         - (1u << heap->maxDepth);
+    const uint32_t pageID = bitID >> heap->pageDepth;
+    const uint32_t localBitID = bitID & ((1u << heap->pageDepth) - 1u);
+    std::atomic<void *> *slot = &heap->root;
+    lebcpu__SparsePage *page;
+
+    for (int level = 0; level < heap->directoryLevelCount; ++level) {
+        int shift = LEBCPU_SPARSE_DIRECTORY_DEPTH
+                  * (heap->directoryLevelCount - level - 1);
+        uint32_t slotID = (pageID >> shift) & (LEBCPU__SPARSE_DIRECTORY_SIZE - 1u);
+        lebcpu__SparseDirectory *directory =
+            lebcpu__LoadOrCreateSparseChild<lebcpu__SparseDirectory>(
+                slot, &heap->directoryCount
+            );
+
+        slot = &directory->children[slotID];
+    }
+
+    page = lebcpu__LoadOrCreateSparseChild<lebcpu__SparsePage>(
+        slot, &heap->pageCount
+    );
+    const uint32_t bit = 1u << (localBitID & 31u);
+
+    return !(lebcpu__AtomicOr(&page->bits[localBitID >> 5u], bit) & bit);
+}
+
+// atomically clears the bit of the ceil node of a node; returns true if the
+// bit was set
+inline bool lebcpu__SparseClearBit(lebcpu_SparseHeap *heap, const leb_Node node)
+{
+    const uint32_t bitID = (node.id << (heap->maxDepth - node.depth))
+                         - (1u << heap->maxDepth);
+    const uint32_t localBitID = bitID & ((1u << heap->pageDepth) - 1u);
+    lebcpu__SparsePage *page =
+        (lebcpu__SparsePage *)lebcpu__FindSparsePage(heap, bitID);
+
+    const uint32_t bit = 1u << (localBitID & 31u);
+
+    return page && (lebcpu__AtomicAnd(&page->bits[localBitID >> 5u], ~bit) & bit);
+}
+
+inline uint32_t lebcpu__SparsePageWordCount(const lebcpu_SparseHeap *heap)
+{
+    return std::max(1u, (1u << heap->pageDepth) >> 6u);
+}
+
+// snapshots the pages below a slot and releases the empty ones; returns false
+// if the slot ends up empty
+inline bool
+lebcpu__ReduceSparseSlot(
+    lebcpu_SparseHeap *heap,
+    std::atomic<void *> *slot,
+    int level,
+    uint32_t pageID,
+    uint32_t *changedPageCount
+) {
+    void *ptr = slot->load(std::memory_order_relaxed);
+
+    if (!ptr)
+        return false;
+
+    if (level == heap->directoryLevelCount) {
+        lebcpu__SparsePage *page = (lebcpu__SparsePage *)ptr;
+        uint32_t leafCount = 0u;
+        bool changed = false;
+
+        for (uint32_t i = 0; i < lebcpu__SparsePageWordCount(heap); ++i) {
+            uint64_t x = (uint64_t)page->bits[2u * i]
+                       | (uint64_t)page->bits[2u * i + 1u] << 32u;
+
+            changed = changed || x != page->leaves[i];
+            page->leaves[i] = x;
+            leafCount+= lebcpu__Popcount64(x);
+        }
+        *changedPageCount+= changed ? 1u : 0u;
+
+        if (leafCount == 0u) {
+            delete page;
+            slot->store(NULL, std::memory_order_relaxed);
+            heap->pageCount.fetch_sub(1u, std::memory_order_relaxed);
+
+            return false;
+        } else {
+            lebcpu__SparsePageRef ref = {pageID, heap->nodeCount, page};
+
+            heap->pages.push_back(ref);
+            heap->nodeCount+= leafCount;
+
+            return true;
+        }
+    } else {
+        lebcpu__SparseDirectory *directory = (lebcpu__SparseDirectory *)ptr;
+        bool isEmpty = true;
+
+        for (uint32_t i = 0; i < LEBCPU__SPARSE_DIRECTORY_SIZE; ++i) {
+            uint32_t childID = pageID << LEBCPU_SPARSE_DIRECTORY_DEPTH | i;
+
+            if (lebcpu__ReduceSparseSlot(heap, &directory->children[i],
+                                         level + 1, childID, changedPageCount))
+                isEmpty = false;
+        }
+
+        if (isEmpty) {
+            delete directory;
+            slot->store(NULL, std::memory_order_relaxed);
+            heap->directoryCount.fetch_sub(1u, std::memory_order_relaxed);
+        }
+
+        return !isEmpty;
+    }
+}
+
+// equivalent of leb_ComputeSumReduction; returns the number of pages whose
+// bits changed since the previous reduction. Must not run concurrently with
+// anything else on the heap.
+inline uint32_t lebcpu_ComputeSumReduction(lebcpu_SparseHeap *heap)
+{
+    uint32_t changedPageCount = 0u;
+
+    heap->pages.clear();
+    heap->nodeCount = 0u;
+    lebcpu__ReduceSparseSlot(heap, &heap->root, 0, 0u, &changedPageCount);
+
+    return changedPageCount;
+}
+
+// releases the pages and directories below a slot
+inline void
+lebcpu__ReleaseSparseSlot(
+    lebcpu_SparseHeap *heap,
+    std::atomic<void *> *slot,
+    int level
+) {
+    void *ptr = slot->load(std::memory_order_relaxed);
+
+    if (!ptr)
+        return;
+
+    if (level == heap->directoryLevelCount) {
+        delete (lebcpu__SparsePage *)ptr;
+        heap->pageCount.fetch_sub(1u, std::memory_order_relaxed);
+    } else {
+        lebcpu__SparseDirectory *directory = (lebcpu__SparseDirectory *)ptr;
+
+        for (uint32_t i = 0; i < LEBCPU__SPARSE_DIRECTORY_SIZE; ++i)
+            lebcpu__ReleaseSparseSlot(heap, &directory->children[i], level + 1);
+
+        delete directory;
+        heap->directoryCount.fetch_sub(1u, std::memory_order_relaxed);
+    }
+
+    slot->store(NULL, std::memory_order_relaxed);
+}
+
+// releases all pages and sets the leaves of minimum depth; the sum reduction
+// is left stale
+inline void lebcpu__ResetLeaves(lebcpu_SparseHeap *heap)
+{
+    const int depth = heap->minDepth;
+
+    lebcpu__ReleaseSparseSlot(heap, &heap->root, 0);
+
+    for (uint32_t id = 1u << depth; id < (2u << depth); ++id)
+        lebcpu__SparseSetBit(heap, lebcpu__CreateNode(id, depth));
+}
+
+// equivalent of leb_ResetToRoot
+inline void lebcpu_ResetSparseHeapToRoot(lebcpu_SparseHeap *heap)
+{
+    lebcpu__ResetLeaves(heap);
+    lebcpu_ComputeSumReduction(heap);
+}
+
+// equivalent of leb_CreateMinMax
+inline lebcpu_SparseHeap *lebcpu_CreateSparseHeap(int minDepth, int maxDepth)
+{
+    lebcpu_SparseHeap *heap = new lebcpu_SparseHeap;
+    int directoryDepth = std::max(0, maxDepth - LEBCPU_SPARSE_PAGE_DEPTH);
+
+    heap->root.store(NULL);
+    heap->pageCount.store(0u);
+    heap->directoryCount.store(0u);
+    heap->nodeCount = 0u;
+    heap->minDepth = minDepth;
+    heap->maxDepth = maxDepth;
+    heap->pageDepth = std::min(maxDepth, LEBCPU_SPARSE_PAGE_DEPTH);
+    heap->directoryLevelCount = (directoryDepth + LEBCPU_SPARSE_DIRECTORY_DEPTH - 1)
+                              / LEBCPU_SPARSE_DIRECTORY_DEPTH;
+    lebcpu_ResetSparseHeapToRoot(heap);
+
+    return heap;
+}
+
+inline void lebcpu_ReleaseSparseHeap(lebcpu_SparseHeap *heap)
+{
+    lebcpu__ReleaseSparseSlot(heap, &heap->root, 0);
+
+    delete heap;
+}
+
+// returns the number of bytes currently allocated by the heap
+inline size_t lebcpu_SparseHeapByteSize(const lebcpu_SparseHeap *heap)
+{
+    return sizeof(*heap)
+         + heap->pageCount.load() * sizeof(lebcpu__SparsePage)
+         + heap->directoryCount.load() * sizeof(lebcpu__SparseDirectory)
+         + heap->pages.capacity() * sizeof(lebcpu__SparsePageRef);
+}
+
+// returns the index of the first page whose ID is at least pageID
+inline size_t
+lebcpu__SparsePageLowerBound(const lebcpu_SparseHeap *heap, uint32_t pageID)
+{
+    size_t lo = 0, hi = heap->pages.size();
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) >> 1;
+
+        if (heap->pages[mid].pageID < pageID)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+inline uint32_t
+lebcpu__SparseFirstHandle(const lebcpu_SparseHeap *heap, size_t pageIndex)
+{
+    return pageIndex < heap->pages.size() ? heap->pages[pageIndex].firstHandle
+                                          : heap->nodeCount;
+}
+
+// same as lebcpu__HeapRead
+inline uint32_t lebcpu__HeapRead(const lebcpu_SparseHeap *heap, const leb_Node node)
+{
+    const int maxDepth = heap->maxDepth;
+    const uint32_t bitCount = 1u << (maxDepth - node.depth);
+    const uint32_t bitID = (node.id << (maxDepth - node.depth))
+                         - (1u << maxDepth);
+
+    if (bitCount >= (1u << heap->pageDepth)) {
+        uint32_t pageID = bitID >> heap->pageDepth;
+        uint32_t pageCount = bitCount >> heap->pageDepth;
+        size_t begin = lebcpu__SparsePageLowerBound(heap, pageID);
+        size_t end = lebcpu__SparsePageLowerBound(heap, pageID + pageCount);
+
+        return lebcpu__SparseFirstHandle(heap, end)
+             - lebcpu__SparseFirstHandle(heap, begin);
+    } else {
+        const lebcpu__SparsePage *page = lebcpu__FindSparsePage(heap, bitID);
+        uint32_t localBitID = bitID & ((1u << heap->pageDepth) - 1u);
+        uint32_t wordID = localBitID >> 6u;
+
+        if (!page)
+            return 0u;
+
+        if (bitCount < 64u) {
+            uint64_t x = page->leaves[wordID] >> (localBitID & 63u);
+
+            return lebcpu__Popcount64(x & ((1ull << bitCount) - 1ull));
+        } else {
+            uint32_t leafCount = 0u;
+
+            for (uint32_t i = 0; i < (bitCount >> 6u); ++i)
+                leafCount+= lebcpu__Popcount64(page->leaves[wordID + i]);
+
+            return leafCount;
+        }
+    }
+}
+
+inline uint32_t lebcpu_NodeCount(const lebcpu_SparseHeap *heap)
+{
+    return heap->nodeCount;
+}
+
+inline bool lebcpu_IsLeafNode(const lebcpu_SparseHeap *heap, const leb_Node node)
+{
+    return lebcpu__HeapRead(heap, node) == 1u;
+}
+
+// same as lebcpu_LeafIterator, over the pages of a sparse heap
+struct lebcpu_SparseLeafIterator {
+    const lebcpu_SparseHeap *heap;
+    uint64_t bits;      // unvisited set bits of the current word
+    size_t pageIndex;   // current page
+    uint32_t wordID;    // current word of the current page
+    uint32_t bitID;     // leaf position of the current leaf
+    uint32_t nextBitID; // leaf position of the next leaf
+    leb_Node node;      // current leaf
+};
+
+inline uint32_t lebcpu__NextLeafBitID(lebcpu_SparseLeafIterator *it)
+{
+    const lebcpu_SparseHeap *heap = it->heap;
+
+    while (it->bits == 0u) {
+        if (++it->wordID == lebcpu__SparsePageWordCount(heap)) {
+            if (++it->pageIndex == heap->pages.size())
+                return 1u << heap->maxDepth;
+
+            it->wordID = 0u;
+        }
+
+        it->bits = heap->pages[it->pageIndex].page->leaves[it->wordID];
+    }
+
+    uint32_t bitID = (heap->pages[it->pageIndex].pageID << heap->pageDepth)
+                   + (it->wordID << 6u) + lebcpu__TrailingZeros64(it->bits);
+
+    it->bits&= it->bits - 1u;
+
+    return bitID;
+}
+
+inline void lebcpu__LeafIteratorUpdateNode(lebcpu_SparseLeafIterator *it)
+{
+    const int maxDepth = it->heap->maxDepth;
+    uint32_t span = it->nextBitID - it->bitID;
+    uint32_t log2Span = lebcpu__TrailingZeros32(span);
+
+    it->node = lebcpu__CreateNode(((1u << maxDepth) + it->bitID) >> log2Span,
+                                  maxDepth - (int)log2Span);
+}
+
+// creates an iterator pointing to the leaf of the given handle
+inline lebcpu_SparseLeafIterator
+lebcpu_CreateLeafIterator(const lebcpu_SparseHeap *heap, uint32_t handle)
+{
+    size_t lo = 0, hi = heap->pages.size();
+    lebcpu_SparseLeafIterator it;
+
+    // last page whose first leaf precedes the handle
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) >> 1;
+
+        if (heap->pages[mid].firstHandle <= handle)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    const lebcpu__SparsePageRef &ref = heap->pages[lo];
+    uint32_t localHandle = handle - ref.firstHandle;
+    uint32_t wordID = 0u;
+    uint64_t x = ref.page->leaves[0];
+
+    for (uint32_t n; localHandle >= (n = lebcpu__Popcount64(x));) {
+        localHandle-= n;
+        x = ref.page->leaves[++wordID];
+    }
+    for (; localHandle > 0u; --localHandle)
+        x&= x - 1u;
+
+    it.heap = heap;
+    it.pageIndex = lo;
+    it.wordID = wordID;
+    it.bitID = (ref.pageID << heap->pageDepth) + (wordID << 6u)
+             + lebcpu__TrailingZeros64(x);
+    it.bits = x & (x - 1u);
+    it.nextBitID = lebcpu__NextLeafBitID(&it);
+    lebcpu__LeafIteratorUpdateNode(&it);
+
+    return it;
+}
+
+// moves the iterator to the next leaf
+inline void lebcpu_LeafIteratorNext(lebcpu_SparseLeafIterator *it)
+{
+    it->bitID = it->nextBitID;
+    it->nextBitID = lebcpu__NextLeafBitID(it);
+    lebcpu__LeafIteratorUpdateNode(it);
+}
+
+// same as leb_DecodeNode
+inline leb_Node lebcpu_DecodeNode(const lebcpu_SparseHeap *heap, uint32_t handle)
+{
+    return lebcpu_CreateLeafIterator(heap, handle).node;
+}
+
+
+// *****************************************************************************
+// Neighbor Decoding
+
+struct lebcpu_NeighborIDs {
+    uint32_t left, right, edge, node;
+};
+
+inline lebcpu_NeighborIDs
+lebcpu__SplitNodeIDs(const lebcpu_NeighborIDs nodeIDs, uint32_t splitBit)
+{
+    uint32_t n1 = nodeIDs.left, n2 = nodeIDs.right,
+             n3 = nodeIDs.edge, n4 = nodeIDs.node;
+    uint32_t b2 = (n2 == 0u) ? 0u : 1u,
+             b3 = (n3 == 0u) ? 0u : 1u;
+
+    if (splitBit == 0u) {
+        lebcpu_NeighborIDs ids = {n4 << 1 | 1, n3 << 1 | b3, n2 << 1 | b2, n4 << 1};
+
+        return ids;
+    } else {
+        lebcpu_NeighborIDs ids = {n3 << 1    , n4 << 1     , n1 << 1     , n4 << 1 | 1};
+
+        return ids;
+    }
+}
+
+inline lebcpu_NeighborIDs
+lebcpu_DecodeSameDepthNeighborIDs(const leb_Node node, lebcpu_Mode mode)
+{
+    int bitID = node.depth - 1;
+    lebcpu_NeighborIDs nodeIDs = {0u, 0u, 0u, 1u};
+
+    if (mode == LEBCPU_MODE_QUAD && node.depth > 0) {
+        uint32_t b = (node.id >> bitID) & 1u;
+        lebcpu_NeighborIDs quadIDs = {0u, 0u, 3u - b, 2u + b};
+
+        nodeIDs = quadIDs;
+        --bitID;
+    }
+
+    for (; bitID >= 0; --bitID)
+        nodeIDs = lebcpu__SplitNodeIDs(nodeIDs, (node.id >> bitID) & 1u);
+
+    return nodeIDs;
+}
+
+inline leb_Node lebcpu__EdgeNeighborNode(const leb_Node node, lebcpu_Mode mode)
+{
+    uint32_t edgeID = lebcpu_DecodeSameDepthNeighborIDs(node, mode).edge;
+
+    return lebcpu__CreateNode(edgeID, node.depth);
+}
+
+inline leb_DiamondParent
+lebcpu_DecodeDiamondParent(const leb_Node node, lebcpu_Mode mode)
+{
+    leb_Node parent = lebcpu__CreateNode(node.id >> 1u, node.depth - 1);
+    uint32_t edgeID = lebcpu_DecodeSameDepthNeighborIDs(parent, mode).edge;
+    leb_DiamondParent diamond = {
+        parent,
+        lebcpu__CreateNode(edgeID > 0u ? edgeID : parent.id, parent.depth)
+    };
+
+    return diamond;
+}
+
+
+// *****************************************************************************
+// Mode Policies
+//
+// Compile-time counterparts of lebcpu_Mode, which forward to the triangle or
+// quad entry points of LongestEdgeBisection.h. Routines templated on a policy
+// are instantiated once per mode and carry no per-node mode checks; their
+// lebcpu_Mode overloads dispatch to them once per call.
+
+struct lebcpu_TriangleMode {
+    static const lebcpu_Mode mode = LEBCPU_MODE_TRIANGLE;
+
+    static void SplitNodeConforming(leb_Heap *leb, const leb_Node node)
+    {
+        leb_SplitNodeConforming(leb, node);
+    }
+
+    static void
+    MergeNodeConforming(leb_Heap *leb, const leb_Node node,
+                        const leb_DiamondParent diamond)
+    {
+        leb_MergeNodeConforming(leb, node, diamond);
+    }
+
+    static leb_DiamondParent DecodeDiamondParent(const leb_Node node)
+    {
+        return leb_DecodeDiamondParent(node);
+    }
+
+    static void
+    DecodeNodeAttributeArray(const leb_Node node, int attributeArraySize,
+                             float attributeArray[][3])
+    {
+        leb_DecodeNodeAttributeArray(node, attributeArraySize, attributeArray);
+    }
+
+    static leb_Node BoundingNode(const leb_Heap *leb, float x, float y)
+    {
+        return leb_BoundingNode(leb, x, y);
+    }
+};
+
+struct lebcpu_QuadMode {
+    static const lebcpu_Mode mode = LEBCPU_MODE_QUAD;
+
+    static void SplitNodeConforming(leb_Heap *leb, const leb_Node node)
+    {
+        leb_SplitNodeConforming_Quad(leb, node);
+    }
+
+    static void
+    MergeNodeConforming(leb_Heap *leb, const leb_Node node,
+                        const leb_DiamondParent diamond)
+    {
+        leb_MergeNodeConforming_Quad(leb, node, diamond);
+    }
+
+    static leb_DiamondParent DecodeDiamondParent(const leb_Node node)
+    {
+        return leb_DecodeDiamondParent_Quad(node);
+    }
+
+    static void
+    DecodeNodeAttributeArray(const leb_Node node, int attributeArraySize,
+                             float attributeArray[][3])
+    {
+        leb_DecodeNodeAttributeArray_Quad(node, attributeArraySize, attributeArray);
+    }
+
+    static leb_Node BoundingNode(const leb_Heap *leb, float x, float y)
+    {
+        return leb_BoundingNode_Quad(leb, x, y);
+    }
+};
+
+// same as lebcpu_DecodeDiamondParent
+template <typename Mode> inline leb_DiamondParent
+lebcpu_DecodeDiamondParent(const leb_Node node)
+{
+    return lebcpu_DecodeDiamondParent(node, Mode::mode);
+}
+
+
+// *****************************************************************************
+// Batched Attribute Decoding
+//
+// Decodes the vertex positions of LEBCPU_BATCH_SIZE nodes at once. Rather than
+// composing 3x3 matrices as leb_DecodeNodeAttributeArray does, each bit of the
+// node ID selects and averages the vertices directly, which produces the same
+// values since all the intermediate quantities are exact.
+
+// vertex positions of LEBCPU_BATCH_SIZE triangles in SoA layout
+struct lebcpu_TriangleBatch {
+    float x[3][LEBCPU_BATCH_SIZE];
+    float y[3][LEBCPU_BATCH_SIZE];
+};
+
+// roots holds the root vertices of each lane
+template <typename Mode> inline void
+lebcpu__DecodeTriangleLanes(
+    const uint32_t *nodeIDs,
+    const uint32_t *nodeDepths,
+    const uint32_t *windingBits,
+    int maxDepth,
+    const lebcpu_TriangleBatch *roots,
+    lebcpu_TriangleBatch *batch,
+    int lane
+) {
+    const lebcpu__f32x4 half = lebcpu__Set1(0.5f);
+    lebcpu__u32x4 id = lebcpu__LoadU32(&nodeIDs[lane]);
+    lebcpu__u32x4 depth = lebcpu__LoadU32(&nodeDepths[lane]);
+    lebcpu__f32x4 v[2][3];
+
+    for (int i = 0; i < 3; ++i) {
+        v[0][i] = lebcpu__Load(&roots->x[i][lane]);
+        v[1][i] = lebcpu__Load(&roots->y[i][lane]);
+    }
+
+    for (int bitID = maxDepth - 1; bitID >= 0; --bitID) {
+        lebcpu__m32x4 b = lebcpu__TestBit(id, bitID);
+
+        if (Mode::mode == LEBCPU_MODE_TRIANGLE) {
+            lebcpu__m32x4 isSplit = lebcpu__Greater(depth, bitID);
+
+            for (int j = 0; j < 2; ++j) {
+                lebcpu__f32x4 v0 = lebcpu__Select(b, v[j][1], v[j][0]);
+                lebcpu__f32x4 v1 = lebcpu__Mul(half, lebcpu__Add(v[j][0], v[j][2]));
+                lebcpu__f32x4 v2 = lebcpu__Select(b, v[j][2], v[j][1]);
+
+                v[j][0] = lebcpu__Select(isSplit, v0, v[j][0]);
+                v[j][1] = lebcpu__Select(isSplit, v1, v[j][1]);
+                v[j][2] = lebcpu__Select(isSplit, v2, v[j][2]);
+            }
+        } else {
+            lebcpu__m32x4 isSplit = lebcpu__Greater(depth, bitID + 1);
+            lebcpu__m32x4 isSquare = lebcpu__Equal(depth, bitID + 1);
+
+            for (int j = 0; j < 2; ++j) {
+                lebcpu__f32x4 s0 = lebcpu__Select(b, v[j][2], v[j][0]);
+                lebcpu__f32x4 s1 = lebcpu__Select(b, lebcpu__Add(v[j][0], v[j][2]),
+                                                     v[j][1]);
+                lebcpu__f32x4 s2 = lebcpu__Select(b, v[j][0], v[j][2]);
+                lebcpu__f32x4 v0 = lebcpu__Select(b, v[j][1], v[j][0]);
+                lebcpu__f32x4 v1 = lebcpu__Mul(half, lebcpu__Add(v[j][0], v[j][2]));
+                lebcpu__f32x4 v2 = lebcpu__Select(b, v[j][2], v[j][1]);
+
+                v[j][0] = lebcpu__Select(isSplit, v0,
+                          lebcpu__Select(isSquare, s0, v[j][0]));
+                v[j][1] = lebcpu__Select(isSplit, v1,
+                          lebcpu__Select(isSquare, s1, v[j][1]));
+                v[j][2] = lebcpu__Select(isSplit, v2,
+                          lebcpu__Select(isSquare, s2, v[j][2]));
+            }
+        }
+    }
+
+    lebcpu__m32x4 w = lebcpu__TestBit(lebcpu__LoadU32(&windingBits[lane]), 0);
+
+    for (int i = 0; i < 3; ++i) {
+        int k = (i == 1) ? 1 : 2 - i;
+
+        lebcpu__Store(&batch->x[i][lane], lebcpu__Select(w, v[0][k], v[0][i]));
+        lebcpu__Store(&batch->y[i][lane], lebcpu__Select(w, v[1][k], v[1][i]));
+    }
+}
+
+// decodes the (x, y) positions of the vertices of nodeCount nodes, with
+// nodeCount at most LEBCPU_BATCH_SIZE; rootAttributeArray holds the positions
+// of the root vertices, as in leb_DecodeNodeAttributeArray(_Quad)
+template <typename Mode> inline void
+lebcpu_DecodeTriangleBatch(
+    const leb_Node *nodes,
+    int nodeCount,
+    const float rootAttributeArray[2][3],
+    lebcpu_TriangleBatch *batch
+) {
+    uint32_t nodeIDs[LEBCPU_BATCH_SIZE];
+    uint32_t nodeDepths[LEBCPU_BATCH_SIZE];
+    uint32_t windingBits[LEBCPU_BATCH_SIZE];
+    lebcpu_TriangleBatch roots;
+    int maxDepth = 0;
+
+    for (int i = 0; i < LEBCPU_BATCH_SIZE; ++i) {
+        leb_Node node = i < nodeCount ? nodes[i] : lebcpu__CreateNode(1u, 0);
+
+        nodeIDs[i] = node.id;
+        nodeDepths[i] = (uint32_t)node.depth;
+        windingBits[i] = (uint32_t)(Mode::mode == LEBCPU_MODE_TRIANGLE
+                                    ? node.depth & 1 : (node.depth ^ 1) & 1);
+        maxDepth = std::max(maxDepth, node.depth);
+
+        for (int j = 0; j < 3; ++j) {
+            roots.x[j][i] = rootAttributeArray[0][j];
+            roots.y[j][i] = rootAttributeArray[1][j];
+        }
+    }
+
+    for (int lane = 0; lane < LEBCPU_BATCH_SIZE; lane+= 4) {
+        lebcpu__DecodeTriangleLanes<Mode>(nodeIDs, nodeDepths, windingBits,
+                                          maxDepth, &roots, batch, lane);
+    }
+}
+
+inline void
+lebcpu_DecodeTriangleBatch(
+    const leb_Node *nodes,
+    int nodeCount,
+    lebcpu_Mode mode,
+    const float rootAttributeArray[2][3],
+    lebcpu_TriangleBatch *batch
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        lebcpu_DecodeTriangleBatch<lebcpu_TriangleMode>(nodes, nodeCount,
+                                                        rootAttributeArray, batch);
+    else
+        lebcpu_DecodeTriangleBatch<lebcpu_QuadMode>(nodes, nodeCount,
+                                                    rootAttributeArray, batch);
+}
+
+
+// *****************************************************************************
+// Thread-safe Split and Merge
+
+// the split and merge routines below return the number of nodes they
+// actually split (resp. merged)
+inline uint32_t
+lebcpu__SplitNode(leb_Heap *leb, const leb_Node node, lebcpu_DirtyMask *mask)
+{
+    if (node.depth < leb->maxDepth)
+        return lebcpu__HeapSetBit(leb, lebcpu__CreateNode(node.id << 1u | 1u,
+                                                          node.depth + 1), mask);
+
+    return 0u;
+}
+
+inline uint32_t
+lebcpu__MergeNode(leb_Heap *leb, const leb_Node node, lebcpu_DirtyMask *mask)
+{
+    if (node.depth > leb->minDepth)
+        return lebcpu__HeapClearBit(leb, lebcpu__CreateNode(node.id | 1u,
+                                                            node.depth), mask);
+
+    return 0u;
+}
+
+inline uint32_t
+lebcpu__SplitNode(
+    lebcpu_SparseHeap *heap,
+    const leb_Node node,
+    lebcpu_DirtyMask * /* sparse heaps track their own pages */
+) {
+    if (node.depth < heap->maxDepth)
+        return lebcpu__SparseSetBit(heap, lebcpu__CreateNode(node.id << 1u | 1u,
+                                                             node.depth + 1));
+
+    return 0u;
+}
+
+inline uint32_t
+lebcpu__MergeNode(
+    lebcpu_SparseHeap *heap,
+    const leb_Node node,
+    lebcpu_DirtyMask * /* sparse heaps track their own pages */
+) {
+    if (node.depth > heap->minDepth)
+        return lebcpu__SparseClearBit(heap, lebcpu__CreateNode(node.id | 1u,
+                                                               node.depth));
+
+    return 0u;
+}
+
+// the conforming routines and the passes below accept both leb_Heap and
+// lebcpu_SparseHeap
+//
+// The split walk stops at the first node that is split already: in a
+// conforming heap, the remainder of its walk was performed by whoever split
+// that node (or is being performed concurrently), so the final heap is the
+// same as when walking up to the root every time.
+template <typename Mode, typename Heap> inline uint32_t
+lebcpu_SplitNodeConforming(
+    Heap *leb,
+    const leb_Node node,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    const lebcpu_Mode mode = Mode::mode;
+    uint32_t splitCount = 0u;
+
+    if (node.depth < leb->maxDepth) {
+        const uint32_t minNodeID = (mode == LEBCPU_MODE_QUAD) ? 2u : 1u;
+        leb_Node nodeIterator = node;
+
+        if (!lebcpu__SplitNode(leb, nodeIterator, mask))
+            return 0u;
+        splitCount = 1u;
+        nodeIterator = lebcpu__EdgeNeighborNode(nodeIterator, mode);
+
+        while (nodeIterator.id >= minNodeID) {
+            if (!lebcpu__SplitNode(leb, nodeIterator, mask))
+                break;
+            ++splitCount;
+            nodeIterator = lebcpu__CreateNode(nodeIterator.id >> 1u,
+                                              nodeIterator.depth - 1);
+            if (nodeIterator.id >= minNodeID) {
+                if (!lebcpu__SplitNode(leb, nodeIterator, mask))
+                    break;
+                ++splitCount;
+            }
+            nodeIterator = lebcpu__EdgeNeighborNode(nodeIterator, mode);
+        }
+    }
+
+    return splitCount;
+}
+
+template <typename Heap> inline uint32_t
+lebcpu_SplitNodeConforming(
+    Heap *leb,
+    const leb_Node node,
+    lebcpu_Mode mode,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        return lebcpu_SplitNodeConforming<lebcpu_TriangleMode>(leb, node, mask);
+    else
+        return lebcpu_SplitNodeConforming<lebcpu_QuadMode>(leb, node, mask);
+}
+
+template <typename Heap> inline uint32_t
+lebcpu_MergeNodeConforming(
+    Heap *leb,
+    const leb_Node node,
+    const leb_DiamondParent diamond,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    if (node.depth > leb->minDepth) {
+        leb_Node dualNode = lebcpu__CreateNode(diamond.top.id << 1u | 1u,
+                                               diamond.top.depth + 1);
+        bool b1 = lebcpu_IsLeafNode(leb, node);
+        bool b2 = lebcpu_IsLeafNode(leb, lebcpu__CreateNode(node.id ^ 1u,
+                                                            node.depth));
+        bool b3 = lebcpu_IsLeafNode(leb, dualNode);
+        bool b4 = lebcpu_IsLeafNode(leb, lebcpu__CreateNode(dualNode.id ^ 1u,
+                                                            dualNode.depth));
+
+        if (b1 && b2 && b3 && b4) {
+            return lebcpu__MergeNode(leb, node, mask)
+                 + lebcpu__MergeNode(leb, dualNode, mask);
+        }
+    }
+
+    return 0u;
+}
+
+
+// *****************************************************************************
+// Parallel Update Passes
+//
+// Both passes produce the exact same heap as their serial counterpart, i.e.,
+// a loop over leb_DecodeNode followed by leb_SplitNodeConforming (resp.
+// leb_MergeNodeConforming), regardless of the number of threads: splits only
+// ever set bits, and a merge only depends on the leaves of its own diamond,
+// which no other merge can modify. The sum reduction must be recomputed
+// afterwards; if a dirty mask is provided, the leaf words modified by the pass
+// are flagged in it. Predicates are invoked concurrently and must be
+// thread-safe. The passes return the number of nodes they split (resp.
+// merged), so that a pass that returns zero left the heap untouched.
+
+template <typename Mode, typename Heap, typename Predicate> inline uint32_t
+lebcpu_SplitPass(
+    Heap *leb,
+    const Predicate &shouldSplit,   // bool(const leb_Node)
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    std::atomic<uint32_t> splitCount(0u);
+
+    lebcpu_ParallelFor(pool, lebcpu_NodeCount(leb), LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        uint32_t count = 0u;
+
+        lebcpu_ForEachLeaf(leb, begin, end, [&](uint32_t, const leb_Node node) {
+            if (shouldSplit(node))
+                count+= lebcpu_SplitNodeConforming<Mode>(leb, node, mask);
+        });
+        splitCount+= count;
+    });
+
+    return splitCount.load();
+}
+
+template <typename Heap, typename Predicate> inline uint32_t
+lebcpu_SplitPass(
+    Heap *leb,
+    lebcpu_Mode mode,
+    const Predicate &shouldSplit,
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        return lebcpu_SplitPass<lebcpu_TriangleMode>(leb, shouldSplit, pool, mask);
+    else
+        return lebcpu_SplitPass<lebcpu_QuadMode>(leb, shouldSplit, pool, mask);
+}
+
+template <typename Mode, typename Heap, typename Predicate> inline uint32_t
+lebcpu_MergePass(
+    Heap *leb,
+    const Predicate &shouldMerge,   // bool(const leb_DiamondParent)
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    std::atomic<uint32_t> mergeCount(0u);
+
+    lebcpu_ParallelFor(pool, lebcpu_NodeCount(leb), LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        uint32_t count = 0u;
+
+        lebcpu_ForEachLeaf(leb, begin, end, [&](uint32_t, const leb_Node node) {
+            leb_DiamondParent diamond = lebcpu_DecodeDiamondParent<Mode>(node);
+
+            if (shouldMerge(diamond))
+                count+= lebcpu_MergeNodeConforming(leb, node, diamond, mask);
+        });
+        mergeCount+= count;
+    });
+
+    return mergeCount.load();
+}
+
+template <typename Heap, typename Predicate> inline uint32_t
+lebcpu_MergePass(
+    Heap *leb,
+    lebcpu_Mode mode,
+    const Predicate &shouldMerge,
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        return lebcpu_MergePass<lebcpu_TriangleMode>(leb, shouldMerge, pool, mask);
+    else
+        return lebcpu_MergePass<lebcpu_QuadMode>(leb, shouldMerge, pool, mask);
+}
+
+
+
+// *****************************************************************************
+// Sum Reduction
+//
+// The six deepest levels of the reduction are computed from the leaf bitfield
+// 64 leaves at a time: the sums of depth maxDepth - k are k-step SWAR
+// reductions of a 64-bit word, and the sum of depth maxDepth - 6 is its
+// popcount. Leaf words are processed in groups of LEBCPU__REDUCTION_GROUP_SIZE
+// so that every group writes whole 32-bit words of each level, which lets
+// groups run concurrently without atomics. The remaining levels are reduced
+// node by node, in parallel while they are deep enough.
+
+#define LEBCPU__REDUCTION_GROUP_SIZE 32u
+
+// appends bitfields to a word-aligned stream of 32-bit words
+struct lebcpu__BitWriter {
+    uint32_t *word;
+    uint64_t bits;
+    uint32_t bitCount;
+};
+
+inline lebcpu__BitWriter lebcpu__CreateBitWriter(uint32_t *buffer, uint32_t bitID)
+{
+    lebcpu__BitWriter writer = {&buffer[bitID >> 5u], 0u, 0u};
+
+    return writer;
+}
+
+inline void
+lebcpu__BitWriterPush(lebcpu__BitWriter *writer, uint32_t value, uint32_t bitCount)
+{
+    writer->bits|= (uint64_t)value << writer->bitCount;
+    writer->bitCount+= bitCount;
+
+    if (writer->bitCount >= 32u) {
+        *writer->word++ = (uint32_t)writer->bits;
+        writer->bits>>= 32u;
+        writer->bitCount-= 32u;
+    }
+}
+
+inline uint64_t lebcpu__LoadLeafWord(const leb_Heap *leb, uint32_t wordID)
+{
+    const uint32_t *words = &leb->buffer[(3u << leb->maxDepth) >> 5u];
+
+    return (uint64_t)words[2u * wordID]
+         | (uint64_t)words[2u * wordID + 1u] << 32u;
+}
+
+// reduces leaf words [groupID, groupID + 1) * LEBCPU__REDUCTION_GROUP_SIZE
+inline void lebcpu__ReduceLeafGroup(leb_Heap *leb, uint32_t groupID)
+{
+    const uint32_t groupSize = LEBCPU__REDUCTION_GROUP_SIZE;
+    const int depth = leb->maxDepth;
+    const uint32_t firstWordID = groupID * groupSize;
+    const uint64_t m1 = 0x5555555555555555ull, m2 = 0x3333333333333333ull,
+                   m4 = 0x0F0F0F0F0F0F0F0Full, m8 = 0x00FF00FF00FF00FFull,
+                   m16 = 0x0000FFFF0000FFFFull;
+    uint64_t x1[groupSize], x2[groupSize], x3[groupSize],
+             x4[groupSize], x5[groupSize];
+    uint32_t x6[groupSize];
+
+    // SWAR sums; each loop is independent across words and vectorizes
+    for (uint32_t i = 0; i < groupSize; ++i) {
+        uint64_t x = lebcpu__LoadLeafWord(leb, firstWordID + i);
+
+        x1[i] = (x & m1) + ((x >> 1u) & m1);
+        x6[i] = lebcpu__Popcount64(x);
+    }
+    for (uint32_t i = 0; i < groupSize; ++i)
+        x2[i] = (x1[i] & m2) + ((x1[i] >> 2u) & m2);
+    for (uint32_t i = 0; i < groupSize; ++i)
+        x3[i] = (x2[i] & m4) + ((x2[i] >> 4u) & m4);
+    for (uint32_t i = 0; i < groupSize; ++i)
+        x4[i] = (x3[i] & m8) + ((x3[i] >> 8u) & m8);
+    for (uint32_t i = 0; i < groupSize; ++i)
+        x5[i] = (x4[i] & m16) + ((x4[i] >> 16u) & m16);
+
+    // depth - 1: 2-bit sums are already laid out as in the heap
+    {
+        uint32_t firstNodeID = (1u << (depth - 1)) + firstWordID * 32u;
+        uint32_t bitID = lebcpu__NodeBitID(leb, lebcpu__CreateNode(firstNodeID,
+                                                                   depth - 1));
+        uint32_t *words = &leb->buffer[bitID >> 5u];
+
+        for (uint32_t i = 0; i < groupSize; ++i) {
+            words[2u * i     ] = (uint32_t)x1[i];
+            words[2u * i + 1u] = (uint32_t)(x1[i] >> 32u);
+        }
+    }
+
+    // depth - 2 to depth - 5: repack 2^k-bit sums into (k + 1)-bit fields
+    {
+        const uint64_t *sums[] = {x2, x3, x4, x5};
+
+        for (int k = 2; k <= 5; ++k) {
+            const uint64_t *x = sums[k - 2];
+            const uint32_t fieldCount = 64u >> k, fieldSize = 1u << k;
+            uint32_t firstNodeID = (1u << (depth - k))
+                                 + firstWordID * fieldCount;
+            leb_Node firstNode = lebcpu__CreateNode(firstNodeID, depth - k);
+            lebcpu__BitWriter writer =
+                lebcpu__CreateBitWriter(leb->buffer,
+                                        lebcpu__NodeBitID(leb, firstNode));
+
+            for (uint32_t i = 0; i < groupSize; ++i)
+            for (uint32_t j = 0; j < fieldCount; ++j) {
+                uint32_t value = (uint32_t)((x[i] >> (j * fieldSize))
+                                          & ((1ull << fieldSize) - 1ull));
+
+                lebcpu__BitWriterPush(&writer, value, (uint32_t)k + 1u);
+            }
+        }
+    }
+
+    // depth - 6: popcounts
+    {
+        uint32_t firstNodeID = (1u << (depth - 6)) + firstWordID;
+        leb_Node firstNode = lebcpu__CreateNode(firstNodeID, depth - 6);
+        lebcpu__BitWriter writer =
+            lebcpu__CreateBitWriter(leb->buffer,
+                                    lebcpu__NodeBitID(leb, firstNode));
+
+        for (uint32_t i = 0; i < groupSize; ++i)
+            lebcpu__BitWriterPush(&writer, x6[i], 7u);
+    }
+}
+
+// reduces nodes [minNodeID, maxNodeID) of a level; the range must start and
+// end on a 32-bit word boundary unless it covers the whole level
+inline void
+lebcpu__ReduceNodeRange(
+    leb_Heap *leb,
+    int depth,
+    uint32_t minNodeID,
+    uint32_t maxNodeID
+) {
+    for (uint32_t nodeID = minNodeID; nodeID < maxNodeID; ++nodeID) {
+        leb_Node node = lebcpu__CreateNode(nodeID, depth);
+        leb_Node leftChild = lebcpu__CreateNode(nodeID << 1u, depth + 1);
+        leb_Node rightChild = lebcpu__CreateNode(nodeID << 1u | 1u, depth + 1);
+
+        lebcpu__HeapWrite(leb, node, lebcpu__HeapRead(leb, leftChild)
+                                   + lebcpu__HeapRead(leb, rightChild));
+    }
+}
+
+// reduces a level deep enough for groups of 32 nodes to own their words
+inline void
+lebcpu__ReduceLevelParallel(leb_Heap *leb, int depth, lebcpu_ThreadPool *pool)
+{
+    const uint32_t nodesPerGroup = 32u;
+    const uint32_t minNodeID = 1u << depth;
+    const uint32_t bitSize = (uint32_t)(leb->maxDepth - depth + 1);
+
+    lebcpu_ParallelFor(pool, minNodeID / nodesPerGroup, 16u,
+                       [&](uint32_t begin, uint32_t end) {
+        uint32_t nodeID = minNodeID + begin * nodesPerGroup;
+        leb_Node firstNode = lebcpu__CreateNode(nodeID, depth);
+        lebcpu__BitWriter writer =
+            lebcpu__CreateBitWriter(leb->buffer,
+                                    lebcpu__NodeBitID(leb, firstNode));
+
+        for (; nodeID < minNodeID + end * nodesPerGroup; ++nodeID) {
+            leb_Node leftChild = lebcpu__CreateNode(nodeID << 1u, depth + 1);
+            leb_Node rightChild = lebcpu__CreateNode(nodeID << 1u | 1u,
+                                                     depth + 1);
+
+            lebcpu__BitWriterPush(&writer,
+                                  lebcpu__HeapRead(leb, leftChild)
+                                  + lebcpu__HeapRead(leb, rightChild),
+                                  bitSize);
+        }
+    });
+}
+
+// same as leb_ComputeSumReduction
+inline void lebcpu_ComputeSumReduction(leb_Heap *leb, lebcpu_ThreadPool *pool)
+{
+    // deep levels are word aligned for groups of 2048 leaves from depth 11 on
+    const int minGroupDepth = 11;
+    int depth = leb->maxDepth;
+
+    if (depth >= minGroupDepth) {
+        uint32_t groupCount = (1u << depth)
+                            / (64u * LEBCPU__REDUCTION_GROUP_SIZE);
+
+        lebcpu_ParallelFor(pool, groupCount, 4u,
+                           [&](uint32_t begin, uint32_t end) {
+            for (uint32_t groupID = begin; groupID < end; ++groupID)
+                lebcpu__ReduceLeafGroup(leb, groupID);
+        });
+        depth-= 6;
+    }
+
+    while (--depth >= 0) {
+        if (depth >= LEBCPU_PARALLEL_REDUCTION_DEPTH && lebcpu_ThreadCount(pool) > 1)
+            lebcpu__ReduceLevelParallel(leb, depth, pool);
+        else
+            lebcpu__ReduceNodeRange(leb, depth, 1u << depth, 2u << depth);
+    }
+}
+
+// recomputes the six deepest levels above a single leaf word; the writes are
+// not word aligned so this must not run concurrently for other leaf words
+inline void lebcpu__ReduceLeafWord(leb_Heap *leb, uint32_t wordID)
+{
+    static const uint64_t masks[] = {
+        0x5555555555555555ull, 0x3333333333333333ull, 0x0F0F0F0F0F0F0F0Full,
+        0x00FF00FF00FF00FFull, 0x0000FFFF0000FFFFull, 0x00000000FFFFFFFFull
+    };
+    const int depth = leb->maxDepth;
+    uint64_t x = lebcpu__LoadLeafWord(leb, wordID);
+
+    for (int k = 1; k <= 6; ++k) {
+        const uint32_t fieldCount = 64u >> k, fieldSize = 1u << k;
+        const uint64_t fieldMask = k < 6 ? (1ull << fieldSize) - 1ull : ~0ull;
+        uint32_t firstNodeID = (1u << (depth - k)) + wordID * fieldCount;
+
+        x = (x & masks[k - 1]) + ((x >> (fieldSize >> 1u)) & masks[k - 1]);
+        for (uint32_t j = 0; j < fieldCount; ++j) {
+            leb_Node node = lebcpu__CreateNode(firstNodeID + j, depth - k);
+
+            lebcpu__HeapWrite(leb, node,
+                              (uint32_t)((x >> (j * fieldSize)) & fieldMask));
+        }
+    }
+}
+
+// updates the reduction above the leaf words flagged in the dirty mask, and
+// clears the mask; returns the number of reduction nodes that were written.
+// Falls back to lebcpu_ComputeSumReduction when many words are dirty. If a
+// delta is provided, the heap words modified since the previous update, leaf
+// words included, are appended to it.
+inline uint32_t
+lebcpu_UpdateSumReduction(
+    leb_Heap *leb,
+    lebcpu_DirtyMask *mask,
+    lebcpu_ThreadPool *pool,
+    lebcpu_HeapDelta *delta = NULL
+) {
+    const int depth = leb->maxDepth;
+    const uint32_t leafWordCount = (1u << depth) >> 6u;
+    std::vector<uint32_t> nodeIDs;
+    uint32_t nodeCount = 0u;
+
+    for (uint32_t i = 0; i < (uint32_t)mask->summary.size(); ++i)
+    for (uint32_t s = mask->summary[i]; s != 0u; s&= s - 1u) {
+        uint32_t wordID = (i << 5u) + lebcpu__TrailingZeros32(s);
+
+        for (uint32_t b = mask->bits[wordID]; b != 0u; b&= b - 1u)
+            nodeIDs.push_back((wordID << 5u) + lebcpu__TrailingZeros32(b));
+        mask->bits[wordID] = 0u;
+    }
+    std::fill(mask->summary.begin(), mask->summary.end(), 0u);
+
+    if (nodeIDs.empty())
+        return 0u;
+
+    if (depth < 6 || nodeIDs.size() > leafWordCount / 8u) {
+        lebcpu_ComputeSumReduction(leb, pool);
+        if (delta)
+            lebcpu_FillHeapDelta(delta, leb);
+
+        return (1u << depth) - 1u;
+    }
+
+    // depth - 1 to depth - 6
+    for (size_t i = 0; i < nodeIDs.size(); ++i) {
+        lebcpu__ReduceLeafWord(leb, nodeIDs[i]);
+
+        if (delta) {
+            lebcpu__AppendHeapDelta(delta, (3u << depth) + nodeIDs[i] * 64u, 64u);
+
+            for (int k = 1; k <= 6; ++k) {
+                const uint32_t fieldCount = 64u >> k;
+                leb_Node node = lebcpu__CreateNode((1u << (depth - k))
+                                                   + nodeIDs[i] * fieldCount,
+                                                   depth - k);
+
+                lebcpu__AppendHeapDelta(delta, lebcpu__NodeBitID(leb, node),
+                                        fieldCount * (uint32_t)(k + 1));
+            }
+        }
+
+        nodeIDs[i]+= 1u << (depth - 6);
+    }
+    nodeCount+= 63u * (uint32_t)nodeIDs.size();
+
+    // remaining levels, following the sorted set of dirty ancestors
+    for (int d = depth - 7; d >= 0; --d) {
+        size_t n = 0;
+
+        for (size_t i = 0; i < nodeIDs.size(); ++i) {
+            uint32_t parentID = nodeIDs[i] >> 1u;
+
+            if (n == 0 || nodeIDs[n - 1] != parentID)
+                nodeIDs[n++] = parentID;
+        }
+        nodeIDs.resize(n);
+
+        for (size_t i = 0; i < n; ++i) {
+            leb_Node node = lebcpu__CreateNode(nodeIDs[i], d);
+
+            lebcpu__ReduceNodeRange(leb, d, nodeIDs[i], nodeIDs[i] + 1u);
+            if (delta)
+                lebcpu__AppendHeapDelta(delta, lebcpu__NodeBitID(leb, node),
+                                        lebcpu__NodeBitSize(leb, node));
+        }
+        nodeCount+= (uint32_t)n;
+    }
+
+    return nodeCount;
+}
+
+
+// *****************************************************************************
+// Disk-Triangle Tests
+//
+// A disk intersects a triangle if its center lies inside the triangle, or if
+// its center lies within a radius of one of the edges. The tests accept
+// either triangle orientation.
+
+inline bool
+lebcpu_DiskTriangleTest(
+    float x, float y, float radius,
+    const float vx[3], const float vy[3]
+) {
+    float dmin = 1e30f;
+    bool neg = false, pos = false;
+
+    for (int i = 0; i < 3; ++i) {
+        int j = (i + 1) % 3;
+        float ex = vx[j] - vx[i], ey = vy[j] - vy[i];
+        float wx = x - vx[i], wy = y - vy[i];
+        float w = ex * wy - ey * wx;
+        float t = std::min(std::max((wx * ex + wy * ey)
+                                    / (ex * ex + ey * ey), 0.0f), 1.0f);
+        float dx = wx - t * ex, dy = wy - t * ey;
+
+        neg = neg || w < 0.0f;
+        pos = pos || w > 0.0f;
+        dmin = std::min(dmin, dx * dx + dy * dy);
+    }
+
+    return !(neg && pos) || dmin <= radius * radius;
+}
+
+// returns a bitmask of the triangles of the batch intersected by the disk
+inline uint32_t
+lebcpu_DiskTriangleTestBatch(
+    float x, float y, float radius,
+    const lebcpu_TriangleBatch *batch
+) {
+    const lebcpu__f32x4 zero = lebcpu__Set1(0.0f), one = lebcpu__Set1(1.0f);
+    const lebcpu__f32x4 px = lebcpu__Set1(x), py = lebcpu__Set1(y);
+    const lebcpu__f32x4 r2 = lebcpu__Set1(radius * radius);
+    uint32_t mask = 0u;
+
+    for (int lane = 0; lane < LEBCPU_BATCH_SIZE; lane+= 4) {
+        lebcpu__f32x4 vx[3], vy[3], dmin = lebcpu__Set1(1e30f);
+        lebcpu__m32x4 allNeg = lebcpu__LessEqual(zero, zero), allPos = allNeg;
+
+        for (int i = 0; i < 3; ++i) {
+            vx[i] = lebcpu__Load(&batch->x[i][lane]);
+            vy[i] = lebcpu__Load(&batch->y[i][lane]);
+        }
+
+        for (int i = 0; i < 3; ++i) {
+            int j = (i + 1) % 3;
+            lebcpu__f32x4 ex = lebcpu__Sub(vx[j], vx[i]);
+            lebcpu__f32x4 ey = lebcpu__Sub(vy[j], vy[i]);
+            lebcpu__f32x4 wx = lebcpu__Sub(px, vx[i]);
+            lebcpu__f32x4 wy = lebcpu__Sub(py, vy[i]);
+            lebcpu__f32x4 w = lebcpu__Sub(lebcpu__Mul(ex, wy), lebcpu__Mul(ey, wx));
+            lebcpu__f32x4 t = lebcpu__Div(
+                lebcpu__Add(lebcpu__Mul(wx, ex), lebcpu__Mul(wy, ey)),
+                lebcpu__Add(lebcpu__Mul(ex, ex), lebcpu__Mul(ey, ey))
+            );
+            lebcpu__f32x4 dx, dy;
+
+            t = lebcpu__Min(lebcpu__Max(t, zero), one);
+            dx = lebcpu__Sub(wx, lebcpu__Mul(t, ex));
+            dy = lebcpu__Sub(wy, lebcpu__Mul(t, ey));
+            dmin = lebcpu__Min(dmin, lebcpu__Add(lebcpu__Mul(dx, dx),
+                                                 lebcpu__Mul(dy, dy)));
+            allNeg = lebcpu__And(allNeg, lebcpu__LessEqual(w, zero));
+            allPos = lebcpu__And(allPos, lebcpu__LessEqual(zero, w));
+        }
+
+        lebcpu__m32x4 hit = lebcpu__Or(lebcpu__Or(allNeg, allPos),
+                                       lebcpu__LessEqual(dmin, r2));
+
+        mask|= lebcpu__MoveMask(hit) << lane;
+    }
+
+    return mask;
+}
+
+// *****************************************************************************
+// Disk Grids
+//
+// Uniform grid over a set of target disks, each with its own maximum depth,
+// so that a node only tests the disks whose bounding box overlaps its own.
+// Cells store the IDs of the disks that overlap them in a single array, and
+// the deepest maximum depth of these disks so that nodes that are already
+// deep enough skip the cell.
+
+struct lebcpu_Disk {
+    float x, y, radius;
+    int maxDepth;   // the disk only requests nodes shallower than this
+};
+
+struct lebcpu_DiskGrid {
+    std::vector<lebcpu_Disk> disks;
+    std::vector<uint32_t> cellOffsets;  // disks of cell c in [offsets[c], offsets[c + 1])
+    std::vector<uint32_t> diskIDs;
+    std::vector<int> cellMaxDepths;
+    float xmin, ymin, cellSize;
+    int resolution; // number of cells along each axis
+};
+
+inline int lebcpu__DiskGridCell(const lebcpu_DiskGrid *grid, float x, float origin)
+{
+    int cell = (int)std::floor((x - origin) / grid->cellSize);
+
+    return std::min(std::max(cell, 0), grid->resolution - 1);
+}
+
+// builds the grid over the square [xmin, xmin + size] x [ymin, ymin + size];
+// disks that stick out of the square are stored in the border cells, and a
+// resolution of 0 picks about one cell per disk
+inline void
+lebcpu_BuildDiskGrid(
+    lebcpu_DiskGrid *grid,
+    const lebcpu_Disk *disks,
+    uint32_t diskCount,
+    float xmin, float ymin, float size,
+    int resolution = 0
+) {
+    std::vector<uint32_t> cursors;
+
+    if (resolution <= 0)
+        resolution = (int)std::ceil(std::sqrt((float)diskCount));
+    resolution = std::min(std::max(resolution, 1), 256);
+
+    grid->disks.assign(disks, disks + diskCount);
+    grid->xmin = xmin;
+    grid->ymin = ymin;
+    grid->cellSize = size / (float)resolution;
+    grid->resolution = resolution;
+    grid->cellOffsets.assign(resolution * resolution + 1, 0u);
+    grid->cellMaxDepths.assign(resolution * resolution, 0);
+
+    // count, then scatter the disks of each cell
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            for (size_t i = 1; i < grid->cellOffsets.size(); ++i)
+                grid->cellOffsets[i]+= grid->cellOffsets[i - 1];
+            grid->diskIDs.resize(grid->cellOffsets.back());
+            cursors.assign(grid->cellOffsets.begin(), grid->cellOffsets.end() - 1);
+        }
+
+        for (uint32_t diskID = 0u; diskID < diskCount; ++diskID) {
+            const lebcpu_Disk &disk = disks[diskID];
+            int i0 = lebcpu__DiskGridCell(grid, disk.x - disk.radius, xmin);
+            int i1 = lebcpu__DiskGridCell(grid, disk.x + disk.radius, xmin);
+            int j0 = lebcpu__DiskGridCell(grid, disk.y - disk.radius, ymin);
+            int j1 = lebcpu__DiskGridCell(grid, disk.y + disk.radius, ymin);
+
+            for (int j = j0; j <= j1; ++j)
+            for (int i = i0; i <= i1; ++i) {
+                int cellID = i + j * resolution;
+
+                if (pass == 0) {
+                    ++grid->cellOffsets[cellID + 1];
+                    grid->cellMaxDepths[cellID] =
+                        std::max(grid->cellMaxDepths[cellID], disk.maxDepth);
+                } else {
+                    grid->diskIDs[cursors[cellID]++] = diskID;
+                }
+            }
+        }
+    }
+}
+
+// returns true if a node of the given depth intersects a disk that requests
+// a deeper node
+inline bool
+lebcpu_DiskGridTest(
+    const lebcpu_DiskGrid *grid,
+    const float vx[3], const float vy[3],
+    int depth
+) {
+    float x0 = std::min(std::min(vx[0], vx[1]), vx[2]);
+    float y0 = std::min(std::min(vy[0], vy[1]), vy[2]);
+    float x1 = std::max(std::max(vx[0], vx[1]), vx[2]);
+    float y1 = std::max(std::max(vy[0], vy[1]), vy[2]);
+    int i0 = lebcpu__DiskGridCell(grid, x0, grid->xmin);
+    int i1 = lebcpu__DiskGridCell(grid, x1, grid->xmin);
+    int j0 = lebcpu__DiskGridCell(grid, y0, grid->ymin);
+    int j1 = lebcpu__DiskGridCell(grid, y1, grid->ymin);
+
+    for (int j = j0; j <= j1; ++j)
+    for (int i = i0; i <= i1; ++i) {
+        int cellID = i + j * grid->resolution;
+
+        if (grid->cellMaxDepths[cellID] <= depth)
+            continue;
+
+        for (uint32_t k = grid->cellOffsets[cellID];
+                      k < grid->cellOffsets[cellID + 1]; ++k) {
+            const lebcpu_Disk &disk = grid->disks[grid->diskIDs[k]];
+
+            if (disk.maxDepth <= depth
+                || disk.x + disk.radius < x0 || disk.x - disk.radius > x1
+                || disk.y + disk.radius < y0 || disk.y - disk.radius > y1)
+                continue;
+
+            // a disk spanning several cells is only tested in the cell that
+            // holds the corner of its overlap with the node
+            float ox = std::max(disk.x - disk.radius, x0);
+            float oy = std::max(disk.y - disk.radius, y0);
+
+            if (lebcpu__DiskGridCell(grid, ox, grid->xmin) != i
+                || lebcpu__DiskGridCell(grid, oy, grid->ymin) != j)
+                continue;
+
+            if (lebcpu_DiskTriangleTest(disk.x, disk.y, disk.radius, vx, vy))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// returns a bitmask of the nodes of the batch for which lebcpu_DiskGridTest
+// succeeds; batch holds the vertices of the nodes
+inline uint32_t
+lebcpu_DiskGridTestBatch(
+    const lebcpu_DiskGrid *grid,
+    const leb_Node *nodes,
+    int nodeCount,
+    const lebcpu_TriangleBatch *batch
+) {
+    uint32_t mask = 0u;
+
+    for (int lane = 0; lane < nodeCount; ++lane) {
+        const float vx[3] = {batch->x[0][lane], batch->x[1][lane], batch->x[2][lane]};
+        const float vy[3] = {batch->y[0][lane], batch->y[1][lane], batch->y[2][lane]};
+
+        if (lebcpu_DiskGridTest(grid, vx, vy, nodes[lane].depth))
+            mask|= 1u << lane;
+    }
+
+    return mask;
+}
+
+// *****************************************************************************
+// Batched Update Passes
+//
+// Same as lebcpu_SplitPass and lebcpu_MergePass, except that predicates are
+// evaluated on batches of up to LEBCPU_BATCH_SIZE leaves and return a bitmask
+// of the entries to split (resp. merge).
+
+template <typename Mode, typename Heap, typename BatchPredicate> inline uint32_t
+lebcpu_SplitPassBatch(
+    Heap *leb,
+    const BatchPredicate &shouldSplit,  // uint32_t(const leb_Node *, int)
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    std::atomic<uint32_t> splitCount(0u);
+
+    lebcpu_ParallelFor(pool, lebcpu_NodeCount(leb), LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        leb_Node nodes[LEBCPU_BATCH_SIZE];
+        int nodeCount = 0;
+        uint32_t count = 0u;
+        auto flush = [&]() {
+            uint32_t hits = shouldSplit(nodes, nodeCount)
+                          & ((1u << nodeCount) - 1u);
+
+            for (; hits != 0u; hits&= hits - 1u) {
+                leb_Node node = nodes[lebcpu__TrailingZeros32(hits)];
+
+                count+= lebcpu_SplitNodeConforming<Mode>(leb, node, mask);
+            }
+            nodeCount = 0;
+        };
+
+        lebcpu_ForEachLeaf(leb, begin, end, [&](uint32_t, const leb_Node node) {
+            nodes[nodeCount++] = node;
+
+            if (nodeCount == LEBCPU_BATCH_SIZE)
+                flush();
+        });
+
+        if (nodeCount > 0)
+            flush();
+        splitCount+= count;
+    });
+
+    return splitCount.load();
+}
+
+template <typename Heap, typename BatchPredicate> inline uint32_t
+lebcpu_SplitPassBatch(
+    Heap *leb,
+    lebcpu_Mode mode,
+    const BatchPredicate &shouldSplit,
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        return lebcpu_SplitPassBatch<lebcpu_TriangleMode>(leb, shouldSplit, pool, mask);
+    else
+        return lebcpu_SplitPassBatch<lebcpu_QuadMode>(leb, shouldSplit, pool, mask);
+}
+
+template <typename Mode, typename Heap, typename BatchPredicate> inline uint32_t
+lebcpu_MergePassBatch(
+    Heap *leb,
+    const BatchPredicate &shouldMerge,  // uint32_t(const leb_DiamondParent *, int)
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    std::atomic<uint32_t> mergeCount(0u);
+
+    lebcpu_ParallelFor(pool, lebcpu_NodeCount(leb), LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        leb_Node nodes[LEBCPU_BATCH_SIZE];
+        leb_DiamondParent diamonds[LEBCPU_BATCH_SIZE];
+        int nodeCount = 0;
+        uint32_t count = 0u;
+        auto flush = [&]() {
+            uint32_t hits = shouldMerge(diamonds, nodeCount)
+                          & ((1u << nodeCount) - 1u);
+
+            for (; hits != 0u; hits&= hits - 1u) {
+                uint32_t i = lebcpu__TrailingZeros32(hits);
+
+                count+= lebcpu_MergeNodeConforming(leb, nodes[i], diamonds[i],
+                                                   mask);
+            }
+            nodeCount = 0;
+        };
+
+        lebcpu_ForEachLeaf(leb, begin, end, [&](uint32_t, const leb_Node node) {
+            nodes[nodeCount] = node;
+            diamonds[nodeCount] = lebcpu_DecodeDiamondParent<Mode>(node);
+
+            if (++nodeCount == LEBCPU_BATCH_SIZE)
+                flush();
+        });
+
+        if (nodeCount > 0)
+            flush();
+        mergeCount+= count;
+    });
+
+    return mergeCount.load();
+}
+
+template <typename Heap, typename BatchPredicate> inline uint32_t
+lebcpu_MergePassBatch(
+    Heap *leb,
+    lebcpu_Mode mode,
+    const BatchPredicate &shouldMerge,
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        return lebcpu_MergePassBatch<lebcpu_TriangleMode>(leb, shouldMerge, pool, mask);
+    else
+        return lebcpu_MergePassBatch<lebcpu_QuadMode>(leb, shouldMerge, pool, mask);
+}
+
+// *****************************************************************************
+// Top-down Construction
+//
+// Builds the subdivision of a refinement predicate in a single descent: the
+// heap is reset to its minimum depth, each node that satisfies the predicate
+// is split conformingly and its children are visited in turn, and the sum
+// reduction is computed once at the end. Each node is thus tested once, and
+// the cost of decoding its vertices does not grow with its depth. Provided
+// that the predicate holds for the parent of every node it holds for, as
+// intersection tests do, the result is the subdivision the split and merge
+// passes converge to, i.e., the coarsest conforming subdivision whose leaves
+// either fail the predicate or have maximum depth. Splits only write the leaf
+// bitfield, so subtrees are distributed over the threads of the pool.
+
+// clears the leaf bitfield and sets the leaves of minimum depth; the sum
+// reduction is left stale
+inline void lebcpu__ResetLeaves(leb_Heap *leb)
+{
+    const int depth = leb->minDepth;
+    const uint32_t leafBitID = 3u << leb->maxDepth;
+
+    if (leb->maxDepth >= 5)
+        memset(&leb->buffer[leafBitID >> 5u], 0, (1u << leb->maxDepth) >> 3u);
+    else
+        lebcpu__BitFieldWrite(leb->buffer, leafBitID, 1u << leb->maxDepth, 0u);
+
+    for (uint32_t id = 1u << depth; id < (2u << depth); ++id)
+        lebcpu__HeapSetBit(leb, lebcpu__CreateNode(id, depth), NULL);
+}
+
+inline void lebcpu__ComputeSumReduction(leb_Heap *leb, lebcpu_ThreadPool *pool)
+{
+    lebcpu_ComputeSumReduction(leb, pool);
+}
+
+inline void lebcpu__ComputeSumReduction(lebcpu_SparseHeap *heap, lebcpu_ThreadPool *)
+{
+    lebcpu_ComputeSumReduction(heap);
+}
+
+// node of the descent, with the vertices of its triangle before the winding
+// fix-up of lebcpu_DecodeTriangleBatch
+struct lebcpu__BuildNode {
+    leb_Node node;
+    float x[3], y[3];
+};
+
+// same arithmetic as one step of lebcpu__DecodeTriangleLanes
+template <typename Mode> inline lebcpu__BuildNode
+lebcpu__BuildChild(const lebcpu__BuildNode &parent, uint32_t b)
+{
+    const float *v[2] = {parent.x, parent.y};
+    lebcpu__BuildNode child;
+    float *c[2] = {child.x, child.y};
+
+    child.node = lebcpu__CreateNode(parent.node.id << 1u | b,
+                                    parent.node.depth + 1);
+
+    for (int j = 0; j < 2; ++j) {
+        if (Mode::mode == LEBCPU_MODE_QUAD && parent.node.depth == 0) {
+            c[j][0] = b ? v[j][2] : v[j][0];
+            c[j][1] = b ? v[j][0] + v[j][2] : v[j][1];
+            c[j][2] = b ? v[j][0] : v[j][2];
+        } else {
+            c[j][0] = b ? v[j][1] : v[j][0];
+            c[j][1] = 0.5f * (v[j][0] + v[j][2]);
+            c[j][2] = b ? v[j][2] : v[j][1];
+        }
+    }
+
+    return child;
+}
+
+// the predicate receives the nodes along with their vertices, as decoded by
+// lebcpu_DecodeTriangleBatch from rootAttributeArray, so that the vertices of
+// a node are derived from those of its parent rather than from the root
+template <typename Mode, typename Heap, typename BatchPredicate> inline void
+lebcpu_BuildBatch(
+    Heap *leb,
+    const float rootAttributeArray[2][3],
+    const BatchPredicate &shouldSplit,
+    // uint32_t(const leb_Node *, int, const lebcpu_TriangleBatch *)
+    lebcpu_ThreadPool *pool
+) {
+    const uint32_t minTaskCount = 64u * (uint32_t)lebcpu_ThreadCount(pool);
+    std::vector<lebcpu__BuildNode> nodes, children;
+    lebcpu__BuildNode root;
+
+    // splits the nodes that satisfy the predicate, and appends the children
+    // that may be split further to a list
+    auto splitNodes = [&](const lebcpu__BuildNode *nodes,
+                          uint32_t nodeCount,
+                          std::vector<lebcpu__BuildNode> *children) {
+        for (uint32_t i = 0; i < nodeCount; i+= LEBCPU_BATCH_SIZE) {
+            int batchSize = (int)std::min(nodeCount - i, (uint32_t)LEBCPU_BATCH_SIZE);
+            leb_Node batchNodes[LEBCPU_BATCH_SIZE];
+            lebcpu_TriangleBatch batch;
+            uint32_t hits;
+
+            for (int lane = 0; lane < LEBCPU_BATCH_SIZE; ++lane) {
+                const lebcpu__BuildNode &node = nodes[i + std::min(lane, batchSize - 1)];
+                int depth = node.node.depth;
+                bool w = ((Mode::mode == LEBCPU_MODE_TRIANGLE ? depth : depth ^ 1) & 1) != 0;
+
+                batchNodes[lane] = node.node;
+                for (int k = 0; k < 3; ++k) {
+                    int l = (w && k != 1) ? 2 - k : k;
+
+                    batch.x[k][lane] = node.x[l];
+                    batch.y[k][lane] = node.y[l];
+                }
+            }
+
+            hits = shouldSplit(batchNodes, batchSize, &batch)
+                 & ((1u << batchSize) - 1u);
+
+            for (; hits != 0u; hits&= hits - 1u) {
+                const lebcpu__BuildNode &node = nodes[i + lebcpu__TrailingZeros32(hits)];
+
+                lebcpu_SplitNodeConforming<Mode>(leb, node.node);
+                if (node.node.depth + 1 < leb->maxDepth) {
+                    children->push_back(lebcpu__BuildChild<Mode>(node, 0u));
+                    children->push_back(lebcpu__BuildChild<Mode>(node, 1u));
+                }
+            }
+        }
+    };
+
+    lebcpu__ResetLeaves(leb);
+
+    root.node = lebcpu__CreateNode(1u, 0);
+    for (int k = 0; k < 3; ++k) {
+        root.x[k] = rootAttributeArray[0][k];
+        root.y[k] = rootAttributeArray[1][k];
+    }
+    nodes.push_back(root);
+
+    // the nodes above the minimum depth are split regardless of the predicate
+    for (int depth = 0; depth < leb->minDepth; ++depth) {
+        children.clear();
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            children.push_back(lebcpu__BuildChild<Mode>(nodes[i], 0u));
+            children.push_back(lebcpu__BuildChild<Mode>(nodes[i], 1u));
+        }
+        nodes.swap(children);
+    }
+    if (leb->minDepth == leb->maxDepth)
+        nodes.clear();
+
+    // breadth-first until there are enough subtrees to keep all threads busy
+    while (!nodes.empty() && nodes.size() < minTaskCount) {
+        children.clear();
+        splitNodes(&nodes[0], (uint32_t)nodes.size(), &children);
+        nodes.swap(children);
+    }
+
+    // depth-first within each subtree
+    lebcpu_ParallelFor(pool, (uint32_t)nodes.size(), 16u,
+                       [&](uint32_t begin, uint32_t end) {
+        std::vector<lebcpu__BuildNode> stack(nodes.begin() + begin,
+                                             nodes.begin() + end);
+        lebcpu__BuildNode batch[LEBCPU_BATCH_SIZE];
+
+        while (!stack.empty()) {
+            uint32_t batchSize = std::min((uint32_t)stack.size(),
+                                          (uint32_t)LEBCPU_BATCH_SIZE);
+
+            std::copy(stack.end() - batchSize, stack.end(), batch);
+            stack.resize(stack.size() - batchSize);
+            splitNodes(batch, batchSize, &stack);
+        }
+    });
+
+    lebcpu__ComputeSumReduction(leb, pool);
+}
+
+template <typename Heap, typename BatchPredicate> inline void
+lebcpu_BuildBatch(
+    Heap *leb,
+    lebcpu_Mode mode,
+    const float rootAttributeArray[2][3],
+    const BatchPredicate &shouldSplit,
+    lebcpu_ThreadPool *pool
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        lebcpu_BuildBatch<lebcpu_TriangleMode>(leb, rootAttributeArray, shouldSplit, pool);
+    else
+        lebcpu_BuildBatch<lebcpu_QuadMode>(leb, rootAttributeArray, shouldSplit, pool);
+}
+
+// *****************************************************************************
+// Batched Point Location
+//
+// Finds the leaves that contain a set of points, as leb_BoundingNode(_Quad)
+// does for a single point. Each point descends the subdivision expressed in
+// the local frame of its current node, which costs one comparison and a
+// couple of additions per level; LEBCPU_BATCH_SIZE points descend at once,
+// and a lane whose point reaches its leaf is refilled with the next point.
+// The points are sorted along a Morton curve beforehand so that consecutive
+// points share most of their descent: the internal nodes found by a point are
+// cached per depth and not read again from the heap by the next ones.
+
+// interleaves the 16 least significant bits of x with zeros
+inline uint32_t lebcpu__MortonSpread16(uint32_t x)
+{
+    x&= 0xFFFFu;
+    x = (x | (x << 8u)) & 0x00FF00FFu;
+    x = (x | (x << 4u)) & 0x0F0F0F0Fu;
+    x = (x | (x << 2u)) & 0x33333333u;
+    x = (x | (x << 1u)) & 0x55555555u;
+
+    return x;
+}
+
+// sorts keys by their 32 most significant bits with an LSD radix sort;
+// temp must hold as many keys
+inline void
+lebcpu__RadixSortKeys(std::vector<uint64_t> &keys, std::vector<uint64_t> &temp)
+{
+    for (uint32_t shift = 32u; shift < 64u; shift+= 8u) {
+        uint32_t offsets[256] = {0u};
+        uint32_t offset = 0u;
+
+        for (size_t i = 0; i < keys.size(); ++i)
+            ++offsets[keys[i] >> shift & 0xFFu];
+
+        // every key shares this byte
+        if (offsets[keys[0] >> shift & 0xFFu] == keys.size())
+            continue;
+
+        for (int i = 0; i < 256; ++i) {
+            uint32_t count = offsets[i];
+
+            offsets[i] = offset;
+            offset+= count;
+        }
+        for (size_t i = 0; i < keys.size(); ++i)
+            temp[offsets[keys[i] >> shift & 0xFFu]++] = keys[i];
+
+        keys.swap(temp);
+    }
+}
+
+// descent state of LEBCPU_BATCH_SIZE points in SoA layout; (u, v) are the
+// coordinates of the point in the frame of its node, in which the node is the
+// triangle (0, 1), (0, 0), (1, 0)
+struct lebcpu__PointLanes {
+    float u[LEBCPU_BATCH_SIZE], v[LEBCPU_BATCH_SIZE];
+    uint32_t nodeIDs[LEBCPU_BATCH_SIZE];
+    uint32_t nodeDepths[LEBCPU_BATCH_SIZE];
+    uint32_t pointIDs[LEBCPU_BATCH_SIZE];
+};
+
+template <typename Mode, typename Heap> inline void
+lebcpu__LocatePoints(
+    const Heap *leb,
+    const float *x,
+    const float *y,
+    const uint64_t *sortedKeys, // Morton code << 32 | point ID
+    uint32_t begin,
+    uint32_t end,
+    leb_Node *nodesOut
+) {
+    uint32_t internalIDs[32] = {0u}; // last internal node found at each depth
+    lebcpu__PointLanes lanes = {};
+    uint32_t activeMask = 0u;
+
+    // starts the descent of the next point that lies within the root
+    auto refill = [&](int lane) -> bool {
+        while (begin < end) {
+            uint32_t pointID = (uint32_t)sortedKeys[begin++];
+            float u = x[pointID], v = y[pointID];
+            leb_Node node = lebcpu__CreateNode(1u, 0);
+
+            if (Mode::mode == LEBCPU_MODE_TRIANGLE) {
+                if (!(u >= 0.0f && v >= 0.0f && u + v <= 1.0f))
+                    node = lebcpu__CreateNode(0u, 0);
+            } else {
+                if (u >= 0.0f && v >= 0.0f && u <= 1.0f && v <= 1.0f) {
+                    uint32_t b = u + v <= 1.0f ? 0u : 1u;
+
+                    node = lebcpu__CreateNode(2u | b, 1);
+                    if (b) {
+                        u = 1.0f - u;
+                        v = 1.0f - v;
+                    }
+                } else {
+                    node = lebcpu__CreateNode(0u, 0);
+                }
+            }
+
+            if (node.id == 0u) {
+                nodesOut[pointID] = node;
+                continue;
+            }
+
+            lanes.u[lane] = u;
+            lanes.v[lane] = v;
+            lanes.nodeIDs[lane] = node.id;
+            lanes.nodeDepths[lane] = (uint32_t)node.depth;
+            lanes.pointIDs[lane] = pointID;
+
+            return true;
+        }
+
+        return false;
+    };
+    auto isLeaf = [&](int lane) -> bool {
+        leb_Node node = lebcpu__CreateNode(lanes.nodeIDs[lane],
+                                           (int)lanes.nodeDepths[lane]);
+
+        if (node.depth == leb->maxDepth)
+            return true;
+        if (internalIDs[node.depth] == node.id)
+            return false;
+        if (lebcpu__HeapRead(leb, node) == 1u)
+            return true;
+
+        internalIDs[node.depth] = node.id;
+
+        return false;
+    };
+
+    for (int lane = 0; lane < LEBCPU_BATCH_SIZE; ++lane)
+        if (refill(lane))
+            activeMask|= 1u << lane;
+
+    for (;;) {
+        uint32_t childMask = 0u;
+
+        // retire the points that reached their leaf
+        for (int lane = 0; lane < LEBCPU_BATCH_SIZE; ++lane) {
+            while ((activeMask >> lane & 1u) && isLeaf(lane)) {
+                nodesOut[lanes.pointIDs[lane]] =
+                    lebcpu__CreateNode(lanes.nodeIDs[lane],
+                                       (int)lanes.nodeDepths[lane]);
+
+                if (!refill(lane))
+                    activeMask&= ~(1u << lane);
+            }
+        }
+
+        if (activeMask == 0u)
+            break;
+
+        // descend one level: the point lies in the right child if u >= v,
+        // and is then expressed in the frame of that child
+        for (int lane = 0; lane < LEBCPU_BATCH_SIZE; lane+= 4) {
+            const lebcpu__f32x4 one = lebcpu__Set1(1.0f);
+            lebcpu__f32x4 u = lebcpu__Load(&lanes.u[lane]);
+            lebcpu__f32x4 v = lebcpu__Load(&lanes.v[lane]);
+            lebcpu__f32x4 s = lebcpu__Sub(lebcpu__Sub(one, u), v);
+            lebcpu__m32x4 b = lebcpu__LessEqual(v, u);
+
+            lebcpu__Store(&lanes.u[lane], lebcpu__Select(b, lebcpu__Sub(u, v), s));
+            lebcpu__Store(&lanes.v[lane], lebcpu__Select(b, s, lebcpu__Sub(v, u)));
+            childMask|= lebcpu__MoveMask(b) << lane;
+        }
+
+        for (int lane = 0; lane < LEBCPU_BATCH_SIZE; ++lane) {
+            lanes.nodeIDs[lane] = lanes.nodeIDs[lane] << 1u
+                                | (childMask >> lane & 1u);
+            lanes.nodeDepths[lane]+= 1u;
+        }
+    }
+}
+
+// scratch memory of lebcpu_BoundingNodeBatch, kept across calls
+struct lebcpu_PointLocator {
+    std::vector<uint64_t> keys, temp; // Morton code << 32 | point ID
+};
+
+inline lebcpu_PointLocator *lebcpu_CreatePointLocator()
+{
+    return new lebcpu_PointLocator;
+}
+
+inline void lebcpu_ReleasePointLocator(lebcpu_PointLocator *locator)
+{
+    delete locator;
+}
+
+// writes the leaf containing each point (x[i], y[i]) to nodesOut[i], or the
+// null node {0, 0} if the point lies outside the root; the points are
+// expressed in the same space as for leb_BoundingNode(_Quad). The locator
+// only grows, so that calls with at most as many points do not allocate
+template <typename Mode, typename Heap> inline void
+lebcpu_BoundingNodeBatch(
+    const Heap *leb,
+    const float *x,
+    const float *y,
+    uint32_t pointCount,
+    lebcpu_PointLocator *locator,
+    leb_Node *nodesOut,
+    lebcpu_ThreadPool *pool = NULL
+) {
+    std::vector<uint64_t> &keys = locator->keys, &temp = locator->temp;
+
+    if (pointCount == 0u)
+        return;
+
+    keys.resize(pointCount);
+    temp.resize(pointCount);
+
+    // sort the points along a Morton curve
+    lebcpu_ParallelFor(pool, pointCount, LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            float u = std::min(std::max(x[i], 0.0f), 1.0f) * 65535.0f;
+            float v = std::min(std::max(y[i], 0.0f), 1.0f) * 65535.0f;
+            uint32_t code = lebcpu__MortonSpread16((uint32_t)u)
+                          | lebcpu__MortonSpread16((uint32_t)v) << 1u;
+
+            keys[i] = (uint64_t)code << 32u | i;
+        }
+    });
+    lebcpu__RadixSortKeys(keys, temp);
+
+    lebcpu_ParallelFor(pool, pointCount, LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        lebcpu__LocatePoints<Mode>(leb, x, y, &keys[0], begin, end, nodesOut);
+    });
+}
+
+template <typename Heap> inline void
+lebcpu_BoundingNodeBatch(
+    const Heap *leb,
+    lebcpu_Mode mode,
+    const float *x,
+    const float *y,
+    uint32_t pointCount,
+    lebcpu_PointLocator *locator,
+    leb_Node *nodesOut,
+    lebcpu_ThreadPool *pool = NULL
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        lebcpu_BoundingNodeBatch<lebcpu_TriangleMode>(leb, x, y, pointCount,
+                                                      locator, nodesOut, pool);
+    else
+        lebcpu_BoundingNodeBatch<lebcpu_QuadMode>(leb, x, y, pointCount,
+                                                  locator, nodesOut, pool);
+}
+
+
+// *****************************************************************************
+// Mesh Extraction
+//
+// Writes the leaves of a subdivision as an indexed triangle mesh whose
+// vertices are shared by the triangles that touch them. Each leaf is decoded
+// once, and its vertices are welded through a lock-free hash table keyed on
+// their exact coordinates: the batched decoder computes every vertex as the
+// midpoint of the same two vertices in all the triangles that share it, so a
+// conforming subdivision decodes shared vertices to identical values.
+// Vertices are numbered in the order in which the leaves first reference them,
+// so that the mesh does not depend on the number of threads.
+
+#define LEBCPU__WELD_EMPTY_KEY 0xFFFFFFFFFFFFFFFFull // a NaN, never decoded
+
+// scratch memory of lebcpu_ExtractMesh, kept across calls
+struct lebcpu_VertexWelder {
+    std::atomic<uint64_t> *keys;        // vertex coordinates, as float bits
+    std::atomic<uint32_t> *firstCorners; // first corner that references a key
+    uint32_t *vertexIDs;
+    uint32_t capacity;                  // power of two
+};
+
+inline lebcpu_VertexWelder *lebcpu_CreateVertexWelder()
+{
+    lebcpu_VertexWelder *welder = new lebcpu_VertexWelder;
+
+    welder->keys = NULL;
+    welder->firstCorners = NULL;
+    welder->vertexIDs = NULL;
+    welder->capacity = 0u;
+
+    return welder;
+}
+
+inline void lebcpu__ReleaseVertexWelderTable(lebcpu_VertexWelder *welder)
+{
+    delete[] welder->keys;
+    delete[] welder->firstCorners;
+    delete[] welder->vertexIDs;
+}
+
+inline void lebcpu_ReleaseVertexWelder(lebcpu_VertexWelder *welder)
+{
+    lebcpu__ReleaseVertexWelderTable(welder);
+    delete welder;
+}
+
+// a subdivision of n leaves has at most n + 2 vertices; the table is kept at
+// most half full
+inline void
+lebcpu__ResetVertexWelder(
+    lebcpu_VertexWelder *welder,
+    uint32_t vertexCount,
+    lebcpu_ThreadPool *pool
+) {
+    uint32_t capacity = 64u;
+
+    while (capacity < 2u * vertexCount)
+        capacity<<= 1u;
+
+    if (capacity > welder->capacity) {
+        lebcpu__ReleaseVertexWelderTable(welder);
+        welder->keys = new std::atomic<uint64_t>[capacity];
+        welder->firstCorners = new std::atomic<uint32_t>[capacity];
+        welder->vertexIDs = new uint32_t[capacity];
+        welder->capacity = capacity;
+    }
+
+    lebcpu_ParallelFor(pool, welder->capacity, 1u << 14,
+                       [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            welder->keys[i].store(LEBCPU__WELD_EMPTY_KEY, std::memory_order_relaxed);
+            welder->firstCorners[i].store(0xFFFFFFFFu, std::memory_order_relaxed);
+        }
+    });
+}
+
+inline uint64_t lebcpu__WeldKey(float x, float y)
+{
+    uint32_t bx, by;
+
+    // -0 and +0 are the same vertex
+    x+= 0.0f;
+    y+= 0.0f;
+    memcpy(&bx, &x, sizeof(bx));
+    memcpy(&by, &y, sizeof(by));
+
+    return (uint64_t)bx << 32u | by;
+}
+
+// inserts the vertex referenced by a corner, i.e., the vertex k of leaf h for
+// corner 3h + k; returns its slot in the table
+inline uint32_t
+lebcpu__WeldVertex(lebcpu_VertexWelder *welder, uint64_t key, uint32_t cornerID)
+{
+    const uint32_t mask = welder->capacity - 1u;
+    uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+    uint32_t slot = (uint32_t)(hash >> 32u) & mask;
+
+    for (;; slot = (slot + 1u) & mask) {
+        uint64_t slotKey = welder->keys[slot].load(std::memory_order_relaxed);
+
+        if (slotKey == LEBCPU__WELD_EMPTY_KEY) {
+            if (welder->keys[slot].compare_exchange_strong(slotKey, key,
+                                                           std::memory_order_relaxed))
+                break;
+        }
+        if (slotKey == key)
+            break;
+    }
+
+    uint32_t first = welder->firstCorners[slot].load(std::memory_order_relaxed);
+
+    while (cornerID < first
+           && !welder->firstCorners[slot].compare_exchange_weak(first, cornerID,
+                                                                std::memory_order_relaxed));
+
+    return slot;
+}
+
+// decodes the leaves and inserts their vertices; cornersOut[3h + k] receives
+// the slot of the vertex k of leaf h
+template <typename Mode, typename Heap> inline void
+lebcpu__WeldLeaves(
+    const Heap *leb,
+    const float rootAttributeArray[2][3],
+    lebcpu_VertexWelder *welder,
+    uint32_t *cornersOut,
+    lebcpu_ThreadPool *pool
+) {
+    lebcpu_ParallelFor(pool, lebcpu_NodeCount(leb), LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        leb_Node nodes[LEBCPU_BATCH_SIZE];
+        uint32_t handle = begin;
+        int nodeCount = 0;
+        auto flush = [&]() {
+            lebcpu_TriangleBatch batch;
+
+            lebcpu_DecodeTriangleBatch<Mode>(nodes, nodeCount,
+                                             rootAttributeArray, &batch);
+
+            for (int i = 0; i < nodeCount; ++i, ++handle)
+            for (uint32_t k = 0; k < 3u; ++k) {
+                uint64_t key = lebcpu__WeldKey(batch.x[k][i], batch.y[k][i]);
+                uint32_t cornerID = 3u * handle + k;
+
+                cornersOut[cornerID] = lebcpu__WeldVertex(welder, key, cornerID);
+            }
+            nodeCount = 0;
+        };
+
+        lebcpu_ForEachLeaf(leb, begin, end, [&](uint32_t, const leb_Node node) {
+            nodes[nodeCount] = node;
+
+            if (++nodeCount == LEBCPU_BATCH_SIZE)
+                flush();
+        });
+
+        if (nodeCount > 0)
+            flush();
+    });
+}
+
+// writes the vertices of the leaves to verticesOut, as (x, y) pairs, and the
+// vertex indices of each leaf to indicesOut, three per leaf and in the order of
+// the leaves, with the winding of lebcpu_DecodeTriangleBatch; returns the
+// number of vertices. verticesOut must hold lebcpu_NodeCount(leb) + 2
+// vertices and indicesOut 3 * lebcpu_NodeCount(leb) indices
+template <typename Mode, typename Heap> inline uint32_t
+lebcpu_ExtractMesh(
+    const Heap *leb,
+    const float rootAttributeArray[2][3],
+    lebcpu_VertexWelder *welder,
+    float (*verticesOut)[2],
+    uint32_t *indicesOut,
+    lebcpu_ThreadPool *pool = NULL
+) {
+    const uint32_t cornerCount = 3u * lebcpu_NodeCount(leb);
+    const uint32_t chunkSize = 3u * LEBCPU_GRAIN_SIZE;
+    const uint32_t chunkCount = (cornerCount + chunkSize - 1u) / chunkSize;
+    std::vector<uint32_t> chunkOffsets(chunkCount + 1u, 0u);
+
+    lebcpu__ResetVertexWelder(welder, lebcpu_NodeCount(leb) + 2u, pool);
+    lebcpu__WeldLeaves<Mode>(leb, rootAttributeArray, welder, indicesOut, pool);
+
+    // number the vertices in the order of their first corner: a chunk of
+    // corners first counts the vertices it owns, ...
+    lebcpu_ParallelFor(pool, chunkCount, 1u, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t chunkID = begin; chunkID < end; ++chunkID) {
+            uint32_t cornerEnd = std::min(cornerCount, (chunkID + 1u) * chunkSize);
+            uint32_t count = 0u;
+
+            for (uint32_t i = chunkID * chunkSize; i < cornerEnd; ++i)
+                if (welder->firstCorners[indicesOut[i]].load(std::memory_order_relaxed) == i)
+                    ++count;
+            chunkOffsets[chunkID + 1] = count;
+        }
+    });
+    for (uint32_t i = 0; i < chunkCount; ++i)
+        chunkOffsets[i + 1]+= chunkOffsets[i];
+
+    // ... then writes them from the offset of the chunk
+    lebcpu_ParallelFor(pool, chunkCount, 1u, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t chunkID = begin; chunkID < end; ++chunkID) {
+            uint32_t cornerEnd = std::min(cornerCount, (chunkID + 1u) * chunkSize);
+            uint32_t vertexID = chunkOffsets[chunkID];
+
+            for (uint32_t i = chunkID * chunkSize; i < cornerEnd; ++i) {
+                uint32_t slot = indicesOut[i];
+
+                if (welder->firstCorners[slot].load(std::memory_order_relaxed) == i) {
+                    uint64_t key = welder->keys[slot].load(std::memory_order_relaxed);
+                    uint32_t bx = (uint32_t)(key >> 32u), by = (uint32_t)key;
+
+                    memcpy(&verticesOut[vertexID][0], &bx, sizeof(bx));
+                    memcpy(&verticesOut[vertexID][1], &by, sizeof(by));
+                    welder->vertexIDs[slot] = vertexID++;
+                }
+            }
+        }
+    });
+
+    lebcpu_ParallelFor(pool, cornerCount, 3u * LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i)
+            indicesOut[i] = welder->vertexIDs[indicesOut[i]];
+    });
+
+    return chunkOffsets[chunkCount];
+}
+
+template <typename Heap> inline uint32_t
+lebcpu_ExtractMesh(
+    const Heap *leb,
+    lebcpu_Mode mode,
+    const float rootAttributeArray[2][3],
+    lebcpu_VertexWelder *welder,
+    float (*verticesOut)[2],
+    uint32_t *indicesOut,
+    lebcpu_ThreadPool *pool = NULL
+) {
+    if (mode == LEBCPU_MODE_TRIANGLE)
+        return lebcpu_ExtractMesh<lebcpu_TriangleMode>(leb, rootAttributeArray,
+                                                       welder, verticesOut,
+                                                       indicesOut, pool);
+    else
+        return lebcpu_ExtractMesh<lebcpu_QuadMode>(leb, rootAttributeArray,
+                                                   welder, verticesOut,
+                                                   indicesOut, pool);
+}
+
+
+// *****************************************************************************
+// Forests
+//
+// A conforming subdivision of a base mesh made of many root triangles, each
+// refined in its own leb_Heap. Each root is a triangle (v0, v1, v2) whose
+// first bisection splits its edge v0-v2, as for the roots of
+// leb_DecodeNodeAttributeArray. An adjacency table gives the roots across the
+// edges v1-v2 (left), v0-v1 (right) and v0-v2 (edge) of each root, through
+// which conforming splits propagate from one root to the next. Adjacent roots
+// must share their edges with matching roles: the left edge of a root is the
+// right edge of its left neighbor, and two roots that share their edge v0-v2
+// do so with opposite orientations. Any polygon mesh satisfies this with one
+// root per halfedge h, namely the triangle (vertex of h, center of the face
+// of h, vertex of next(h)), see lebcpu_BuildHalfedgeForestRoots.
+//
+// Neighbors are decoded as within a single heap, using 64-bit IDs whose bits
+// above the depth of a node encode its root: the node of ID id in the heap of
+// root r has the ID id + (r << depth). Passes are distributed over chunks of
+// the leaves of all the roots with lebcpu_ParallelForStealing, so that they
+// scale with the number of roots as well as with the number of leaves.
+
+#define LEBCPU_NULL_ROOT 0xFFFFFFFFu
+
+struct lebcpu_ForestRoot {
+    uint32_t left, right, edge; // adjacent roots, or LEBCPU_NULL_ROOT
+};
+
+struct lebcpu_ForestNode {
+    uint32_t rootID;
+    leb_Node node;
+};
+
+struct lebcpu_ForestDiamond {
+    lebcpu_ForestNode base, top;
+};
+
+struct lebcpu_Forest {
+    std::vector<leb_Heap *> heaps;
+    std::vector<lebcpu_DirtyMask *> masks;
+    std::vector<lebcpu_ForestRoot> roots;
+    std::vector<uint32_t> handleOffsets; // handle of the first leaf of each root
+    int minDepth, maxDepth;
+};
+
+// computes the handle of the first leaf of each root
+inline void lebcpu__UpdateForestHandles(lebcpu_Forest *forest)
+{
+    const uint32_t rootCount = (uint32_t)forest->heaps.size();
+
+    forest->handleOffsets.resize(rootCount + 1u);
+    forest->handleOffsets[0] = 0u;
+    for (uint32_t i = 0; i < rootCount; ++i) {
+        forest->handleOffsets[i + 1] = forest->handleOffsets[i]
+                                     + lebcpu_NodeCount(forest->heaps[i]);
+    }
+}
+
+// heaps have a maximum depth of maxDepth within their root, and so use
+// 2^(maxDepth - 1) bytes each
+inline lebcpu_Forest *
+lebcpu_CreateForest(
+    const lebcpu_ForestRoot *roots,
+    uint32_t rootCount,
+    int minDepth,
+    int maxDepth
+) {
+    lebcpu_Forest *forest = new lebcpu_Forest;
+
+    forest->roots.assign(roots, roots + rootCount);
+    forest->minDepth = minDepth;
+    forest->maxDepth = maxDepth;
+
+    for (uint32_t i = 0; i < rootCount; ++i) {
+        leb_Heap *heap = leb_CreateMinMax(minDepth, maxDepth);
+
+        leb_ResetToRoot(heap);
+        forest->heaps.push_back(heap);
+        forest->masks.push_back(lebcpu_CreateDirtyMask(heap));
+    }
+    lebcpu__UpdateForestHandles(forest);
+
+    return forest;
+}
+
+inline void lebcpu_ReleaseForest(lebcpu_Forest *forest)
+{
+    for (size_t i = 0; i < forest->heaps.size(); ++i) {
+        leb_Release(forest->heaps[i]);
+        lebcpu_ReleaseDirtyMask(forest->masks[i]);
+    }
+
+    delete forest;
+}
+
+inline void lebcpu_ResetForestToRoot(lebcpu_Forest *forest)
+{
+    for (size_t i = 0; i < forest->heaps.size(); ++i) {
+        leb_ResetToRoot(forest->heaps[i]);
+        lebcpu_ClearDirtyMask(forest->masks[i]);
+    }
+    lebcpu__UpdateForestHandles(forest);
+}
+
+// fills the adjacency of the roots of a polygon mesh, one per halfedge;
+// twins[h] is LEBCPU_NULL_ROOT for the halfedges of the boundary. The
+// vertices of root h are (vertex of h, center of its face, vertex of next(h))
+inline void
+lebcpu_BuildHalfedgeForestRoots(
+    const uint32_t *twins,
+    const uint32_t *nexts,
+    uint32_t halfedgeCount,
+    lebcpu_ForestRoot *rootsOut
+) {
+    for (uint32_t h = 0; h < halfedgeCount; ++h) {
+        rootsOut[h].left = nexts[h];
+        rootsOut[h].edge = twins[h];
+        rootsOut[nexts[h]].right = h;
+    }
+}
+
+inline uint32_t lebcpu_ForestNodeCount(const lebcpu_Forest *forest)
+{
+    return forest->handleOffsets.back();
+}
+
+// same as leb_DecodeNode, over the leaves of all the roots in order
+inline lebcpu_ForestNode
+lebcpu_DecodeForestNode(const lebcpu_Forest *forest, uint32_t handle)
+{
+    const std::vector<uint32_t> &offsets = forest->handleOffsets;
+    uint32_t rootID = (uint32_t)(std::upper_bound(offsets.begin(), offsets.end(),
+                                                  handle) - offsets.begin()) - 1u;
+    lebcpu_ForestNode node = {
+        rootID, lebcpu_DecodeNode(forest->heaps[rootID], handle - offsets[rootID])
+    };
+
+    return node;
+}
+
+struct lebcpu__ForestNeighborIDs {
+    uint64_t left, right, edge, node;
+};
+
+inline uint64_t lebcpu__ForestRootID(uint32_t rootID)
+{
+    return rootID == LEBCPU_NULL_ROOT ? 0u : (uint64_t)rootID + 1u;
+}
+
+// same as lebcpu_DecodeSameDepthNeighborIDs, across roots
+inline lebcpu__ForestNeighborIDs
+lebcpu__DecodeForestNeighborIDs(
+    const lebcpu_Forest *forest,
+    const lebcpu_ForestNode node
+) {
+    const lebcpu_ForestRoot &root = forest->roots[node.rootID];
+    lebcpu__ForestNeighborIDs ids = {
+        lebcpu__ForestRootID(root.left),
+        lebcpu__ForestRootID(root.right),
+        lebcpu__ForestRootID(root.edge),
+        lebcpu__ForestRootID(node.rootID)
+    };
+
+    for (int bitID = node.node.depth - 1; bitID >= 0; --bitID) {
+        uint64_t n1 = ids.left, n2 = ids.right, n3 = ids.edge, n4 = ids.node;
+        uint64_t b2 = (n2 == 0u) ? 0u : 1u,
+                 b3 = (n3 == 0u) ? 0u : 1u;
+
+        if (((node.node.id >> bitID) & 1u) == 0u) {
+            lebcpu__ForestNeighborIDs childIDs = {n4 << 1 | 1, n3 << 1 | b3, n2 << 1 | b2, n4 << 1};
+
+            ids = childIDs;
+        } else {
+            lebcpu__ForestNeighborIDs childIDs = {n3 << 1    , n4 << 1     , n1 << 1     , n4 << 1 | 1};
+
+            ids = childIDs;
+        }
+    }
+
+    return ids;
+}
+
+// converts a neighbor ID; returns false if there is no neighbor
+inline bool
+lebcpu__ForestNodeFromID(uint64_t id, int depth, lebcpu_ForestNode *node)
+{
+    if (id == 0u)
+        return false;
+
+    uint64_t rootID = (id >> depth) - 1u;
+
+    node->rootID = (uint32_t)rootID;
+    node->node = lebcpu__CreateNode((uint32_t)(id - (rootID << depth)), depth);
+
+    return true;
+}
+
+inline bool
+lebcpu__ForestEdgeNeighbor(
+    const lebcpu_Forest *forest,
+    const lebcpu_ForestNode node,
+    lebcpu_ForestNode *neighbor
+) {
+    uint64_t edgeID = lebcpu__DecodeForestNeighborIDs(forest, node).edge;
+
+    return lebcpu__ForestNodeFromID(edgeID, node.node.depth, neighbor);
+}
+
+// same as lebcpu_DecodeDiamondParent; node must not be a root
+inline lebcpu_ForestDiamond
+lebcpu_DecodeForestDiamondParent(
+    const lebcpu_Forest *forest,
+    const lebcpu_ForestNode node
+) {
+    lebcpu_ForestDiamond diamond;
+
+    diamond.base.rootID = node.rootID;
+    diamond.base.node = lebcpu__CreateNode(node.node.id >> 1u, node.node.depth - 1);
+    if (!lebcpu__ForestEdgeNeighbor(forest, diamond.base, &diamond.top))
+        diamond.top = diamond.base;
+
+    return diamond;
+}
+
+// same as lebcpu_SplitNodeConforming; the walk crosses root boundaries
+inline uint32_t
+lebcpu_SplitForestNodeConforming(
+    lebcpu_Forest *forest,
+    const lebcpu_ForestNode node
+) {
+    lebcpu_ForestNode nodeIterator = node;
+    uint32_t splitCount = 1u;
+
+    if (!lebcpu__SplitNode(forest->heaps[node.rootID], node.node,
+                           forest->masks[node.rootID]))
+        return 0u;
+
+    while (lebcpu__ForestEdgeNeighbor(forest, nodeIterator, &nodeIterator)) {
+        if (!lebcpu__SplitNode(forest->heaps[nodeIterator.rootID],
+                               nodeIterator.node,
+                               forest->masks[nodeIterator.rootID]))
+            break;
+        ++splitCount;
+
+        if (nodeIterator.node.depth == 0)
+            break;
+
+        nodeIterator.node = lebcpu__CreateNode(nodeIterator.node.id >> 1u,
+                                               nodeIterator.node.depth - 1);
+        if (!lebcpu__SplitNode(forest->heaps[nodeIterator.rootID],
+                               nodeIterator.node,
+                               forest->masks[nodeIterator.rootID]))
+            break;
+        ++splitCount;
+    }
+
+    return splitCount;
+}
+
+// same as lebcpu_MergeNodeConforming; both halves of the diamond may belong
+// to different roots
+inline uint32_t
+lebcpu_MergeForestNodeConforming(
+    lebcpu_Forest *forest,
+    const lebcpu_ForestNode node,
+    const lebcpu_ForestDiamond diamond
+) {
+    if (node.node.depth > forest->minDepth) {
+        const leb_Heap *heap = forest->heaps[node.rootID];
+        const leb_Heap *dualHeap = forest->heaps[diamond.top.rootID];
+        leb_Node dualNode = lebcpu__CreateNode(diamond.top.node.id << 1u | 1u,
+                                               diamond.top.node.depth + 1);
+        bool b1 = lebcpu_IsLeafNode(heap, node.node);
+        bool b2 = lebcpu_IsLeafNode(heap, lebcpu__CreateNode(node.node.id ^ 1u,
+                                                             node.node.depth));
+        bool b3 = lebcpu_IsLeafNode(dualHeap, dualNode);
+        bool b4 = lebcpu_IsLeafNode(dualHeap, lebcpu__CreateNode(dualNode.id ^ 1u,
+                                                                 dualNode.depth));
+
+        if (b1 && b2 && b3 && b4) {
+            return lebcpu__MergeNode(forest->heaps[node.rootID], node.node,
+                                     forest->masks[node.rootID])
+                 + lebcpu__MergeNode(forest->heaps[diamond.top.rootID], dualNode,
+                                     forest->masks[diamond.top.rootID]);
+        }
+    }
+
+    return 0u;
+}
+
+// leaves [begin, end) of a root
+struct lebcpu__ForestTask {
+    uint32_t rootID, begin, end;
+};
+
+inline std::vector<lebcpu__ForestTask>
+lebcpu__CreateForestTasks(const lebcpu_Forest *forest)
+{
+    std::vector<lebcpu__ForestTask> tasks;
+
+    for (uint32_t i = 0; i < (uint32_t)forest->heaps.size(); ++i) {
+        uint32_t nodeCount = forest->handleOffsets[i + 1] - forest->handleOffsets[i];
+
+        for (uint32_t begin = 0u; begin < nodeCount; begin+= LEBCPU_GRAIN_SIZE) {
+            lebcpu__ForestTask task = {
+                i, begin, std::min(begin + LEBCPU_GRAIN_SIZE, nodeCount)
+            };
+
+            tasks.push_back(task);
+        }
+    }
+
+    return tasks;
+}
+
+// same as lebcpu_SplitPassBatch; the nodes of a batch belong to the same root
+template <typename BatchPredicate> inline uint32_t
+lebcpu_ForestSplitPassBatch(
+    lebcpu_Forest *forest,
+    const BatchPredicate &shouldSplit,  // uint32_t(const lebcpu_ForestNode *, int)
+    lebcpu_ThreadPool *pool
+) {
+    const std::vector<lebcpu__ForestTask> tasks = lebcpu__CreateForestTasks(forest);
+    std::atomic<uint32_t> splitCount(0u);
+
+    lebcpu_ParallelForStealing(pool, (uint32_t)tasks.size(), [&](uint32_t taskID) {
+        const lebcpu__ForestTask task = tasks[taskID];
+        lebcpu_ForestNode nodes[LEBCPU_BATCH_SIZE];
+        int nodeCount = 0;
+        uint32_t count = 0u;
+        auto flush = [&]() {
+            uint32_t hits = shouldSplit(nodes, nodeCount)
+                          & ((1u << nodeCount) - 1u);
+
+            for (; hits != 0u; hits&= hits - 1u) {
+                const lebcpu_ForestNode node = nodes[lebcpu__TrailingZeros32(hits)];
+
+                count+= lebcpu_SplitForestNodeConforming(forest, node);
+            }
+            nodeCount = 0;
+        };
+
+        lebcpu_ForEachLeaf(forest->heaps[task.rootID], task.begin, task.end,
+                           [&](uint32_t, const leb_Node node) {
+            nodes[nodeCount].rootID = task.rootID;
+            nodes[nodeCount].node = node;
+
+            if (++nodeCount == LEBCPU_BATCH_SIZE)
+                flush();
+        });
+
+        if (nodeCount > 0)
+            flush();
+        splitCount+= count;
+    });
+
+    return splitCount.load();
+}
+
+// same as lebcpu_MergePassBatch
+template <typename BatchPredicate> inline uint32_t
+lebcpu_ForestMergePassBatch(
+    lebcpu_Forest *forest,
+    const BatchPredicate &shouldMerge,  // uint32_t(const lebcpu_ForestDiamond *, int)
+    lebcpu_ThreadPool *pool
+) {
+    const std::vector<lebcpu__ForestTask> tasks = lebcpu__CreateForestTasks(forest);
+    std::atomic<uint32_t> mergeCount(0u);
+
+    lebcpu_ParallelForStealing(pool, (uint32_t)tasks.size(), [&](uint32_t taskID) {
+        const lebcpu__ForestTask task = tasks[taskID];
+        lebcpu_ForestNode nodes[LEBCPU_BATCH_SIZE];
+        lebcpu_ForestDiamond diamonds[LEBCPU_BATCH_SIZE];
+        int nodeCount = 0;
+        uint32_t count = 0u;
+        auto flush = [&]() {
+            uint32_t hits = shouldMerge(diamonds, nodeCount)
+                          & ((1u << nodeCount) - 1u);
+
+            for (; hits != 0u; hits&= hits - 1u) {
+                uint32_t i = lebcpu__TrailingZeros32(hits);
+
+                count+= lebcpu_MergeForestNodeConforming(forest, nodes[i],
+                                                         diamonds[i]);
+            }
+            nodeCount = 0;
+        };
+
+        lebcpu_ForEachLeaf(forest->heaps[task.rootID], task.begin, task.end,
+                           [&](uint32_t, const leb_Node node) {
+            // roots have no diamond
+            if (node.depth == 0)
+                return;
+
+            nodes[nodeCount].rootID = task.rootID;
+            nodes[nodeCount].node = node;
+            diamonds[nodeCount] = lebcpu_DecodeForestDiamondParent(forest,
+                                                                   nodes[nodeCount]);
+
+            if (++nodeCount == LEBCPU_BATCH_SIZE)
+                flush();
+        });
+
+        if (nodeCount > 0)
+            flush();
+        mergeCount+= count;
+    });
+
+    return mergeCount.load();
+}
+
+// same as lebcpu_UpdateSumReduction, for each root
+inline uint32_t
+lebcpu_UpdateForestSumReduction(lebcpu_Forest *forest, lebcpu_ThreadPool *pool)
+{
+    std::atomic<uint32_t> nodeCount(0u);
+
+    lebcpu_ParallelForStealing(pool, (uint32_t)forest->heaps.size(),
+                               [&](uint32_t rootID) {
+        nodeCount+= lebcpu_UpdateSumReduction(forest->heaps[rootID],
+                                              forest->masks[rootID], NULL);
+    });
+    lebcpu__UpdateForestHandles(forest);
+
+    return nodeCount.load();
+}
+
+// same as lebcpu_DecodeTriangleBatch, for nodes of any root;
+// rootAttributeArrays[r] holds the vertices of root r
+inline void
+lebcpu_DecodeForestTriangleBatch(
+    const lebcpu_ForestNode *nodes,
+    int nodeCount,
+    const float (*rootAttributeArrays)[2][3],
+    lebcpu_TriangleBatch *batch
+) {
+    uint32_t nodeIDs[LEBCPU_BATCH_SIZE];
+    uint32_t nodeDepths[LEBCPU_BATCH_SIZE];
+    uint32_t windingBits[LEBCPU_BATCH_SIZE];
+    lebcpu_TriangleBatch roots;
+    int maxDepth = 0;
+
+    for (int i = 0; i < LEBCPU_BATCH_SIZE; ++i) {
+        lebcpu_ForestNode node = i < nodeCount ? nodes[i] : nodes[0];
+
+        nodeIDs[i] = node.node.id;
+        nodeDepths[i] = (uint32_t)node.node.depth;
+        windingBits[i] = (uint32_t)node.node.depth & 1u;
+        maxDepth = std::max(maxDepth, node.node.depth);
+
+        for (int j = 0; j < 3; ++j) {
+            roots.x[j][i] = rootAttributeArrays[node.rootID][0][j];
+            roots.y[j][i] = rootAttributeArrays[node.rootID][1][j];
+        }
+    }
+
+    for (int lane = 0; lane < LEBCPU_BATCH_SIZE; lane+= 4) {
+        lebcpu__DecodeTriangleLanes<lebcpu_TriangleMode>(nodeIDs, nodeDepths,
+                                                         windingBits, maxDepth,
+                                                         &roots, batch, lane);
+    }
+}
+
+#endif // LEBCPU_INCLUDE_LEBCPU_H
@@ -0,0 +1,288 @@
+/* LongestEdgeBisectionSnapshot.h - public domain
+by Jonathan Dupuy
+
+    On-disk snapshots of a leb_Heap, used to start the demos from an already
+    converged subdivision.
+
+    A snapshot file is a 16-byte header followed by the exact contents of the
+    LEB buffer of the GPU implementation, i.e., the minimum and maximum depths
+    as 32-bit integers followed by the heap:
+
+        offset  size        content
+        0       4           magic "LEBS"
+        4       4           format version (LEBSNAP_VERSION)
+        8       4           heap byte size, i.e., leb__HeapByteSize(maxDepth)
+        12      4           subdivision mode (lebsnap_Mode)
+        16      4           minDepth
+        20      4           maxDepth
+        24      heap size   heap bitfield, including its sum reduction
+
+    Loading maps the file in memory rather than reading it, so that the heap
+    can be used, or uploaded to the GPU, without any copy. The mapping is
+    private: modifying the heap never writes back to the file. Values are
+    stored in the byte order of the host. A heap only makes sense for the
+    mode it was subdivided with, so snapshots of another mode are rejected.
+
+    Do this:
+        #define LEBSNAP_IMPLEMENTATION
+    before you include this file in *one* C++ file to create the
+    implementation.
+
+    This code has dependencies on the following sources:
+    - LongestEdgeBisection.h
+*/
+#ifndef LEBSNAP_INCLUDE_LEBSNAP_H
+#define LEBSNAP_INCLUDE_LEBSNAP_H
+
+#ifdef LEBSNAP_STATIC
+#   define LEBSNAPDEF static
+#else
+#   define LEBSNAPDEF extern
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LEBSNAP_VERSION 2
+
+// subdivision mode of the heap; the values match those of lebcpu_Mode
+typedef enum {
+    LEBSNAP_MODE_TRIANGLE,
+    LEBSNAP_MODE_QUAD
+} lebsnap_Mode;
+
+typedef struct {
+    leb_Heap heap;              // views the mapped heap; not to be released
+    const void *gpuBuffer;      // contents of the GPU LEB buffer
+    uint32_t gpuBufferByteSize;
+    void *mapping;              // base address of the mapping
+    size_t mappingByteSize;
+} lebsnap_Snapshot;
+
+// writes a heap to disk; returns false on failure
+LEBSNAPDEF bool
+lebsnap_Save(const char *pathToFile, const leb_Heap *leb, lebsnap_Mode mode);
+
+// writes the contents of a GPU LEB buffer to disk
+LEBSNAPDEF bool
+lebsnap_SaveBuffer(const char *pathToFile, const void *gpuBuffer, lebsnap_Mode mode);
+
+// maps a snapshot file; returns NULL if the file is missing, invalid, or of
+// another mode
+LEBSNAPDEF lebsnap_Snapshot *lebsnap_Load(const char *pathToFile, lebsnap_Mode mode);
+LEBSNAPDEF void lebsnap_Release(lebsnap_Snapshot *snapshot);
+
+#endif // LEBSNAP_INCLUDE_LEBSNAP_H
+
+
+/*******************************************************************************
+ * Implementation
+ *
+ */
+#if defined(LEBSNAP_IMPLEMENTATION) && !defined(LEBSNAP__IMPLEMENTATION_INCLUDED)
+#define LEBSNAP__IMPLEMENTATION_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#ifndef LEBSNAP_LOG
+#   define LEBSNAP_LOG(format, ...) do { fprintf(stderr, format, ##__VA_ARGS__); fflush(stderr); } while(0)
+#endif
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t heapByteSize;
+    uint32_t mode;
+} lebsnap__Header;
+
+static const char lebsnap__Magic[4] = {'L', 'E', 'B', 'S'};
+
+
+/*******************************************************************************
+ * Save -- Writes the header followed by the GPU buffer layout
+ *
+ */
+static bool
+lebsnap__Write(
+    const char *pathToFile,
+    int32_t minDepth,
+    int32_t maxDepth,
+    const void *heapBuffer,
+    lebsnap_Mode mode
+) {
+    lebsnap__Header header;
+    FILE *pf = fopen(pathToFile, "wb");
+    bool success;
+
+    if (!pf) {
+        LEBSNAP_LOG("lebsnap: fopen failed (%s)\n", pathToFile);
+
+        return false;
+    }
+
+    memcpy(header.magic, lebsnap__Magic, sizeof(header.magic));
+    header.version = LEBSNAP_VERSION;
+    header.heapByteSize = leb__HeapByteSize(maxDepth);
+    header.mode = (uint32_t)mode;
+
+    success = fwrite(&header, sizeof(header), 1, pf) == 1
+           && fwrite(&minDepth, sizeof(minDepth), 1, pf) == 1
+           && fwrite(&maxDepth, sizeof(maxDepth), 1, pf) == 1
+           && fwrite(heapBuffer, header.heapByteSize, 1, pf) == 1;
+    success = (fclose(pf) == 0) && success;
+
+    if (!success)
+        LEBSNAP_LOG("lebsnap: write failed (%s)\n", pathToFile);
+
+    return success;
+}
+
+LEBSNAPDEF bool
+lebsnap_Save(const char *pathToFile, const leb_Heap *leb, lebsnap_Mode mode)
+{
+    return lebsnap__Write(pathToFile, leb->minDepth, leb->maxDepth,
+                          leb->buffer, mode);
+}
+
+LEBSNAPDEF bool
+lebsnap_SaveBuffer(const char *pathToFile, const void *gpuBuffer, lebsnap_Mode mode)
+{
+    const int32_t *depths = (const int32_t *)gpuBuffer;
+
+    return lebsnap__Write(pathToFile, depths[0], depths[1], &depths[2], mode);
+}
+
+
+/*******************************************************************************
+ * Load -- Maps the file and validates its header
+ *
+ */
+static void *lebsnap__Map(const char *pathToFile, size_t *byteSize)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(pathToFile, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE mapping;
+    LARGE_INTEGER fileSize;
+    void *data = NULL;
+
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            *byteSize = (size_t)fileSize.QuadPart;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+
+    return data;
+#else
+    int fd = open(pathToFile, O_RDONLY);
+    struct stat st;
+    void *data = NULL;
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED)
+            data = NULL;
+        else
+            *byteSize = (size_t)st.st_size;
+    }
+    close(fd);
+
+    return data;
+#endif
+}
+
+static void lebsnap__Unmap(void *data, size_t byteSize)
+{
+#ifdef _WIN32
+    (void)byteSize;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, byteSize);
+#endif
+}
+
+LEBSNAPDEF lebsnap_Snapshot *lebsnap_Load(const char *pathToFile, lebsnap_Mode mode)
+{
+    const size_t headerByteSize = sizeof(lebsnap__Header) + 2 * sizeof(int32_t);
+    size_t byteSize = 0;
+    void *data = lebsnap__Map(pathToFile, &byteSize);
+    const lebsnap__Header *header;
+    int32_t *gpuBuffer;
+    lebsnap_Snapshot *snapshot;
+
+    if (!data)
+        return NULL;
+
+    header = (const lebsnap__Header *)data;
+    gpuBuffer = (int32_t *)((char *)data + sizeof(lebsnap__Header));
+
+    if (byteSize < headerByteSize
+        || memcmp(header->magic, lebsnap__Magic, sizeof(header->magic))
+        || header->version != LEBSNAP_VERSION
+        || gpuBuffer[1] < 1 || gpuBuffer[1] > 31
+        || gpuBuffer[0] < 0 || gpuBuffer[0] > gpuBuffer[1]
+        || header->heapByteSize != leb__HeapByteSize(gpuBuffer[1])
+        || byteSize < headerByteSize + header->heapByteSize) {
+        LEBSNAP_LOG("lebsnap: invalid snapshot (%s)\n", pathToFile);
+        lebsnap__Unmap(data, byteSize);
+
+        return NULL;
+    }
+
+    if (header->mode != (uint32_t)mode) {
+        LEBSNAP_LOG("lebsnap: snapshot of another mode (%s)\n", pathToFile);
+        lebsnap__Unmap(data, byteSize);
+
+        return NULL;
+    }
+
+    snapshot = (lebsnap_Snapshot *)malloc(sizeof(*snapshot));
+    snapshot->heap.buffer = (uint32_t *)&gpuBuffer[2];
+    snapshot->heap.minDepth = gpuBuffer[0];
+    snapshot->heap.maxDepth = gpuBuffer[1];
+    snapshot->gpuBuffer = gpuBuffer;
+    snapshot->gpuBufferByteSize = (uint32_t)(2 * sizeof(int32_t))
+                                + header->heapByteSize;
+    snapshot->mapping = data;
+    snapshot->mappingByteSize = byteSize;
+
+    return snapshot;
+}
+
+LEBSNAPDEF void lebsnap_Release(lebsnap_Snapshot *snapshot)
+{
+    lebsnap__Unmap(snapshot->mapping, snapshot->mappingByteSize);
+    free(snapshot);
+}
+
+#endif // LEBSNAP_IMPLEMENTATION
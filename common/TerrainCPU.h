@@ -0,0 +1,620 @@
+/* TerrainCPU.h - public domain
+by Jonathan Dupuy
+
+    CPU implementation of the level-of-detail pipeline of the Terrain demo,
+    i.e., the split and merge passes of TerrainUpdateCS.glsl along with the
+    tests of TerrainRenderCommon.glsl they rely on (LevelOfDetail,
+    FrustumCullingTest, DisplacementVarianceTest and TriangleLevelOfDetail_*).
+    It computes the same subdivision as the GPU without any graphics API,
+    e.g., on a server, or to benchmark the algorithm.
+
+    The displacement map is sampled from the levels of a heightmap container
+    the way the shaders sample the dmap texture: texture() is a bilinear
+    lookup in the first level, and textureGrad() a trilinear lookup whose
+    level is selected from the gradients, both clamped to the edges.
+    Displaced triangles are culled with the height bounds of the min/max
+    pyramid of the displacement map, if provided, and with the whole range
+    of heights otherwise, as for tiled heightmaps.
+
+    The passes run on a leb_Heap or a lebcpu_SparseHeap, in quad mode, over
+    the threads of a lebcpu_ThreadPool. As on the GPU, each update runs
+    either a split or a merge pass, in alternation, which is followed by a
+    sum reduction; the visible leaves are then listed by their node ID, as
+    TerrainUpdateCS.glsl writes them in its node buffer.
+
+    Matrices are row-major, as in dj_algebra (the demo transposes them before
+    uploading them to the GPU).
+
+    This code has dependencies on the following sources:
+    - LongestEdgeBisection.h
+    - LongestEdgeBisectionCPU.h
+    - HeightmapContainer.h
+*/
+#ifndef TERRAINCPU_INCLUDE_TERRAINCPU_H
+#define TERRAINCPU_INCLUDE_TERRAINCPU_H
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+enum terraincpu_Projection {
+    TERRAINCPU_PROJECTION_ORTHOGRAPHIC,
+    TERRAINCPU_PROJECTION_RECTILINEAR,
+    TERRAINCPU_PROJECTION_FISHEYE
+};
+
+// min/max pyramid of a displacement map (see hmap_ComputeHeightBounds)
+struct terraincpu_DmapBoundsLevel {
+    int width, height;
+    std::vector<uint16_t> texels; // (min, max) pairs
+};
+
+struct terraincpu_DmapBounds {
+    int width, height;            // size of the displacement map
+    std::vector<terraincpu_DmapBoundsLevel> levels;
+};
+
+// equivalent of the uniforms of the terrain programs
+struct terraincpu_Terrain {
+    float modelViewMatrix[4][4];
+    float frustumPlanes[6][4];
+    terraincpu_Projection projection;
+    float lodFactor;
+    const hmap_Heightmap *dmap;              // NULL if not displaced
+    const terraincpu_DmapBounds *dmapBounds; // NULL to cull with [0, dmapFactor]
+    float dmapFactor;
+    float minLodVariance;
+    bool cull;                               // whether culled nodes are reported
+};
+
+// first component of vec2 LevelOfDetail, and whether the second is non-zero
+struct terraincpu_Lod {
+    float value;
+    bool visible;
+};
+
+
+// *****************************************************************************
+// Uniforms
+//
+// Same as the uniforms set by loadTerrainVariables and configureTerrainProgram.
+
+// frustum planes of a modelview-projection matrix, scaled as in the demo
+inline void
+terraincpu_LoadFrustumPlanes(const float mvp[4][4], float planes[6][4])
+{
+    for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 2; ++j) {
+        float *plane = planes[i * 2 + j];
+
+        for (int k = 0; k < 4; ++k)
+            plane[k] = mvp[3][k] + (j == 0 ? mvp[i][k] : -mvp[i][k]);
+
+        float norm = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1]
+                             + plane[2] * plane[2]);
+
+        for (int k = 0; k < 4; ++k)
+            plane[k]*= norm;
+    }
+}
+
+// u_LodFactor, for a vertical field of view given in degrees
+inline float
+terraincpu_LodFactor(
+    terraincpu_Projection projection,
+    float fovy,
+    int framebufferHeight,
+    int gpuSubd,
+    float primitivePixelLengthTarget
+) {
+    const float radians = fovy * 3.14159265358979f / 180.0f;
+
+    if (projection == TERRAINCPU_PROJECTION_RECTILINEAR) {
+        float tmp = 2.0f * std::tan(radians / 2.0f)
+            / framebufferHeight * (1 << gpuSubd)
+            * primitivePixelLengthTarget;
+
+        return -2.0f * std::log2(tmp) + 2.0f;
+    } else if (projection == TERRAINCPU_PROJECTION_ORTHOGRAPHIC) {
+        float planeSize = 2.0f * std::tan(radians / 2.0f);
+        float targetSize = planeSize * primitivePixelLengthTarget
+                         / framebufferHeight * (1 << gpuSubd);
+
+        return -2.0f * std::log2(targetSize);
+    }
+
+    return 1.0f;
+}
+
+// u_MinLodVariance
+inline float terraincpu_MinLodVariance(float minLodStdev, float dmapScale)
+{
+    float tmp = minLodStdev / 64.0f / dmapScale;
+
+    return tmp * tmp;
+}
+
+
+// *****************************************************************************
+// Displacement Map Sampling
+
+inline void
+terraincpu__FetchDmap(const hmap_Level *level, int x, int y, float texel[2])
+{
+    x = std::min(std::max(x, 0), level->width - 1);
+    y = std::min(std::max(y, 0), level->height - 1);
+
+    const uint16_t *dmap = &level->dmap[2 * ((size_t)x + (size_t)level->width * y)];
+
+    texel[0] = dmap[0] / 65535.0f;
+    texel[1] = dmap[1] / 65535.0f;
+}
+
+// bilinear lookup in a level, with GL_CLAMP_TO_EDGE
+inline void
+terraincpu__SampleDmapLevel(
+    const hmap_Level *level,
+    float u,
+    float v,
+    float dmap[2]
+) {
+    float x = std::min(std::max(u, 0.0f), 1.0f) * level->width - 0.5f;
+    float y = std::min(std::max(v, 0.0f), 1.0f) * level->height - 0.5f;
+    float x0 = std::floor(x), y0 = std::floor(y);
+    float fx = x - x0, fy = y - y0;
+    int i = (int)x0, j = (int)y0;
+    float t00[2], t10[2], t01[2], t11[2];
+
+    terraincpu__FetchDmap(level, i    , j    , t00);
+    terraincpu__FetchDmap(level, i + 1, j    , t10);
+    terraincpu__FetchDmap(level, i    , j + 1, t01);
+    terraincpu__FetchDmap(level, i + 1, j + 1, t11);
+
+    for (int c = 0; c < 2; ++c) {
+        float a = t00[c] + fx * (t10[c] - t00[c]);
+        float b = t01[c] + fx * (t11[c] - t01[c]);
+
+        dmap[c] = a + fy * (b - a);
+    }
+}
+
+// equivalent of textureLod(u_DmapSampler, uv, lod).rg, with trilinear
+// filtering between levels
+inline void
+terraincpu_SampleDmap(
+    const hmap_Heightmap *heightmap,
+    float u,
+    float v,
+    float lod,
+    float dmap[2]
+) {
+    const int maxLevel = heightmap->levelCount - 1;
+
+    if (!(lod > 0.0f)) {
+        terraincpu__SampleDmapLevel(&heightmap->levels[0], u, v, dmap);
+    } else if (lod >= (float)maxLevel) {
+        terraincpu__SampleDmapLevel(&heightmap->levels[maxLevel], u, v, dmap);
+    } else {
+        int level = (int)lod;
+        float t = lod - (float)level;
+        float dmap1[2];
+
+        terraincpu__SampleDmapLevel(&heightmap->levels[level    ], u, v, dmap);
+        terraincpu__SampleDmapLevel(&heightmap->levels[level + 1], u, v, dmap1);
+        dmap[0]+= t * (dmap1[0] - dmap[0]);
+        dmap[1]+= t * (dmap1[1] - dmap[1]);
+    }
+}
+
+// equivalent of textureGrad(u_DmapSampler, uv, dx, dy).rg
+inline void
+terraincpu_SampleDmapGrad(
+    const hmap_Heightmap *heightmap,
+    float u,
+    float v,
+    const float dx[2],
+    const float dy[2],
+    float dmap[2]
+) {
+    const float w = (float)heightmap->width, h = (float)heightmap->height;
+    float rhoX = (dx[0] * w) * (dx[0] * w) + (dx[1] * h) * (dx[1] * h);
+    float rhoY = (dy[0] * w) * (dy[0] * w) + (dy[1] * h) * (dy[1] * h);
+    float lod = 0.5f * std::log2(std::max(rhoX, rhoY));
+
+    terraincpu_SampleDmap(heightmap, u, v, lod, dmap);
+}
+
+
+// computes the min/max pyramid of the first level of a displacement map, as
+// the demo does when it loads the dmap texture
+inline void
+terraincpu_ComputeDmapBounds(
+    const hmap_Heightmap *dmap,
+    terraincpu_DmapBounds *bounds,
+    int threadCount = 0
+) {
+    const int levelCount = hmap_HeightBoundsLevelCount(dmap->width, dmap->height);
+    int w = std::max(1, dmap->width >> 1), h = std::max(1, dmap->height >> 1);
+
+    bounds->width = dmap->width;
+    bounds->height = dmap->height;
+    bounds->levels.resize(levelCount);
+
+    for (int i = 0; i < levelCount; ++i) {
+        terraincpu_DmapBoundsLevel &level = bounds->levels[i];
+
+        level.width = w;
+        level.height = h;
+        level.texels.resize(2u * w * h);
+
+        if (i == 0) {
+            hmap_ComputeHeightBounds(dmap->levels[0].dmap, dmap->width,
+                                     dmap->height, &level.texels[0], threadCount);
+        } else {
+            const terraincpu_DmapBoundsLevel &parent = bounds->levels[i - 1];
+
+            hmap_ComputeNextHeightBounds(&parent.texels[0], parent.width,
+                                         parent.height, &level.texels[0]);
+        }
+
+        w = std::max(1, w >> 1);
+        h = std::max(1, h >> 1);
+    }
+}
+
+// DisplacementBounds, i.e., the range of the heights that bilinear lookups
+// within a region of the displacement map may return
+inline void
+terraincpu_DisplacementBounds(
+    const terraincpu_DmapBounds *bounds,
+    const float texCoordMin[2],
+    const float texCoordMax[2],
+    float range[2]
+) {
+    const int dmapSize[2] = {bounds->width, bounds->height};
+    int texelMin[2], texelMax[2];
+    int extent = 0, level = 0;
+
+    for (int i = 0; i < 2; ++i) {
+        float tmin = std::min(std::max(texCoordMin[i], 0.0f), 1.0f);
+        float tmax = std::min(std::max(texCoordMax[i], 0.0f), 1.0f);
+
+        texelMin[i] = (int)std::floor(tmin * dmapSize[i] - 0.5f);
+        texelMax[i] = (int)std::floor(tmax * dmapSize[i] - 0.5f) + 1;
+        texelMin[i] = std::min(std::max(texelMin[i], 0), dmapSize[i] - 1);
+        texelMax[i] = std::min(std::max(texelMax[i], 0), dmapSize[i] - 1);
+        extent = std::max(extent, texelMax[i] - texelMin[i]);
+    }
+
+    // findMSB(extent - 1)
+    if (extent > 2)
+        while (((extent - 1) >> (level + 1)) > 0)
+            ++level;
+    level = std::min(level, (int)bounds->levels.size() - 1);
+
+    const terraincpu_DmapBoundsLevel &boundsLevel = bounds->levels[level];
+    const int x[2] = {std::min(texelMin[0] >> (level + 1), boundsLevel.width - 1),
+                      std::min(texelMax[0] >> (level + 1), boundsLevel.width - 1)};
+    const int y[2] = {std::min(texelMin[1] >> (level + 1), boundsLevel.height - 1),
+                      std::min(texelMax[1] >> (level + 1), boundsLevel.height - 1)};
+    uint16_t zMin = 0xFFFF, zMax = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        const uint16_t *texel =
+            &boundsLevel.texels[2 * (x[i & 1] + (size_t)boundsLevel.width * y[i >> 1])];
+
+        zMin = std::min(zMin, texel[0]);
+        zMax = std::max(zMax, texel[1]);
+    }
+
+    range[0] = zMin / 65535.0f;
+    range[1] = zMax / 65535.0f;
+}
+
+
+// *****************************************************************************
+// Level of Detail
+//
+// Triangle vertices hold their (x, y, z) position in local space; their w
+// coordinate is always one.
+
+// DecodeTriangleVertices, for a batch of up to LEBCPU_BATCH_SIZE nodes
+inline void
+terraincpu_DecodeTriangleVertices(
+    const terraincpu_Terrain *terrain,
+    const leb_Node *nodes,
+    int nodeCount,
+    float vertices[][3][3]
+) {
+    const float rootAttributeArray[2][3] = {
+        {0.0f, 0.0f, 1.0f},
+        {1.0f, 0.0f, 0.0f}
+    };
+    lebcpu_TriangleBatch batch;
+
+    lebcpu_DecodeTriangleBatch<lebcpu_QuadMode>(nodes, nodeCount,
+                                                rootAttributeArray, &batch);
+
+    for (int i = 0; i < nodeCount; ++i)
+    for (int j = 0; j < 3; ++j) {
+        float *vertex = vertices[i][j];
+
+        vertex[0] = batch.x[j][i];
+        vertex[1] = batch.y[j][i];
+        vertex[2] = 0.0f;
+
+        if (terrain->dmap) {
+            float dmap[2];
+
+            terraincpu_SampleDmap(terrain->dmap, vertex[0], vertex[1], 0.0f, dmap);
+            vertex[2] = terrain->dmapFactor * dmap[0];
+        }
+    }
+}
+
+inline void
+terraincpu__ViewSpace(const float m[4][4], const float x[3], float y[3])
+{
+    for (int i = 0; i < 3; ++i)
+        y[i] = m[i][0] * x[0] + m[i][1] * x[1] + m[i][2] * x[2] + m[i][3];
+}
+
+inline float terraincpu__Dot(const float a[3], const float b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// TriangleLevelOfDetail; the fisheye projection uses the perspective LoD,
+// as in the shaders
+inline float
+terraincpu_TriangleLevelOfDetail(
+    const terraincpu_Terrain *terrain,
+    const float vertices[3][3]
+) {
+    float v0[3], v2[3];
+
+    terraincpu__ViewSpace(terrain->modelViewMatrix, vertices[0], v0);
+    terraincpu__ViewSpace(terrain->modelViewMatrix, vertices[2], v2);
+
+    if (terrain->projection == TERRAINCPU_PROJECTION_ORTHOGRAPHIC) {
+        float edgeVector[3] = {v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]};
+        float edgeLengthSqr = terraincpu__Dot(edgeVector, edgeVector);
+
+        return terrain->lodFactor + std::log2(edgeLengthSqr);
+    } else {
+        float sqrMagSum = terraincpu__Dot(v0, v0) + terraincpu__Dot(v2, v2);
+        float twoDotAC = 2.0f * terraincpu__Dot(v0, v2);
+        float distanceToEdgeSqr = sqrMagSum + twoDotAC;
+        float edgeLengthSqr     = sqrMagSum - twoDotAC;
+
+        return terrain->lodFactor + std::log2(edgeLengthSqr / distanceToEdgeSqr);
+    }
+}
+
+// DisplacementVarianceTest; always passes on flat terrains
+inline bool
+terraincpu_DisplacementVarianceTest(
+    const terraincpu_Terrain *terrain,
+    const float vertices[3][3]
+) {
+    if (!terrain->dmap)
+        return true;
+
+    const float *p0 = vertices[0], *p1 = vertices[1], *p2 = vertices[2];
+    float u = (p0[0] + p1[0] + p2[0]) / 3.0f;
+    float v = (p0[1] + p1[1] + p2[1]) / 3.0f;
+    float dx[2] = {p0[0] - p1[0], p0[1] - p1[1]};
+    float dy[2] = {p2[0] - p1[0], p2[1] - p1[1]};
+    float dmap[2];
+
+    terraincpu_SampleDmapGrad(terrain->dmap, u, v, dx, dy, dmap);
+
+    float dmapVariance = std::min(std::max(dmap[1] - dmap[0] * dmap[0], 0.0f),
+                                  1.0f);
+
+    return (dmapVariance >= terrain->minLodVariance);
+}
+
+// FrustumCullingTest
+inline bool
+terraincpu_FrustumCullingTest(
+    const terraincpu_Terrain *terrain,
+    const float vertices[3][3]
+) {
+    float bmin[3], bmax[3];
+    float a = 1.0f;
+
+    for (int i = 0; i < 3; ++i) {
+        bmin[i] = std::min(std::min(vertices[0][i], vertices[1][i]), vertices[2][i]);
+        bmax[i] = std::max(std::max(vertices[0][i], vertices[1][i]), vertices[2][i]);
+    }
+
+    if (terrain->dmap && terrain->dmapBounds) {
+        float range[2];
+
+        terraincpu_DisplacementBounds(terrain->dmapBounds, bmin, bmax, range);
+        bmin[2] = terrain->dmapFactor * range[0];
+        bmax[2] = terrain->dmapFactor * range[1];
+    } else if (terrain->dmap) {
+        bmin[2] = 0.0f;
+        bmax[2] = terrain->dmapFactor;
+    }
+
+    for (int i = 0; i < 6 && a >= 0.0f; ++i) {
+        const float *plane = terrain->frustumPlanes[i];
+        float n[3];
+
+        for (int j = 0; j < 3; ++j)
+            n[j] = plane[j] > 0.0f ? bmax[j] : bmin[j];
+
+        a = terraincpu__Dot(n, plane) + plane[3];
+    }
+
+    return (a >= 0.0f);
+}
+
+// LevelOfDetail
+inline terraincpu_Lod
+terraincpu_LevelOfDetail(
+    const terraincpu_Terrain *terrain,
+    const float vertices[3][3]
+) {
+    terraincpu_Lod lod = {0.0f, true};
+
+    // culling test
+    if (!terraincpu_FrustumCullingTest(terrain, vertices)) {
+        lod.visible = !terrain->cull;
+
+        return lod;
+    }
+
+    // variance test
+    if (!terraincpu_DisplacementVarianceTest(terrain, vertices))
+        return lod;
+
+    // compute triangle LOD
+    lod.value = terraincpu_TriangleLevelOfDetail(terrain, vertices);
+
+    return lod;
+}
+
+// bitmask of the nodes of a batch whose LoD is above (resp. below) one
+inline uint32_t
+terraincpu__LodTestBatch(
+    const terraincpu_Terrain *terrain,
+    const leb_Node *nodes,
+    int nodeCount,
+    bool above
+) {
+    float vertices[LEBCPU_BATCH_SIZE][3][3];
+    uint32_t mask = 0u;
+
+    terraincpu_DecodeTriangleVertices(terrain, nodes, nodeCount, vertices);
+
+    for (int i = 0; i < nodeCount; ++i) {
+        float lod = terraincpu_LevelOfDetail(terrain, vertices[i]).value;
+
+        if (above ? lod > 1.0f : lod < 1.0f)
+            mask|= 1u << i;
+    }
+
+    return mask;
+}
+
+
+// *****************************************************************************
+// Update Passes
+//
+// Same as TerrainUpdateCS.glsl compiled with FLAG_SPLIT (resp. FLAG_MERGE):
+// leaves whose LoD exceeds one are split conformingly, and leaves whose
+// diamond has both halves below one are merged. The passes return the number
+// of nodes they modified and leave the sum reduction stale.
+
+template <typename Heap> inline uint32_t
+terraincpu_SplitPass(
+    Heap *leb,
+    const terraincpu_Terrain *terrain,
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    return lebcpu_SplitPassBatch<lebcpu_QuadMode>(leb,
+                               [&](const leb_Node *nodes, int nodeCount) {
+        return terraincpu__LodTestBatch(terrain, nodes, nodeCount, true);
+    }, pool, mask);
+}
+
+template <typename Heap> inline uint32_t
+terraincpu_MergePass(
+    Heap *leb,
+    const terraincpu_Terrain *terrain,
+    lebcpu_ThreadPool *pool,
+    lebcpu_DirtyMask *mask = NULL
+) {
+    return lebcpu_MergePassBatch<lebcpu_QuadMode>(leb,
+                     [&](const leb_DiamondParent *diamonds, int nodeCount) {
+        leb_Node base[LEBCPU_BATCH_SIZE] = {}, top[LEBCPU_BATCH_SIZE] = {};
+
+        for (int i = 0; i < nodeCount; ++i) {
+            base[i] = diamonds[i].base;
+            top[i] = diamonds[i].top;
+        }
+
+        return terraincpu__LodTestBatch(terrain, base, nodeCount, false)
+             & terraincpu__LodTestBatch(terrain, top, nodeCount, false);
+    }, pool, mask);
+}
+
+// runs the split pass if pingPong is zero and the merge pass otherwise, and
+// updates the sum reduction; returns the number of modified nodes
+template <typename Heap> inline uint32_t
+terraincpu_Update(
+    Heap *leb,
+    const terraincpu_Terrain *terrain,
+    int pingPong,
+    lebcpu_ThreadPool *pool
+) {
+    uint32_t nodeCount = pingPong == 0
+                       ? terraincpu_SplitPass(leb, terrain, pool)
+                       : terraincpu_MergePass(leb, terrain, pool);
+
+    lebcpu__ComputeSumReduction(leb, pool);
+
+    return nodeCount;
+}
+
+// IDs of the leaves that pass the culling test (or of all the leaves if
+// terrain->cull is false), in the order of their handles
+template <typename Heap> inline void
+terraincpu_VisibleNodes(
+    const Heap *leb,
+    const terraincpu_Terrain *terrain,
+    lebcpu_ThreadPool *pool,
+    std::vector<uint32_t> *nodeIDs
+) {
+    const uint32_t nodeCount = lebcpu_NodeCount(leb);
+
+    nodeIDs->resize(nodeCount);
+
+    // culled leaves leave a zero, which is never the ID of a node
+    lebcpu_ParallelFor(pool, nodeCount, LEBCPU_GRAIN_SIZE,
+                       [&](uint32_t begin, uint32_t end) {
+        leb_Node nodes[LEBCPU_BATCH_SIZE];
+        uint32_t handles[LEBCPU_BATCH_SIZE];
+        int batchSize = 0;
+        auto flush = [&]() {
+            float vertices[LEBCPU_BATCH_SIZE][3][3];
+
+            terraincpu_DecodeTriangleVertices(terrain, nodes, batchSize, vertices);
+
+            for (int i = 0; i < batchSize; ++i) {
+                bool visible = terraincpu_FrustumCullingTest(terrain, vertices[i]);
+
+                (*nodeIDs)[handles[i]] = visible ? nodes[i].id : 0u;
+            }
+            batchSize = 0;
+        };
+
+        lebcpu_ForEachLeaf(leb, begin, end, [&](uint32_t handle, const leb_Node node) {
+            if (!terrain->cull) {
+                (*nodeIDs)[handle] = node.id;
+                return;
+            }
+
+            nodes[batchSize] = node;
+            handles[batchSize] = handle;
+
+            if (++batchSize == LEBCPU_BATCH_SIZE)
+                flush();
+        });
+
+        if (batchSize > 0)
+            flush();
+    });
+
+    if (terrain->cull)
+        nodeIDs->erase(std::remove(nodeIDs->begin(), nodeIDs->end(), 0u),
+                       nodeIDs->end());
+}
+
+#endif // TERRAINCPU_INCLUDE_TERRAINCPU_H